@@ -0,0 +1,441 @@
+/*
+ * Workload benchmark for a mounted rufs (or any other fs)
+ *
+ * usage: ./bench [-d MOUNTDIR] [-w WORKLOAD[,WORKLOAD..]] [-s IOSIZE[,IOSIZE..]] [-n OPS]
+ *                [-t THREADS] [-S FILESIZE] [-D DEPTH]
+ *
+ * workloads: seqwrite seqread randwrite randread create stat readdir unlink lookup (default: all)
+ * sizes take a K or M suffix. prints one JSON object per workload and io size on stdout, with
+ * wall clock ops/s, MB/s and p50/p99/p999 latency in microseconds. everything it makes goes
+ * in MOUNTDIR/bench.PID, so runs do not collide
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* default mount point, -d overrides it */
+#define TESTDIR "/tmp/dsp187/mountdir"
+
+#define FSPATHLEN 1024
+#define FILEPERM 0666
+#define DIRPERM 0755
+#define MAX_SIZES 16
+/* rufs dirs hold about 300 entries, so files of the metadata workloads are spread over subdirs */
+#define FILES_PER_DIR 200
+
+struct config {
+	const char *mountdir;
+	char basedir[FSPATHLEN];
+	int nops;			/* ops per thread */
+	int nthreads;
+	size_t file_size;	/* of the file the data workloads work on. rufs files stop at 64K */
+	int depth;			/* of the lookup workload's path */
+	size_t io_size;		/* of the run going on */
+};
+static struct config cfg = { TESTDIR, "", 1000, 1, 64 * 1024, 16, 4096 };
+
+struct thread_ctx {
+	int id;
+	char dir[FSPATHLEN];
+	uint64_t *lat;		/* ns of each op */
+	int nlat;
+	uint64_t bytes;
+	int errors;
+	unsigned int seed;
+	pthread_barrier_t *start;
+};
+
+struct workload {
+	const char *name;
+	int uses_io_size;
+	int (*prep)(struct thread_ctx *t);		/* untimed setup, 0 on sucess */
+	int (*run)(struct thread_ctx *t);		/* the timed ops, fills t->lat */
+};
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void die(const char *what) {
+	perror(what);
+	exit(1);
+}
+
+static void file_path(struct thread_ctx *t, int i, char *out) {
+	snprintf(out, FSPATHLEN, "%s/d%d/f%d", t->dir, i / FILES_PER_DIR, i);
+}
+
+/*
+ * data workloads. each thread has one file of cfg.file_size and goes through it
+ * cfg.nops times io_size at a time, wrapping around at the end
+ */
+static int data_prep(struct thread_ctx *t) {
+	char path[FSPATHLEN];
+	snprintf(path, FSPATHLEN, "%s/data", t->dir);
+	int fd = open(path, O_RDWR | O_CREAT, FILEPERM);
+	if (fd < 0)
+		return -1;
+	char *buf = malloc(cfg.file_size);
+	memset(buf, 0x61 + t->id, cfg.file_size);
+	ssize_t n = pwrite(fd, buf, cfg.file_size, 0);
+	free(buf);
+	close(fd);
+	return n == (ssize_t)cfg.file_size ? 0 : -1;
+}
+
+static int data_run(struct thread_ctx *t, int writing, int random) {
+	char path[FSPATHLEN];
+	snprintf(path, FSPATHLEN, "%s/data", t->dir);
+	int fd = open(path, O_RDWR);
+	if (fd < 0)
+		return -1;
+	char *buf = malloc(cfg.io_size);
+	memset(buf, 0x41 + t->id, cfg.io_size);
+	off_t slots = cfg.file_size / cfg.io_size;
+	if (slots == 0)
+		slots = 1;
+	pthread_barrier_wait(t->start);
+	for (int i = 0; i < cfg.nops; i++) {
+		off_t off = (random ? rand_r(&t->seed) % slots : i % slots) * cfg.io_size;
+		uint64_t t0 = now_ns();
+		ssize_t n = writing ? pwrite(fd, buf, cfg.io_size, off) : pread(fd, buf, cfg.io_size, off);
+		t->lat[t->nlat++] = now_ns() - t0;
+		if (n < 0)
+			t->errors++;
+		else
+			t->bytes += n;
+	}
+	free(buf);
+	close(fd);
+	return 0;
+}
+
+static int seqwrite_run(struct thread_ctx *t) { return data_run(t, 1, 0); }
+static int seqread_run(struct thread_ctx *t) { return data_run(t, 0, 0); }
+static int randwrite_run(struct thread_ctx *t) { return data_run(t, 1, 1); }
+static int randread_run(struct thread_ctx *t) { return data_run(t, 0, 1); }
+
+/*
+ * metadata workloads on cfg.nops empty files per thread. create makes them, stat, readdir
+ * and unlink work on the ones it left behind
+ */
+static int subdirs_prep(struct thread_ctx *t) {
+	char path[FSPATHLEN];
+	for (int d = 0; d * FILES_PER_DIR < cfg.nops; d++) {
+		snprintf(path, FSPATHLEN, "%s/d%d", t->dir, d);
+		if (mkdir(path, DIRPERM) < 0 && errno != EEXIST)
+			return -1;
+	}
+	return 0;
+}
+
+/* stat, readdir and unlink can also run without create, the files are made untimed then */
+static int files_prep(struct thread_ctx *t) {
+	char path[FSPATHLEN];
+	struct stat st;
+	if (subdirs_prep(t) < 0)
+		return -1;
+	for (int i = 0; i < cfg.nops; i++) {
+		file_path(t, i, path);
+		if (stat(path, &st) == 0)
+			continue;
+		int fd = creat(path, FILEPERM);
+		if (fd < 0)
+			return -1;
+		close(fd);
+	}
+	return 0;
+}
+
+static int create_run(struct thread_ctx *t) {
+	char path[FSPATHLEN];
+	pthread_barrier_wait(t->start);
+	for (int i = 0; i < cfg.nops; i++) {
+		file_path(t, i, path);
+		uint64_t t0 = now_ns();
+		int fd = creat(path, FILEPERM);
+		if (fd >= 0)
+			close(fd);
+		t->lat[t->nlat++] = now_ns() - t0;
+		if (fd < 0)
+			t->errors++;
+	}
+	return 0;
+}
+
+static int stat_run(struct thread_ctx *t) {
+	char path[FSPATHLEN];
+	struct stat st;
+	pthread_barrier_wait(t->start);
+	for (int i = 0; i < cfg.nops; i++) {
+		file_path(t, rand_r(&t->seed) % cfg.nops, path);
+		uint64_t t0 = now_ns();
+		int ret = stat(path, &st);
+		t->lat[t->nlat++] = now_ns() - t0;
+		if (ret < 0)
+			t->errors++;
+	}
+	return 0;
+}
+
+/* one op is a whole opendir/readdir/closedir of one of the subdirs */
+static int readdir_run(struct thread_ctx *t) {
+	char path[FSPATHLEN];
+	int ndirs = (cfg.nops + FILES_PER_DIR - 1) / FILES_PER_DIR;
+	pthread_barrier_wait(t->start);
+	for (int i = 0; i < cfg.nops; i++) {
+		snprintf(path, FSPATHLEN, "%s/d%d", t->dir, i % ndirs);
+		uint64_t t0 = now_ns();
+		DIR *dir = opendir(path);
+		if (dir != NULL) {
+			while (readdir(dir) != NULL)
+				;
+			closedir(dir);
+		}
+		t->lat[t->nlat++] = now_ns() - t0;
+		if (dir == NULL)
+			t->errors++;
+	}
+	return 0;
+}
+
+static int unlink_run(struct thread_ctx *t) {
+	char path[FSPATHLEN];
+	pthread_barrier_wait(t->start);
+	for (int i = 0; i < cfg.nops; i++) {
+		file_path(t, i, path);
+		uint64_t t0 = now_ns();
+		int ret = unlink(path);
+		t->lat[t->nlat++] = now_ns() - t0;
+		if (ret < 0)
+			t->errors++;
+	}
+	return 0;
+}
+
+/* stat of a file cfg.depth dirs down, so every op walks the whole path */
+static void deep_path(struct thread_ctx *t, int levels, char *out) {
+	int len = snprintf(out, FSPATHLEN, "%s", t->dir);
+	for (int l = 0; l < levels; l++)
+		len += snprintf(out + len, FSPATHLEN - len, "/l%d", l);
+}
+
+static int lookup_prep(struct thread_ctx *t) {
+	char path[FSPATHLEN];
+	for (int l = 1; l <= cfg.depth; l++) {
+		deep_path(t, l, path);
+		if (mkdir(path, DIRPERM) < 0 && errno != EEXIST)
+			return -1;
+	}
+	deep_path(t, cfg.depth, path);
+	strncat(path, "/leaf", FSPATHLEN - strlen(path) - 1);
+	int fd = creat(path, FILEPERM);
+	if (fd < 0)
+		return -1;
+	close(fd);
+	return 0;
+}
+
+static int lookup_run(struct thread_ctx *t) {
+	char path[FSPATHLEN];
+	struct stat st;
+	deep_path(t, cfg.depth, path);
+	strncat(path, "/leaf", FSPATHLEN - strlen(path) - 1);
+	pthread_barrier_wait(t->start);
+	for (int i = 0; i < cfg.nops; i++) {
+		uint64_t t0 = now_ns();
+		int ret = stat(path, &st);
+		t->lat[t->nlat++] = now_ns() - t0;
+		if (ret < 0)
+			t->errors++;
+	}
+	return 0;
+}
+
+static struct workload workloads[] = {
+	{ "seqwrite", 1, data_prep, seqwrite_run },
+	{ "seqread", 1, data_prep, seqread_run },
+	{ "randwrite", 1, data_prep, randwrite_run },
+	{ "randread", 1, data_prep, randread_run },
+	{ "create", 0, subdirs_prep, create_run },
+	{ "stat", 0, files_prep, stat_run },
+	{ "readdir", 0, files_prep, readdir_run },
+	{ "unlink", 0, files_prep, unlink_run },
+	{ "lookup", 0, lookup_prep, lookup_run },
+};
+#define N_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static struct workload *current;
+
+static void *thread_main(void *arg) {
+	struct thread_ctx *t = arg;
+	if (current->run(t) < 0) {
+		fprintf(stderr, "%s: thread %d could not start\n", current->name, t->id);
+		t->errors += cfg.nops;
+		pthread_barrier_wait(t->start);
+	}
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile_us(uint64_t *sorted, int n, double p) {
+	if (n == 0)
+		return 0;
+	int i = (int)(p * n);
+	if (i >= n)
+		i = n - 1;
+	return sorted[i] / 1000.0;
+}
+
+static void run_workload(struct workload *w, struct thread_ctx *threads) {
+	pthread_t tids[cfg.nthreads];
+	pthread_barrier_t start;
+	pthread_barrier_init(&start, NULL, cfg.nthreads + 1);
+	current = w;
+	for (int i = 0; i < cfg.nthreads; i++) {
+		struct thread_ctx *t = &threads[i];
+		t->nlat = 0;
+		t->bytes = 0;
+		t->errors = 0;
+		t->start = &start;
+		if (w->prep != NULL && w->prep(t) < 0)
+			die(w->name);
+		pthread_create(&tids[i], NULL, thread_main, t);
+	}
+	// every thread is set up and waiting, and none of them goes before this one joins the barrier
+	uint64_t t0 = now_ns();
+	pthread_barrier_wait(&start);
+	for (int i = 0; i < cfg.nthreads; i++)
+		pthread_join(tids[i], NULL);
+	double secs = (now_ns() - t0) / 1e9;
+	pthread_barrier_destroy(&start);
+
+	int n = 0, errors = 0;
+	uint64_t bytes = 0;
+	uint64_t *all = malloc(sizeof(uint64_t) * cfg.nops * cfg.nthreads);
+	for (int i = 0; i < cfg.nthreads; i++) {
+		memcpy(all + n, threads[i].lat, threads[i].nlat * sizeof(uint64_t));
+		n += threads[i].nlat;
+		bytes += threads[i].bytes;
+		errors += threads[i].errors;
+	}
+	qsort(all, n, sizeof(uint64_t), cmp_u64);
+	printf("{\"workload\":\"%s\",\"io_size\":%zu,\"threads\":%d,\"ops\":%d,\"errors\":%d,"
+		"\"secs\":%.6f,\"ops_per_s\":%.1f,\"mb_per_s\":%.3f,"
+		"\"p50_us\":%.2f,\"p99_us\":%.2f,\"p999_us\":%.2f}\n",
+		w->name, w->uses_io_size ? cfg.io_size : 0, cfg.nthreads, n, errors,
+		secs, secs > 0 ? n / secs : 0, secs > 0 ? bytes / secs / (1024 * 1024) : 0,
+		percentile_us(all, n, 0.50), percentile_us(all, n, 0.99), percentile_us(all, n, 0.999));
+	fflush(stdout);
+	free(all);
+}
+
+static size_t parse_size(const char *str) {
+	char *end;
+	size_t size = strtoul(str, &end, 10);
+	if (*end == 'K' || *end == 'k')
+		size <<= 10;
+	else if (*end == 'M' || *end == 'm')
+		size <<= 20;
+	return size;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-d MOUNTDIR] [-w WORKLOAD[,WORKLOAD..]] [-s IOSIZE[,IOSIZE..]] [-n OPS] "
+		"[-t THREADS] [-S FILESIZE] [-D DEPTH]\nworkloads:", prog);
+	for (int i = 0; i < N_WORKLOADS; i++)
+		fprintf(stderr, " %s", workloads[i].name);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	char *wl_list = NULL;
+	size_t sizes[MAX_SIZES] = { 4096 };
+	int nsizes = 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "d:w:s:n:t:S:D:")) != -1) {
+		switch (opt) {
+		case 'd': cfg.mountdir = optarg; break;
+		case 'w': wl_list = optarg; break;
+		case 's':
+			nsizes = 0;
+			for (char *tok = strtok(optarg, ","); tok != NULL && nsizes < MAX_SIZES; tok = strtok(NULL, ","))
+				sizes[nsizes++] = parse_size(tok);
+			break;
+		case 'n': cfg.nops = atoi(optarg); break;
+		case 't': cfg.nthreads = atoi(optarg); break;
+		case 'S': cfg.file_size = parse_size(optarg); break;
+		case 'D': cfg.depth = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (cfg.nops <= 0 || cfg.nthreads <= 0 || cfg.file_size == 0 || cfg.depth <= 0 || nsizes == 0)
+		usage(argv[0]);
+	for (int i = 0; i < nsizes; i++) {
+		if (sizes[i] == 0)
+			usage(argv[0]);
+	}
+
+	// which workloads, in the order of the table so create runs before what needs its files
+	int selected[N_WORKLOADS] = { 0 };
+	if (wl_list == NULL) {
+		for (int i = 0; i < N_WORKLOADS; i++)
+			selected[i] = 1;
+	} else {
+		for (char *tok = strtok(wl_list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+			int i;
+			for (i = 0; i < N_WORKLOADS && strcmp(tok, workloads[i].name) != 0; i++)
+				;
+			if (i == N_WORKLOADS)
+				usage(argv[0]);
+			selected[i] = 1;
+		}
+	}
+
+	snprintf(cfg.basedir, FSPATHLEN, "%s/bench.%d", cfg.mountdir, (int)getpid());
+	if (mkdir(cfg.basedir, DIRPERM) < 0)
+		die(cfg.basedir);
+	struct thread_ctx *threads = calloc(cfg.nthreads, sizeof(struct thread_ctx));
+	for (int i = 0; i < cfg.nthreads; i++) {
+		threads[i].id = i;
+		threads[i].seed = 1234 + i;
+		threads[i].lat = malloc(sizeof(uint64_t) * cfg.nops);
+		snprintf(threads[i].dir, FSPATHLEN, "%s/t%d", cfg.basedir, i);
+		if (mkdir(threads[i].dir, DIRPERM) < 0)
+			die(threads[i].dir);
+	}
+
+	for (int i = 0; i < N_WORKLOADS; i++) {
+		if (!selected[i])
+			continue;
+		if (!workloads[i].uses_io_size) {
+			run_workload(&workloads[i], threads);
+			continue;
+		}
+		for (int s = 0; s < nsizes; s++) {
+			cfg.io_size = sizes[s];
+			run_workload(&workloads[i], threads);
+		}
+	}
+
+	for (int i = 0; i < cfg.nthreads; i++)
+		free(threads[i].lat);
+	free(threads);
+	return 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * Microbenchmarks of librufs internals: the allocator, inode table, dir lookup and path walk
+ *
+ * usage: ./microbench [-f SCRATCH_IMAGE] [-n OPS]
+ *
+ * everything runs in process against a scratch image that is made fresh and removed after.
+ * prints one JSON object per scenario on stdout with ns/op and the DISKFILE syscalls per op
+ * (dev_syscalls of block.c)
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "../block.h"
+#include "../rufs.h"
+#include "../librufs.h"
+
+/* internals of librufs.c that are not part of its API */
+int get_avail_blkno(uint32_t goal);
+void release_blkno(int blkno);
+void icache_drop();
+int readi(uint16_t ino, struct inode *inode);
+int writei(uint16_t ino, struct inode *inode);
+int dir_find(uint16_t ino, const char *fname, size_t name_len, struct dirent *final_dirent);
+int get_node_by_path(const char *const_path, uint16_t ino, struct inode *final_inode);
+extern struct superblock *sb;
+
+#define SCRATCH "/tmp/rufs_microbench.img"
+#define FULL_DIR_FILES 300			/* a rufs dir takes about 304 entries */
+#define PATH_DEPTH 16
+#define FRAG_EVERY 64				/* the fragmented image has one free block in this many */
+
+static int nops = 100000;
+static unsigned int seed = 1234;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct timing {
+	uint64_t t0;
+	uint64_t sys0;
+};
+
+static void start(struct timing *t) {
+	t->sys0 = dev_syscalls;
+	t->t0 = now_ns();
+}
+
+static void report(struct timing *t, const char *scenario, int n) {
+	uint64_t ns = now_ns() - t->t0;
+	uint64_t sys = dev_syscalls - t->sys0;
+	printf("{\"scenario\":\"%s\",\"ops\":%d,\"ns_per_op\":%.1f,\"syscalls_per_op\":%.3f}\n",
+		scenario, n, (double)ns / n, (double)sys / n);
+	fflush(stdout);
+}
+
+/* the bitmap helpers of rufs.h on one bitmap block */
+static void bench_bitmap(void) {
+	unsigned char bm[BLOCK_SIZE] = { 0 };
+	int *idx = malloc(nops * sizeof(int));
+	for (int k = 0; k < nops; k++)
+		idx[k] = rand_r(&seed) % (BLOCK_SIZE * 8);
+	struct timing t;
+	volatile int sink = 0;
+	start(&t);
+	for (int k = 0; k < nops; k++) {
+		set_bitmap(bm, idx[k]);
+		sink += get_bitmap(bm, idx[k]);
+		unset_bitmap(bm, idx[k]);
+	}
+	report(&t, "bitmap_set_get_unset", nops);
+	free(idx);
+}
+
+/* one op is taking a data block near a random goal and giving it back */
+static void bench_alloc(const char *scenario) {
+	struct timing t;
+	start(&t);
+	for (int k = 0; k < nops; k++) {
+		int b = get_avail_blkno(rand_r(&seed) % sb->nr_dblocks);
+		if (b == INVALID_DBLOCK) {
+			fprintf(stderr, "%s: out of data blocks\n", scenario);
+			exit(1);
+		}
+		release_blkno(b);
+	}
+	report(&t, scenario, nops);
+}
+
+/*
+ * takes every free data block and gives back one in FRAG_EVERY of them, so every search has to
+ * skip taken ones. only blocks taken here go back, the dirs made before keep theirs
+ */
+static void fragment(void) {
+	int *taken = malloc(sb->nr_dblocks * sizeof(int));
+	int count = 0, b;
+	while ((b = get_avail_blkno(0)) != INVALID_DBLOCK)
+		taken[count++] = b;
+	for (int k = 0; k < count; k += FRAG_EVERY)
+		release_blkno(taken[k]);
+	free(taken);
+}
+
+static void bench_inodes(uint16_t *inos, int count) {
+	struct inode in;
+	struct timing t;
+	start(&t);
+	for (int k = 0; k < nops; k++)
+		readi(inos[rand_r(&seed) % count], &in);
+	report(&t, "readi_cached", nops);
+
+	// the cache is dropped before every read, so each one goes to the DISKFILE
+	int cold = nops / 10 > 0 ? nops / 10 : 1;
+	start(&t);
+	for (int k = 0; k < cold; k++) {
+		icache_drop();
+		readi(inos[rand_r(&seed) % count], &in);
+	}
+	report(&t, "readi_uncached", cold);
+
+	start(&t);
+	for (int k = 0; k < nops; k++) {
+		uint16_t ino = inos[rand_r(&seed) % count];
+		readi(ino, &in);
+		writei(ino, &in);
+	}
+	report(&t, "readi_writei", nops);
+}
+
+static void bench_dir(uint16_t dir_ino) {
+	char name[64];
+	struct dirent de;
+	struct timing t;
+	start(&t);
+	for (int k = 0; k < nops; k++) {
+		snprintf(name, sizeof(name), "f%d", rand_r(&seed) % FULL_DIR_FILES);
+		dir_find(dir_ino, name, strlen(name), &de);
+	}
+	report(&t, "dir_find_hit_full_dir", nops);
+
+	start(&t);
+	for (int k = 0; k < nops; k++) {
+		snprintf(name, sizeof(name), "nope%d", k);
+		dir_find(dir_ino, name, strlen(name), NULL);
+	}
+	report(&t, "dir_find_miss_full_dir", nops);
+
+	// the same misses with no bloom filter, a whole scan each
+	bloom_enabled = 0;
+	start(&t);
+	for (int k = 0; k < nops; k++) {
+		snprintf(name, sizeof(name), "nope%d", k);
+		dir_find(dir_ino, name, strlen(name), NULL);
+	}
+	report(&t, "dir_find_miss_full_dir_nobloom", nops);
+	bloom_enabled = 1;
+}
+
+static void bench_path(const char *path) {
+	struct inode in;
+	struct timing t;
+	start(&t);
+	for (int k = 0; k < nops; k++)
+		get_node_by_path(path, 0, &in);
+	report(&t, "get_node_by_path_depth16", nops);
+}
+
+int main(int argc, char **argv) {
+	const char *image = SCRATCH;
+	int opt;
+	while ((opt = getopt(argc, argv, "f:n:r")) != -1) {
+		switch (opt) {
+		case 'f': image = optarg; break;
+		case 'n': nops = atoi(optarg); break;
+		case 'r': dev_select("ram"); break;
+		default:
+			fprintf(stderr, "usage: %s [-f SCRATCH_IMAGE] [-n OPS] [-r]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nops <= 0)
+		return 1;
+
+	unlink(image);
+	disk_size = 64 * 1024 * 1024;
+	if (rufs_mount(image) != 0)
+		return 1;
+
+	bench_bitmap();
+	bench_alloc("get_avail_blkno_fresh");
+
+	// a full dir and a deep path, all inodes of which go into the inode benchmarks
+	uint16_t inos[FULL_DIR_FILES + PATH_DEPTH + 1];
+	int count = 0;
+	uint16_t dir_ino;
+	char path[1024];
+	rufs_mkdir("/full", 0755);
+	rufs_opendir("/full", &dir_ino);
+	inos[count++] = dir_ino;
+	for (int k = 0; k < FULL_DIR_FILES; k++) {
+		snprintf(path, sizeof(path), "/full/f%d", k);
+		if (rufs_create(path, 0644, &inos[count]) == 0)
+			count++;
+	}
+	int len = 0;
+	for (int l = 0; l < PATH_DEPTH; l++) {
+		len += snprintf(path + len, sizeof(path) - len, "/l%d", l);
+		rufs_mkdir(path, 0755);
+		rufs_opendir(path, &inos[count++]);
+	}
+
+	bench_inodes(inos, count);
+	bench_dir(dir_ino);
+	bench_path(path);
+
+	fragment();
+	bench_alloc("get_avail_blkno_fragmented");
+
+	rufs_unmount();
+	unlink(image);
+	return 0;
+}
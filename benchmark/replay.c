@@ -0,0 +1,350 @@
+/*
+ * Replay a capture of ./rufs --capture=FILE
+ *
+ * usage: ./replay (-d MOUNTDIR | -i IMAGE) [-p] CAPTUREFILE
+ *
+ * issues every captured operation again, in the order they started, either through the
+ * syscalls on a mounted fs (-d, any fs works) or straight into librufs on IMAGE (-i, no
+ * mount). as fast as it can, or with -p at the pacing they were captured at. replay on a
+ * copy of the image the capture started from, or the ops on files it does not have fail.
+ * prints one JSON object per operation type with the replayed p50/p99/p999 latency next to
+ * the captured p50/p99, and how many ops came out differently (diverged) than captured
+ *
+ * ioctls are counted but not issued, their argument is not in the capture. threads are
+ * replayed one after another on a single thread
+ */
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "../librufs.h"
+#include "../capture.h"
+
+#define FSPATHLEN 4096
+#define HANDLE_SLOTS 4096
+
+static const char *op_names[TRACE_OP_COUNT] = RUFS_OP_NAMES;
+
+static const char *mountdir = NULL;
+static int paced = 0;
+static char *iobuf;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile_us(uint64_t *sorted, int n, double p) {
+	if (n == 0)
+		return 0;
+	int i = (int)(p * n);
+	if (i >= n)
+		i = n - 1;
+	return sorted[i] / 1000.0;
+}
+
+/*
+ * open files by path: an fd with -d, an inode number with -i. chained, the capture may
+ * hold any number of paths
+ */
+struct handle {
+	char *path;
+	int h;
+	struct handle *next;
+};
+static struct handle *handles[HANDLE_SLOTS];
+
+static struct handle **handle_slot(const char *path) {
+	uint32_t hash = 2166136261u;
+	for (const char *c = path; *c != '\0'; c++)
+		hash = (hash ^ (unsigned char)*c) * 16777619u;
+	struct handle **p = &handles[hash % HANDLE_SLOTS];
+	while (*p != NULL && strcmp((*p)->path, path) != 0)
+		p = &(*p)->next;
+	return p;
+}
+
+static void handle_put(const char *path, int h) {
+	struct handle **p = handle_slot(path);
+	if (*p == NULL) {
+		*p = calloc(1, sizeof(struct handle));
+		(*p)->path = strdup(path);
+	} else if (mountdir != NULL) {
+		close((*p)->h);
+	}
+	(*p)->h = h;
+}
+
+/* the handle of path, opening it first if the capture did that before it started */
+static int handle_get(const char *path) {
+	struct handle **p = handle_slot(path);
+	if (*p != NULL)
+		return (*p)->h;
+	int h;
+	if (mountdir != NULL) {
+		h = open(path, O_RDWR);
+		if (h < 0)
+			return -1;
+	} else {
+		uint16_t ino;
+		if (rufs_open(path, &ino) != 0)
+			return -1;
+		h = ino;
+	}
+	handle_put(path, h);
+	return h;
+}
+
+static void handle_drop(const char *path) {
+	struct handle **p = handle_slot(path);
+	if (*p == NULL)
+		return;
+	struct handle *h = *p;
+	*p = h->next;
+	if (mountdir != NULL)
+		close(h->h);
+	free(h->path);
+	free(h);
+}
+
+static int count_name(void *ctx, const char *name) {
+	(*(int *)ctx)++;
+	return 0;
+}
+
+/* rec through the syscalls on path (under mountdir). returns like the FUSE op would */
+static int replay_mounted(struct capture_rec *rec, const char *path) {
+	struct stat st;
+	DIR *dir;
+	int fd, ret;
+	switch (rec->op) {
+	case OP_GETATTR:
+		return lstat(path, &st) == 0 ? 0 : -errno;
+	case OP_OPENDIR:
+	case OP_READDIR:
+		if ((dir = opendir(path)) == NULL)
+			return -errno;
+		if (rec->op == OP_READDIR)
+			while (readdir(dir) != NULL)
+				;
+		closedir(dir);
+		return 0;
+	case OP_MKDIR:
+		return mkdir(path, rec->arg) == 0 ? 0 : -errno;
+	case OP_RMDIR:
+		return rmdir(path) == 0 ? 0 : -errno;
+	case OP_CREATE:
+	case OP_OPEN:
+		fd = open(path, rec->op == OP_CREATE ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, rec->arg);
+		if (fd < 0)
+			return -errno;
+		handle_put(path, fd);
+		return 0;
+	case OP_UNLINK:
+		handle_drop(path);
+		return unlink(path) == 0 ? 0 : -errno;
+	case OP_READ:
+	case OP_WRITE:
+	case OP_FALLOCATE:
+		if ((fd = handle_get(path)) < 0)
+			return -errno;
+		if (rec->op == OP_READ)
+			ret = pread(fd, iobuf, rec->size, rec->offset);
+		else if (rec->op == OP_WRITE)
+			ret = pwrite(fd, iobuf, rec->size, rec->offset);
+		else
+			ret = fallocate(fd, rec->arg, rec->offset, rec->size);
+		return ret < 0 ? -errno : ret;
+	case OP_FLUSH:
+		// the kernel flushes on close, the file is opened again when it is next used
+		handle_drop(path);
+		return 0;
+	}
+	return 0;
+}
+
+/* rec straight into librufs */
+static int replay_inprocess(struct capture_rec *rec, const char *path) {
+	struct stat st;
+	uint16_t ino;
+	int h, names = 0;
+	switch (rec->op) {
+	case OP_GETATTR:
+		return rufs_getattr(path, &st);
+	case OP_OPENDIR:
+		return rufs_opendir(path, &ino);
+	case OP_READDIR:
+		return rufs_readdir(path, count_name, &names);
+	case OP_MKDIR:
+		return rufs_mkdir(path, rec->arg);
+	case OP_RMDIR:
+		return rufs_rmdir(path);
+	case OP_CREATE:
+	case OP_OPEN:
+		h = (rec->op == OP_CREATE) ? rufs_create(path, rec->arg, &ino) : rufs_open(path, &ino);
+		if (h == 0)
+			handle_put(path, ino);
+		return h;
+	case OP_UNLINK:
+		handle_drop(path);
+		return rufs_unlink(path);
+	case OP_READ:
+	case OP_WRITE:
+	case OP_FALLOCATE:
+		if ((h = handle_get(path)) < 0)
+			return -ENOENT;
+		if (rec->op == OP_READ)
+			return rufs_read(h, iobuf, rec->size, rec->offset);
+		if (rec->op == OP_WRITE)
+			return rufs_write(h, iobuf, rec->size, rec->offset);
+		return rufs_fallocate(h, rec->arg, rec->offset, rec->size);
+	case OP_FLUSH:
+		return rufs_flush();
+	}
+	return 0;
+}
+
+/* a record copied out of the capture, which packs them with no alignment */
+struct entry {
+	struct capture_rec rec;
+	const char *path;
+};
+
+static int by_start(const void *a, const void *b) {
+	const struct entry *x = a, *y = b;
+	return (x->rec.ts_ns > y->rec.ts_ns) - (x->rec.ts_ns < y->rec.ts_ns);
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s (-d MOUNTDIR | -i IMAGE) [-p] CAPTUREFILE\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	const char *image = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "d:i:p")) != -1) {
+		switch (opt) {
+		case 'd': mountdir = optarg; break;
+		case 'i': image = optarg; break;
+		case 'p': paced = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || (mountdir == NULL) == (image == NULL))
+		usage(argv[0]);
+
+	// Step 1: read the whole capture and index its records
+	FILE *f = fopen(argv[optind], "rb");
+	if (f == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *data = malloc(len > 0 ? len : 1);
+	if (len < 8 || fread(data, 1, len, f) != len || memcmp(data, CAPTURE_MAGIC, 8) != 0) {
+		fprintf(stderr, "%s: not a rufs capture\n", argv[optind]);
+		return 1;
+	}
+	fclose(f);
+	int n = 0, cap = 1024;
+	struct entry *recs = malloc(cap * sizeof(*recs));
+	size_t max_io = 4096;
+	for (long pos = 8; pos + (long)sizeof(struct capture_rec) <= len; ) {
+		struct capture_rec rec;
+		memcpy(&rec, data + pos, sizeof(rec));
+		if (pos + sizeof(rec) + rec.path_len > len || rec.op >= OP_COUNT)
+			break;
+		if (n == cap)
+			recs = realloc(recs, (cap *= 2) * sizeof(*recs));
+		recs[n].rec = rec;
+		recs[n++].path = data + pos + sizeof(rec);
+		if ((rec.op == OP_READ || rec.op == OP_WRITE) && rec.size > max_io)
+			max_io = rec.size;
+		pos += sizeof(rec) + rec.path_len;
+	}
+	qsort(recs, n, sizeof(*recs), by_start);
+	// the mount may have sat idle before the first op, pacing starts from there
+	uint64_t base = n > 0 ? recs[0].rec.ts_ns : 0;
+	iobuf = malloc(max_io);
+	memset(iobuf, 'r', max_io);
+
+	if (image != NULL && rufs_mount(image) != 0) {
+		fprintf(stderr, "%s: can not mount it\n", image);
+		return 1;
+	}
+
+	// Step 2: issue them, keeping the latency of each
+	uint64_t *lat = malloc((n > 0 ? n : 1) * sizeof(uint64_t));
+	int *result = malloc((n > 0 ? n : 1) * sizeof(int));
+	char path[FSPATHLEN];
+	uint64_t start = now_ns();
+	for (int k = 0; k < n; k++) {
+		struct capture_rec *rec = &recs[k].rec;
+		int plen = snprintf(path, sizeof(path), "%s", mountdir != NULL ? mountdir : "");
+		snprintf(path + plen, sizeof(path) - plen, "%.*s", rec->path_len, recs[k].path);
+		if (paced) {
+			uint64_t due = start + rec->ts_ns - base;
+			uint64_t now = now_ns();
+			if (due > now) {
+				struct timespec ts = { (due - now) / 1000000000, (due - now) % 1000000000 };
+				nanosleep(&ts, NULL);
+			}
+		}
+		uint64_t t0 = now_ns();
+		if (rec->op == OP_IOCTL)
+			result[k] = rec->ret;
+		else
+			result[k] = (mountdir != NULL) ? replay_mounted(rec, path) : replay_inprocess(rec, path);
+		lat[k] = now_ns() - t0;
+	}
+	double secs = (now_ns() - start) / 1e9;
+	if (image != NULL)
+		rufs_unmount();
+
+	// Step 3: the report, one line per op type and a total
+	uint64_t *mine = malloc((n > 0 ? n : 1) * sizeof(uint64_t));
+	uint64_t *theirs = malloc((n > 0 ? n : 1) * sizeof(uint64_t));
+	int diverged_all = 0;
+	for (int op = 0; op < OP_COUNT; op++) {
+		int m = 0, errors = 0, diverged = 0;
+		for (int k = 0; k < n; k++) {
+			if (recs[k].rec.op != op)
+				continue;
+			mine[m] = lat[k];
+			theirs[m++] = recs[k].rec.dur_ns;
+			errors += (result[k] < 0);
+			diverged += ((result[k] < 0) != (recs[k].rec.ret < 0));
+		}
+		if (m == 0)
+			continue;
+		diverged_all += diverged;
+		qsort(mine, m, sizeof(uint64_t), cmp_u64);
+		qsort(theirs, m, sizeof(uint64_t), cmp_u64);
+		printf("{\"op\":\"%s\",\"ops\":%d,\"errors\":%d,\"diverged\":%d,%s"
+			"\"p50_us\":%.2f,\"p99_us\":%.2f,\"p999_us\":%.2f,\"captured_p50_us\":%.2f,\"captured_p99_us\":%.2f}\n",
+			op_names[op], m, errors, diverged, op == OP_IOCTL ? "\"skipped\":true," : "",
+			percentile_us(mine, m, 0.50), percentile_us(mine, m, 0.99), percentile_us(mine, m, 0.999),
+			percentile_us(theirs, m, 0.50), percentile_us(theirs, m, 0.99));
+	}
+	double captured_secs = n > 0 ? (recs[n - 1].rec.ts_ns + recs[n - 1].rec.dur_ns - base) / 1e9 : 0;
+	printf("{\"op\":\"all\",\"ops\":%d,\"diverged\":%d,\"paced\":%s,\"secs\":%.6f,\"ops_per_s\":%.1f,\"captured_secs\":%.6f}\n",
+		n, diverged_all, paced ? "true" : "false", secs, secs > 0 ? n / secs : 0, captured_secs);
+	return 0;
+}
@@ -7,6 +7,7 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,53 +15,276 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <linux/falloc.h>
 
 #include "block.h"
+#include "trace.h"
 
-//Disk size set to 32MB
-#define DISK_SIZE	32*1024*1024
+uint64_t dev_syscalls = 0;
+struct op_stat dev_read_stat;
+struct op_stat dev_write_stat;
 
-int diskfile = -1;
+static const struct dev_ops *dev = &file_dev;
 
-//Creates a file which is your new emulated disk
-void dev_init(const char* diskfile_path) {
-    if (diskfile >= 0) {
-		return;
-    }
-    
-    diskfile = open(diskfile_path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+/*
+ * the file backend, a DISKFILE on the host
+ */
+static int diskfile = -1;
+
+static void file_init(const char *path, const uint64_t size) {
+    diskfile = open(path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
     if (diskfile < 0) {
 		perror("disk_open failed");
 		exit(EXIT_FAILURE);
     }
 	
-    ftruncate(diskfile, DISK_SIZE);
+    ftruncate(diskfile, size);
+}
+
+static int file_open(const char *path) {
+    diskfile = open(path, O_RDWR, S_IRUSR | S_IWUSR);
+    if (diskfile < 0) {
+		perror("disk_open failed");
+		return -1;
+    }
+	return 0;
+}
+
+static void file_close() {
+    close(diskfile);
+}
+
+static int file_read(void *buf, const size_t len, const uint64_t off) {
+    dev_syscalls++;
+    return pread(diskfile, buf, len, (off_t)off);
+}
+
+static int file_write(const void *buf, const size_t len, const uint64_t off) {
+    dev_syscalls++;
+    return pwrite(diskfile, buf, len, (off_t)off);
+}
+
+static int file_flush() {
+    dev_syscalls++;
+    return fdatasync(diskfile);
+}
+
+//Punch a hole, so the host frees the space
+static int file_discard(const uint64_t off, const uint64_t len) {
+    dev_syscalls++;
+    return fallocate(diskfile, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)off, (off_t)len);
+}
+
+static int file_grow(const uint64_t size) {
+    dev_syscalls++;
+    return ftruncate(diskfile, (off_t)size);
+}
+
+static void file_readahead(const uint64_t off, const uint64_t len) {
+    dev_syscalls++;
+    posix_fadvise(diskfile, (off_t)off, (off_t)len, POSIX_FADV_WILLNEED);
+}
+
+const struct dev_ops file_dev = {
+	.name = "file",
+	.init = file_init,
+	.open = file_open,
+	.close = file_close,
+	.read = file_read,
+	.write = file_write,
+	.flush = file_flush,
+	.discard = file_discard,
+	.grow = file_grow,
+	.readahead = file_readahead,
+};
+
+/*
+ * the ram backend. the disk is one anonymous mapping: hugetlb pages if the host has some set
+ * aside, else normal pages the kernel is asked to back with transparent huge pages. either way
+ * a block is a memcpy away and the tlb covers 2MB of the disk per entry
+ */
+#define HUGE_PAGE (2*1024*1024)
+
+static char *ram = NULL;
+static uint64_t ram_size = 0;	// what the fs asked for, reads and writes past it are cut off
+static uint64_t ram_mapped = 0;
+static uint64_t ram_page = 0;	// HUGE_PAGE for hugetlb, else 4K
+
+//Map size zeroed bytes. sets ram_mapped and ram_page
+static char *ram_map(const uint64_t size) {
+    uint64_t huge = (size + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+    char *p = mmap(NULL, huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+		ram_mapped = huge;
+		ram_page = HUGE_PAGE;
+		return p;
+    }
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+		return NULL;
+    madvise(p, size, MADV_HUGEPAGE);
+    ram_mapped = size;
+    ram_page = BLOCK_SIZE;
+    return p;
+}
+
+static void ram_init(const char *path, const uint64_t size) {
+    ram = ram_map(size);
+    if (ram == NULL) {
+		perror("ram disk mmap failed");
+		exit(EXIT_FAILURE);
+    }
+    ram_size = size;
+}
+
+//There is never a ram disk left from before, so this always ends up in a mkfs
+static int ram_open(const char *path) {
+	return -1;
+}
+
+static void ram_close() {
+    munmap(ram, ram_mapped);
+    ram = NULL;
+    ram_size = 0;
 }
 
-//Function to open the disk file
+static int ram_read(void *buf, const size_t len, const uint64_t off) {
+    if (off >= ram_size)
+		return 0;
+    size_t n = (off + len > ram_size) ? ram_size - off : len;
+    memcpy(buf, ram + off, n);
+    return n;
+}
+
+static int ram_write(const void *buf, const size_t len, const uint64_t off) {
+    if (off >= ram_size)
+		return 0;
+    size_t n = (off + len > ram_size) ? ram_size - off : len;
+    memcpy(ram + off, buf, n);
+    return n;
+}
+
+static int ram_flush() {
+	return 0;
+}
+
+//Give the pages fully inside the range back and zero the rest, so it reads back as zeros like a hole
+static int ram_discard(const uint64_t off, const uint64_t len) {
+    uint64_t start = (off + ram_page - 1) / ram_page * ram_page;
+    uint64_t end = (off + len) / ram_page * ram_page;
+    if (start >= end) {
+		memset(ram + off, 0, len);
+		return 0;
+    }
+    memset(ram + off, 0, start - off);
+    memset(ram + end, 0, off + len - end);
+    dev_syscalls++;
+    // hugetlb mappings on older kernels refuse MADV_DONTNEED, those pages are zeroed by hand
+    if (madvise(ram + start, end - start, MADV_DONTNEED) < 0)
+		memset(ram + start, 0, end - start);
+    return 0;
+}
+
+//Let the kernel move the mapping. hugetlb ones it may not, those are copied into a new one
+static int ram_grow(const uint64_t size) {
+    if (size <= ram_mapped) {
+		ram_size = size;
+		return 0;
+    }
+    dev_syscalls++;
+    if (ram_page == BLOCK_SIZE) {
+		char *p = mremap(ram, ram_mapped, size, MREMAP_MAYMOVE);
+		if (p != MAP_FAILED) {
+			madvise(p, size, MADV_HUGEPAGE);
+			ram = p;
+			ram_mapped = size;
+			ram_size = size;
+			return 0;
+		}
+    }
+    uint64_t old_mapped = ram_mapped, old_page = ram_page;
+    char *p = ram_map(size);
+    if (p == NULL) {
+		ram_mapped = old_mapped;
+		ram_page = old_page;
+		return -1;
+    }
+    memcpy(p, ram, ram_size);
+    munmap(ram, old_mapped);
+    ram = p;
+    ram_size = size;
+    return 0;
+}
+
+static void ram_readahead(const uint64_t off, const uint64_t len) {
+}
+
+const struct dev_ops ram_dev = {
+	.name = "ram",
+	.init = ram_init,
+	.open = ram_open,
+	.close = ram_close,
+	.read = ram_read,
+	.write = ram_write,
+	.flush = ram_flush,
+	.discard = ram_discard,
+	.grow = ram_grow,
+	.readahead = ram_readahead,
+};
+
+/*
+ * what the fs calls. the same for every backend
+ */
+static const struct dev_ops *backends[] = { &file_dev, &ram_dev };
+static int dev_ready = 0;
+
+int dev_select(const char *name) {
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+		if (strcmp(backends[i]->name, name) == 0) {
+			dev = backends[i];
+			return 0;
+		}
+    }
+    return -1;
+}
+
+//Creates your new emulated disk, size bytes long
+void dev_init(const char* diskfile_path, const uint64_t size) {
+    if (dev_ready) {
+		return;
+    }
+    dev->init(diskfile_path, size);
+    dev_ready = 1;
+}
+
+//Function to open the disk
 int dev_open(const char* diskfile_path) {
-    if (diskfile >= 0) {
+    if (dev_ready) {
 		return 0;
     }
-    
-    diskfile = open(diskfile_path, O_RDWR, S_IRUSR | S_IWUSR);
-    if (diskfile < 0) {
-		perror("disk_open failed");
+    if (dev->open(diskfile_path) < 0) {
 		return -1;
     }
+    dev_ready = 1;
 	return 0;
 }
 
 void dev_close() {
-    if (diskfile >= 0) {
-		close(diskfile);
+    if (dev_ready) {
+		dev->close();
+		dev_ready = 0;
     }
 }
 
 //Read a block from the disk
-int bio_read(const int block_num, void *buf) {
+int bio_read(const uint64_t block_num, void *buf) {
     int retstat = 0;
-    retstat = pread(diskfile, buf, BLOCK_SIZE, block_num*BLOCK_SIZE);
+    uint64_t t0 = stat_clock();
+    retstat = dev->read(buf, BLOCK_SIZE, block_num*BLOCK_SIZE);
+    uint64_t t1 = stat_clock();
+    op_stat_record(&dev_read_stat, t1 - t0, retstat > 0 ? retstat : 0, retstat < 0);
+    TRACE_DEV(OP_DEV_READ, block_num*BLOCK_SIZE, BLOCK_SIZE, t0, t1, retstat);
     if (retstat <= 0) {
 		memset (buf, 0, BLOCK_SIZE);
 		if (retstat < 0)
@@ -70,13 +294,82 @@ int bio_read(const int block_num, void *buf) {
     return retstat;
 }
 
+//Read count neighbouring blocks from the disk in one go
+int bio_read_blocks(const uint64_t block_num, const int count, void *buf) {
+    int retstat = 0;
+    uint64_t t0 = stat_clock();
+    retstat = dev->read(buf, (size_t)count*BLOCK_SIZE, block_num*BLOCK_SIZE);
+    uint64_t t1 = stat_clock();
+    op_stat_record(&dev_read_stat, t1 - t0, retstat > 0 ? retstat : 0, retstat < 0);
+    TRACE_DEV(OP_DEV_READ, block_num*BLOCK_SIZE, count*BLOCK_SIZE, t0, t1, retstat);
+    if (retstat < count*BLOCK_SIZE) {
+		memset ((char *)buf + (retstat > 0 ? retstat : 0), 0, (size_t)count*BLOCK_SIZE - (retstat > 0 ? retstat : 0));
+		if (retstat < 0)
+			perror("block_read failed");
+    }
+
+    return retstat;
+}
+
 //Write a block to the disk
-int bio_write(const int block_num, const void *buf) {
+int bio_write(const uint64_t block_num, const void *buf) {
+    int retstat = 0;
+    uint64_t t0 = stat_clock();
+    retstat = dev->write(buf, BLOCK_SIZE, block_num*BLOCK_SIZE);
+    uint64_t t1 = stat_clock();
+    op_stat_record(&dev_write_stat, t1 - t0, retstat > 0 ? retstat : 0, retstat < 0);
+    TRACE_DEV(OP_DEV_WRITE, block_num*BLOCK_SIZE, BLOCK_SIZE, t0, t1, retstat);
+    if (retstat < 0) {
+		    perror("block_write failed");
+    }
+    return retstat;
+}
+
+//Write count neighbouring blocks to the disk in one go
+int bio_write_blocks(const uint64_t block_num, const int count, const void *buf) {
     int retstat = 0;
-    retstat = pwrite(diskfile, buf, BLOCK_SIZE, block_num*BLOCK_SIZE);
+    uint64_t t0 = stat_clock();
+    retstat = dev->write(buf, (size_t)count*BLOCK_SIZE, block_num*BLOCK_SIZE);
+    uint64_t t1 = stat_clock();
+    op_stat_record(&dev_write_stat, t1 - t0, retstat > 0 ? retstat : 0, retstat < 0);
+    TRACE_DEV(OP_DEV_WRITE, block_num*BLOCK_SIZE, count*BLOCK_SIZE, t0, t1, retstat);
     if (retstat < 0) {
 		    perror("block_write failed");
     }
     return retstat;
 }
 
+//Make what has been written so far survive a crash of the host
+int dev_flush() {
+    int retstat = 0;
+    retstat = dev->flush();
+    if (retstat < 0) {
+		    perror("block_flush failed");
+    }
+    return retstat;
+}
+
+//Drop count blocks starting at block_num, so the host frees their space. they read back as zeros
+int dev_discard(const uint64_t block_num, const int count) {
+    int retstat = 0;
+    retstat = dev->discard(block_num*BLOCK_SIZE, (uint64_t)count*BLOCK_SIZE);
+    if (retstat < 0) {
+		    perror("block_discard failed");
+    }
+    return retstat;
+}
+
+//Make the disk size bytes long. the new part reads back as zeros
+int dev_grow(const uint64_t size) {
+    int retstat = 0;
+    retstat = dev->grow(size);
+    if (retstat < 0) {
+		    perror("block_grow failed");
+    }
+    return retstat;
+}
+
+//Ask the host to start reading count blocks from block_num into its page cache. does not wait for them
+void dev_readahead(const uint64_t block_num, const int count) {
+    dev->readahead(block_num*BLOCK_SIZE, (uint64_t)count*BLOCK_SIZE);
+}
@@ -8,12 +8,54 @@
 #ifndef _BLOCK_H_
 #define _BLOCK_H_
 
+#include <stdint.h>
+#include "stats.h"
+
 #define BLOCK_SIZE 4096
 
-void dev_init(const char* diskfile_path);
+//Size of a new disk unless told otherwise, 32MB
+#define DISK_SIZE	(32*1024*1024)
+
+//Syscalls made on the disk so far, reads, writes, flushes, discards, grows and readaheads.
+//the ram disk only makes them to discard and grow
+extern uint64_t dev_syscalls;
+//Latency and bytes of every read (bio_read, bio_read_blocks) and write (bio_write, bio_write_blocks)
+extern struct op_stat dev_read_stat;
+extern struct op_stat dev_write_stat;
+
+//What a disk is made of. block.c times and traces every call, the backend only moves the bytes.
+//offsets and lengths are in bytes, read and write return what they moved like pread/pwrite
+struct dev_ops {
+	const char *name;
+	void (*init)(const char *path, const uint64_t size);
+	int (*open)(const char *path);
+	void (*close)();
+	int (*read)(void *buf, const size_t len, const uint64_t off);
+	int (*write)(const void *buf, const size_t len, const uint64_t off);
+	int (*flush)();
+	int (*discard)(const uint64_t off, const uint64_t len);
+	int (*grow)(const uint64_t size);
+	void (*readahead)(const uint64_t off, const uint64_t len);
+};
+
+//The DISKFILE, the default
+extern const struct dev_ops file_dev;
+//An anonymous mapping, on huge pages if it can get them. there is nothing to open, so every
+//mount starts with a mkfs, and dev_close() (the unmount) throws the contents away
+extern const struct dev_ops ram_dev;
+
+//Pick the backend by name ("file" or "ram") before dev_init()/dev_open(). -1 if there is none by that name
+int dev_select(const char *name);
+void dev_init(const char* diskfile_path, const uint64_t size);
 int dev_open(const char* diskfile_path);
 void dev_close();
-int bio_read(const int block_num, void *buf);
-int bio_write(const int block_num, const void *buf);
+int bio_read(const uint64_t block_num, void *buf);
+int bio_write(const uint64_t block_num, const void *buf);
+int bio_read_blocks(const uint64_t block_num, const int count, void *buf);
+int bio_write_blocks(const uint64_t block_num, const int count, const void *buf);
+int dev_flush();
+int dev_discard(const uint64_t block_num, const int count);
+int dev_grow(const uint64_t size);
+void dev_readahead(const uint64_t block_num, const int count);
 
 #endif
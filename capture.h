@@ -0,0 +1,32 @@
+/*
+ *	Tiny File System
+ *	File:	capture.h
+ *
+ *	file format of ./rufs --capture=FILE, read by benchmark/replay. unlike the trace of
+ *	trace.h it keeps every operation and its path, so the traffic can be issued again
+ */
+
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <stdint.h>
+
+#define CAPTURE_MAGIC "RUFSCAP1"
+
+/*
+ * one per FUSE operation, in the order they finished, followed by path_len bytes of its
+ * path (no '\0'). op is an enum rufs_op of trace.h
+ */
+struct capture_rec {
+	uint64_t ts_ns;		// when it started, from the start of the capture
+	uint64_t offset;
+	uint32_t dur_ns;
+	uint32_t size;
+	uint32_t arg;		// mode of mkdir, create and fallocate, cmd of ioctl
+	int32_t ret;
+	uint16_t path_len;
+	uint8_t op;
+	uint8_t tid;		// FUSE thread it ran on, in the order they first showed up
+};
+
+#endif
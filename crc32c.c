@@ -0,0 +1,136 @@
+/*
+ *	Tiny File System
+ *	File:	crc32c.c
+ *
+ *	CRC32C. uses the SSE4.2 crc32 instruction when the cpu has it and a
+ *	slice-by-8 table otherwise. crc32c_batch() runs three buffers through
+ *	the instruction side by side, which hides its 3 cycle latency. the
+ *	buffers are independent so no PCLMUL merge step is needed
+ */
+
+#include <string.h>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78	// reflected Castagnoli polynomial
+
+static uint32_t crc32c_table[8][256];
+static int crc32c_hw = -1;	// -1 until crc32c_init() ran
+
+static void crc32c_init()
+{
+	for (int i = 0; i < 256; i++)
+	{
+		uint32_t crc = i;
+		for (int k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+		crc32c_table[0][i] = crc;
+	}
+	for (int i = 0; i < 256; i++)
+	{
+		for (int t = 1; t < 8; t++)
+			crc32c_table[t][i] = (crc32c_table[t - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[t - 1][i] & 0xff];
+	}
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	crc32c_hw = __builtin_cpu_supports("sse4.2");
+#else
+	crc32c_hw = 0;
+#endif
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len)
+{
+	while (len >= 8)
+	{
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		word ^= crc;
+		crc = crc32c_table[7][word & 0xff] ^ crc32c_table[6][(word >> 8) & 0xff]
+			^ crc32c_table[5][(word >> 16) & 0xff] ^ crc32c_table[4][(word >> 24) & 0xff]
+			^ crc32c_table[3][(word >> 32) & 0xff] ^ crc32c_table[2][(word >> 40) & 0xff]
+			^ crc32c_table[1][(word >> 48) & 0xff] ^ crc32c_table[0][word >> 56];
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint64_t crc64 = crc;
+	while (len >= 8)
+	{
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+		p += 8;
+		len -= 8;
+	}
+	crc = crc64;
+	while (len--)
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+
+__attribute__((target("sse4.2")))
+static void crc32c_sse42_x3(const uint8_t *a, const uint8_t *b, const uint8_t *c, size_t len, uint32_t *crcs)
+{
+	uint64_t ca = ~0U, cb = ~0U, cc = ~0U;
+	size_t i;
+	for (i = 0; i + 8 <= len; i += 8)
+	{
+		uint64_t wa, wb, wc;
+		memcpy(&wa, a + i, sizeof(wa));
+		memcpy(&wb, b + i, sizeof(wb));
+		memcpy(&wc, c + i, sizeof(wc));
+		ca = _mm_crc32_u64(ca, wa);
+		cb = _mm_crc32_u64(cb, wb);
+		cc = _mm_crc32_u64(cc, wc);
+	}
+	crcs[0] = ~crc32c_sse42(ca, a + i, len - i);
+	crcs[1] = ~crc32c_sse42(cb, b + i, len - i);
+	crcs[2] = ~crc32c_sse42(cc, c + i, len - i);
+}
+#endif
+
+/*
+ * CRC32C of one buffer
+ */
+uint32_t crc32c(const void *buf, size_t len)
+{
+	if (crc32c_hw == -1)
+		crc32c_init();
+#if defined(__x86_64__)
+	if (crc32c_hw)
+		return ~crc32c_sse42(~0U, buf, len);
+#endif
+	return ~crc32c_sw(~0U, buf, len);
+}
+
+/*
+ * CRC32C of count buffers of the same length, crcs[i] is the checksum of bufs[i]
+ */
+void crc32c_batch(const void *const *bufs, size_t len, uint32_t *crcs, int count)
+{
+	if (crc32c_hw == -1)
+		crc32c_init();
+	int i = 0;
+#if defined(__x86_64__)
+	if (crc32c_hw)
+	{
+		for (; i + 3 <= count; i += 3)
+			crc32c_sse42_x3(bufs[i], bufs[i + 1], bufs[i + 2], len, crcs + i);
+	}
+#endif
+	for (; i < count; i++)
+		crcs[i] = crc32c(bufs[i], len);
+}
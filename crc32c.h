@@ -0,0 +1,17 @@
+/*
+ *	Tiny File System
+ *	File:	crc32c.h
+ *
+ *	CRC32C (Castagnoli) used for block checksums
+ */
+
+#ifndef _CRC32C_H
+#define _CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32c(const void *buf, size_t len);
+void crc32c_batch(const void *const *bufs, size_t len, uint32_t *crcs, int count);
+
+#endif
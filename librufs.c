@@ -0,0 +1,4212 @@
+/*
+ *  Copyright (C) 2024 CS416/CS518 Rutgers CS
+ *	Tiny File System
+ *	File:	librufs.c
+ *
+ *	the file system itself, without FUSE. rufs.c mounts it, tools can link it directly
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <time.h>
+#include <libgen.h>
+#include <limits.h>
+#include <linux/falloc.h>
+#include <pthread.h>
+
+#include "block.h"
+#include "rufs.h"
+#include "rufs_ioctl.h"
+#include "librufs.h"
+#include "lz.h"
+#include "crc32c.h"
+#include "pack.h"
+
+#define ANSI_COLOR_RED "\x1b[31m"
+#define ANSI_COLOR_GREEN "\x1b[32m"
+#define ANSI_COLOR_YELLOW "\x1b[33m"
+#define ANSI_COLOR_BLUE "\x1b[34m"
+#define ANSI_COLOR_MAGENTA "\x1b[35m"
+#define ANSI_COLOR_CYAN "\x1b[36m"
+#define ANSI_COLOR_RESET "\x1b[0m"
+
+char diskfile_path[PATH_MAX];
+
+/**
+ * Do not put new line char at end. called through my_print()
+ */
+void my_print_debug(const char *format, ...)
+{
+	va_list args;
+	printf(ANSI_COLOR_RED);
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf(ANSI_COLOR_RESET "\n");
+}
+#define my_print_mag(...) my_print(__VA_ARGS__)
+/**
+ * Always print, no matter DEBUG
+ */
+void my_print_always(const char *format, ...)
+{
+	va_list args;
+	printf(ANSI_COLOR_MAGENTA);
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf(ANSI_COLOR_RESET "\n");
+}
+
+// Declare your in-memory data structures here
+struct superblock *sb = NULL;
+/*
+ * on-disk bitmaps are kept whole in memory. free[] counts the clear bits of each bitmap
+ * block, so a search skips full blocks without looking inside them and does not get slower
+ * as the image grows. every change is written through to its one bitmap block
+ */
+#define BM_BLOCK_BITS (BLOCK_SIZE * 8)
+struct disk_bitmap {
+	bitmap_t bits;
+	uint32_t start_blk;	// first disk block of the bitmap
+	uint32_t len;		// blocks in the bitmap
+	uint32_t nbits;		// inodes or data blocks it covers
+	uint32_t *free;		// clear bits in each block
+};
+// bitmap for indoes
+struct disk_bitmap inode_bm;
+// bitmap for datablocks not diskblocks
+struct disk_bitmap dblock_bm;
+// size of the DISKFILE mkfs makes, --size
+uint64_t disk_size = DISK_SIZE;
+// size mkfs leaves room to grow to online, --max-size. 0 for none
+uint64_t max_disk_size = 0;
+// smallest step a full image grows by on its own, 64MB
+#define AUTOGROW_MIN ((64 * 1024 * 1024) / BLOCK_SIZE)
+
+/*
+ * per block metadata regions. each is mapped whole, but a region block is only read in the
+ * first time one of its entries is used, so mounting a big image reads next to none of them.
+ * data is NULL when the image does not have the region
+ */
+#define REGION_UNREAD 0
+#define REGION_CLEAN 1
+#define REGION_DIRTY 2
+struct region {
+	char *data;
+	uint8_t *state;		// REGION_* of each block
+	uint32_t start_blk;
+	uint64_t len;		// blocks
+	int raw;			// not checksummed, only the checksum region itself
+};
+// extra owners of each data block (uint16_t). FEATURE_REFCOUNT
+struct region ref_region;
+// --compress: compress every file, not just the ones with INODE_COMPRESS
+int compress_all = 0;
+// fingerprint of each data block (uint64_t). FEATURE_FPRINT
+struct region fp_region;
+// --dedup: share blocks with the same contents instead of writing them again
+int dedup_enabled = 0;
+int dedup_hits = 0;
+// fingerprints overwritten since the dedup index was last rebuilt
+int fp_index_stale = 0;
+// crc32c of every disk block (uint32_t). FEATURE_CSUM
+struct region csum_region;
+// --data-csum: checksum file data blocks too, not just metadata
+int data_csum_enabled = 0;
+// --trace=FILE: record the event trace of trace.h and write it there at unmount
+const char *trace_file = NULL;
+
+// inode table blocks read last, see icache_get(). block 0 is the superblock, so 0 marks a free slot
+#define ICACHE_SLOTS 256
+struct icache_slot {
+	uint64_t block_num;
+	char data[BLOCK_SIZE];
+};
+struct icache_slot icache[ICACHE_SLOTS];
+// --noprefetch: do not read the inodes of a dir's children ahead when it is listed
+int prefetch_enabled = 1;
+int prefetch_batches = 0;
+int prefetch_blocks = 0;
+#define PREFETCH_RUN_MAX 64			// blocks in one read
+#define PREFETCH_GAP 4				// blocks between two wanted ones that are read along
+
+// bloom filter of the names in each dir, by inode number mod BLOOM_SLOTS. only dirs that were
+// scanned whole have one, see dir_find()
+#define BLOOM_SLOTS 1024
+#define BLOOM_BITS 4096				// 304 names (a full dir) give about 0.5% false positives
+#define BLOOM_HASHES 4
+struct dir_bloom {
+	uint16_t ino;
+	uint8_t built;
+	uint64_t bits[BLOOM_BITS / 64];
+};
+struct dir_bloom *dir_blooms = NULL;
+// --nobloom turns them off
+int bloom_enabled = 1;
+int bloom_misses = 0;
+
+// readahead state of the files read last, by inode number mod RA_SLOTS
+#define RA_SLOTS 64
+#define RA_MIN 2					// blocks asked for on the first sequential read
+#define RA_MAX MAX_DIRECT_PTRS		// a whole file
+struct ra_state {
+	uint16_t ino;
+	uint32_t window;	// blocks to keep asked for ahead of the reader, 0 after a random read
+	off_t next_off;		// where a sequential read would start
+	int ahead_i;		// first direct_ptr index not asked for yet
+};
+struct ra_state ra_table[RA_SLOTS];
+// --noreadahead turns it off
+int readahead_enabled = 1;
+int ra_hits = 0;
+int ra_blocks = 0;
+// readi() calls the inode cache had the block for, and the ones it did not
+uint64_t icache_hits = 0;
+uint64_t icache_misses = 0;
+// each FUSE operation, timed by rufs.c. shown in STATS_FILE with the other counters
+struct op_stat op_stats[OP_COUNT];
+
+int meta_read(uint64_t block_num, void *buf);
+int meta_write(uint64_t block_num, const void *buf);
+
+/*
+ * scratch memory of an upcall. block sized buffers come off a free list instead of malloc, and
+ * anything else that only lives as long as the call comes from an arena that is rolled back when
+ * the ARENA_SCOPE it was taken in ends, on every return path. both are per thread and keep what
+ * they were given, so after the first few calls an upcall does no allocator calls at all
+ */
+#define BLKBUF_MAX 32				// free buffers kept per thread, more are given back
+struct blkbuf_pool {
+	void *bufs[BLKBUF_MAX];
+	int n;
+};
+static __thread struct blkbuf_pool blkbufs;
+
+#define ARENA_CHUNK (64 * 1024)
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+// chunks are never freed until destroy, the ones past cur are reused by the next calls
+struct arena {
+	struct arena_chunk *head;
+	struct arena_chunk *cur;
+};
+static __thread struct arena arena;
+struct arena_mark {
+	struct arena_chunk *chunk;
+	size_t used;
+};
+
+void *blkbuf_get()
+{
+	if (blkbufs.n > 0)
+		return blkbufs.bufs[--blkbufs.n];
+	return malloc(BLOCK_SIZE);
+}
+
+void blkbuf_put(void *buf)
+{
+	if (buf == NULL)
+		return;
+	if (blkbufs.n < BLKBUF_MAX)
+		blkbufs.bufs[blkbufs.n++] = buf;
+	else
+		free(buf);
+}
+
+struct arena_chunk *arena_chunk_new(size_t size)
+{
+	struct arena_chunk *ch = malloc(sizeof(struct arena_chunk) + size);
+	ch->next = NULL;
+	ch->size = size;
+	ch->used = 0;
+	return ch;
+}
+
+struct arena_mark arena_save()
+{
+	if (arena.head == NULL)
+		arena.head = arena.cur = arena_chunk_new(ARENA_CHUNK);
+	struct arena_mark m = { arena.cur, arena.cur->used };
+	return m;
+}
+
+/*
+ * Give back everything taken since m was saved
+ */
+void arena_restore(struct arena_mark *m)
+{
+	arena.cur = m->chunk;
+	arena.cur->used = m->used;
+}
+
+// the arena is rolled back to here when the enclosing block is left
+#define ARENA_SCOPE struct arena_mark arena_scope __attribute__((cleanup(arena_restore))) = arena_save()
+
+/*
+ * size bytes that stay valid until the enclosing ARENA_SCOPE ends. never fails
+ */
+void *arena_alloc(size_t size)
+{
+	size = (size + 15) & ~(size_t)15;
+	if (arena.head == NULL)
+		arena_save();
+	while (arena.cur->used + size > arena.cur->size)
+	{
+		// move on to the next kept chunk, or put a new one big enough in front of it
+		struct arena_chunk *next = arena.cur->next;
+		if (next == NULL || next->size < size)
+		{
+			struct arena_chunk *ch = arena_chunk_new(size > ARENA_CHUNK ? size : ARENA_CHUNK);
+			ch->next = next;
+			arena.cur->next = ch;
+			next = ch;
+		}
+		next->used = 0;
+		arena.cur = next;
+	}
+	void *p = arena.cur->data + arena.cur->used;
+	arena.cur->used += size;
+	return p;
+}
+
+char *arena_strdup(const char *s)
+{
+	size_t len = strlen(s) + 1;
+	return memcpy(arena_alloc(len), s, len);
+}
+
+void scratch_free()
+{
+	while (blkbufs.n > 0)
+		free(blkbufs.bufs[--blkbufs.n]);
+	while (arena.head != NULL)
+	{
+		struct arena_chunk *next = arena.head->next;
+		free(arena.head);
+		arena.head = next;
+	}
+	arena.cur = NULL;
+}
+
+/*
+ * region operations. fresh regions (mkfs) are all zeros on disk already, so nothing is read or written
+ */
+void region_open(struct region *r, uint32_t start_blk, uint64_t len, int raw, int fresh)
+{
+	// a calloc this big is mmap'd, blocks that are never loaded cost no memory
+	r->data = calloc(len, BLOCK_SIZE);
+	r->state = malloc(len);
+	memset(r->state, fresh ? REGION_CLEAN : REGION_UNREAD, len);
+	r->start_blk = start_blk;
+	r->len = len;
+	r->raw = raw;
+}
+
+void region_close(struct region *r)
+{
+	free(r->data);
+	free(r->state);
+	r->data = NULL;
+	r->state = NULL;
+}
+
+/*
+ * Entry idx of a region of size byte entries, read in if its block was not yet
+ */
+void *region_at(struct region *r, uint64_t idx, size_t size)
+{
+	uint64_t blk = idx * size / BLOCK_SIZE;
+	if (r->state[blk] == REGION_UNREAD)
+	{
+		if (r->raw)
+			bio_read(r->start_blk + blk, r->data + blk * BLOCK_SIZE);
+		else
+			meta_read(r->start_blk + blk, r->data + blk * BLOCK_SIZE);
+		r->state[blk] = REGION_CLEAN;
+	}
+	return r->data + idx * size;
+}
+
+void region_dirty(struct region *r, uint64_t idx, size_t size)
+{
+	r->state[idx * size / BLOCK_SIZE] = REGION_DIRTY;
+}
+
+/*
+ * Write the block holding entry idx now, not on the next flush
+ */
+void region_write(struct region *r, uint64_t idx, size_t size)
+{
+	uint64_t blk = idx * size / BLOCK_SIZE;
+	if (r->raw)
+		bio_write(r->start_blk + blk, r->data + blk * BLOCK_SIZE);
+	else
+		meta_write(r->start_blk + blk, r->data + blk * BLOCK_SIZE);
+	r->state[blk] = REGION_CLEAN;
+}
+
+void region_flush(struct region *r)
+{
+	if (r->data == NULL)
+		return;
+	for (uint64_t blk = 0; blk < r->len; blk++)
+	{
+		if (r->state[blk] == REGION_DIRTY)
+			region_write(r, blk * BLOCK_SIZE, 1);
+	}
+}
+
+uint16_t *ref_of(int blkno)
+{
+	return region_at(&ref_region, blkno, sizeof(uint16_t));
+}
+
+uint64_t *fp_of(int blkno)
+{
+	return region_at(&fp_region, blkno, sizeof(uint64_t));
+}
+
+uint32_t *csum_of(uint64_t block_num)
+{
+	return region_at(&csum_region, block_num, sizeof(uint32_t));
+}
+
+/*
+ * checksummed block io. metadata (bitmaps, inodes, dirents, the refcount and fingerprint
+ * regions) always goes through meta_read/meta_write, file data through data_read/data_write.
+ * reads return -1 when the block does not match its checksum
+ */
+void mark_csum_intent(uint64_t block_num);
+
+void set_csum(uint64_t block_num, uint32_t crc)
+{
+	mark_csum_intent(block_num);
+	*csum_of(block_num) = crc;
+	region_dirty(&csum_region, block_num, sizeof(uint32_t));
+}
+
+void flush_csums()
+{
+	region_flush(&csum_region);
+}
+
+/*
+ * write intent for checksums. the checksum region is only written back now and then, so after a
+ * crash the checksums of blocks written since can be behind. before the first checksum change
+ * under a part of the region, its bit in sb->csum_intent goes to disk, so a mount after a crash
+ * knows which blocks to take as they are and which to hold to their checksums
+ */
+uint32_t csum_intent_bit(uint64_t block_num)
+{
+	uint64_t span = (CSUM_BLOCKS(sb->max_blocks) + CSUM_INTENT_BITS - 1) / CSUM_INTENT_BITS;
+	uint64_t bit = block_num / (BLOCK_SIZE / sizeof(uint32_t)) / (span ? span : 1);
+	return (bit < CSUM_INTENT_BITS) ? bit : CSUM_INTENT_BITS - 1;
+}
+
+void mark_csum_intent(uint64_t block_num)
+{
+	if (!(sb->state & SB_CSUM_INTENT))
+		return;
+	uint32_t bit = csum_intent_bit(block_num);
+	if (get_bitmap(sb->csum_intent, bit))
+		return;
+	set_bitmap(sb->csum_intent, bit);
+	bio_write(0, sb);
+	dev_flush();
+}
+
+/*
+ * The checksum region is all on disk, no part of it is behind any more. the caller writes sb
+ */
+void clear_csum_intent()
+{
+	dev_flush();
+	memset(sb->csum_intent, 0, sizeof(sb->csum_intent));
+}
+
+int check_csum(uint64_t block_num, uint32_t crc)
+{
+	uint32_t want = *csum_of(block_num);
+	if (want == 0 || want == crc)
+		return 0;
+	my_print_always("Checksum mismatch on block %llu: have %08x, expected %08x", (unsigned long long)block_num, crc, want);
+	return -1;
+}
+
+int meta_read(uint64_t block_num, void *buf)
+{
+	bio_read(block_num, buf);
+	if (csum_region.data == NULL)
+		return 0;
+	return check_csum(block_num, crc32c(buf, BLOCK_SIZE));
+}
+
+int meta_write(uint64_t block_num, const void *buf)
+{
+	if (csum_region.data != NULL)
+		set_csum(block_num, crc32c(buf, BLOCK_SIZE));
+	return bio_write(block_num, buf);
+}
+
+/*
+ * Read count data blocks and verify them in one batch
+ */
+int data_read_batch(const int *blknos, void *const *bufs, int count)
+{
+	int checked = 0;
+	for (int k = 0; k < count; k++)
+	{
+		bio_read(sb->d_start_blk + blknos[k], bufs[k]);
+		if (csum_region.data != NULL && *csum_of(sb->d_start_blk + blknos[k]) != 0)
+			checked = 1;
+	}
+	if (!checked)
+		return 0;
+
+	uint32_t crcs[count];
+	crc32c_batch((const void *const *)bufs, BLOCK_SIZE, crcs, count);
+	int ret = 0;
+	for (int k = 0; k < count; k++)
+	{
+		if (check_csum(sb->d_start_blk + blknos[k], crcs[k]) == -1)
+			ret = -1;
+	}
+	return ret;
+}
+
+int data_read(int blkno, void *buf)
+{
+	return data_read_batch(&blkno, &buf, 1);
+}
+
+int data_write(int blkno, const void *buf)
+{
+	if (csum_region.data != NULL)
+	{
+		// without --data-csum the old checksum is just dropped
+		uint64_t block_num = sb->d_start_blk + blkno;
+		uint32_t crc = data_csum_enabled ? crc32c(buf, BLOCK_SIZE) : 0;
+		if (*csum_of(block_num) != crc)
+			set_csum(block_num, crc);
+	}
+	return bio_write(sb->d_start_blk + blkno, buf);
+}
+
+/*
+ * data_write() of count neighbouring data blocks from blkno, in one write
+ */
+int data_write_run(int blkno, int count, const void *buf)
+{
+	if (csum_region.data != NULL)
+	{
+		for (int k = 0; k < count; k++)
+		{
+			uint64_t block_num = sb->d_start_blk + blkno + k;
+			uint32_t crc = data_csum_enabled ? crc32c(buf + k * BLOCK_SIZE, BLOCK_SIZE) : 0;
+			if (*csum_of(block_num) != crc)
+				set_csum(block_num, crc);
+		}
+	}
+	return bio_write_blocks(sb->d_start_blk + blkno, count, buf);
+}
+/*
+ * bitmap operations
+ */
+uint32_t bm_block_bits(struct disk_bitmap *bm, uint32_t b)
+{
+	// the last block is only partly used, mkfs may size the bitmap a few blocks past it
+	if ((uint64_t)b * BM_BLOCK_BITS >= bm->nbits)
+		return 0;
+	uint32_t left = bm->nbits - b * BM_BLOCK_BITS;
+	return left < BM_BLOCK_BITS ? left : BM_BLOCK_BITS;
+}
+
+void bm_count_free(struct disk_bitmap *bm, uint32_t b)
+{
+	uint64_t *words = (uint64_t *)(bm->bits + (size_t)b * BLOCK_SIZE);
+	uint32_t used = 0;
+	for (int k = 0; k < BLOCK_SIZE / sizeof(uint64_t); k++)
+		used += __builtin_popcountll(words[k]);
+	bm->free[b] = bm_block_bits(bm, b) - used;
+}
+
+/*
+ * Set up a bitmap of nbits at disk block start_blk. fresh ones (mkfs) start out clear like the
+ * new DISKFILE, otherwise it is read in. returns 0 on sucess, -1 if a block did not match its checksum
+ */
+int bm_open(struct disk_bitmap *bm, uint32_t start_blk, uint32_t len, uint32_t nbits, int fresh)
+{
+	bm->bits = calloc(len, BLOCK_SIZE);
+	bm->free = malloc(len * sizeof(uint32_t));
+	bm->start_blk = start_blk;
+	bm->len = len;
+	bm->nbits = nbits;
+	int ret = 0;
+	for (uint32_t b = 0; b < len; b++)
+	{
+		void *blk = bm->bits + (size_t)b * BLOCK_SIZE;
+		if (!fresh && meta_read(start_blk + b, blk) == -1)
+			ret = -1;
+		bm_count_free(bm, b);
+	}
+	return ret;
+}
+
+/*
+ * Cover nbits from now on. the bits past the old end were never set, they just start counting as free
+ */
+void bm_grow(struct disk_bitmap *bm, uint32_t nbits)
+{
+	uint32_t first = bm->nbits / BM_BLOCK_BITS;
+	bm->nbits = nbits;
+	for (uint32_t b = first; b < bm->len; b++)
+		bm_count_free(bm, b);
+}
+
+void bm_close(struct disk_bitmap *bm)
+{
+	free(bm->bits);
+	free(bm->free);
+	bm->bits = NULL;
+	bm->free = NULL;
+}
+
+void bm_write(struct disk_bitmap *bm, uint32_t b)
+{
+	meta_write(bm->start_blk + b, bm->bits + (size_t)b * BLOCK_SIZE);
+}
+
+void bm_set(struct disk_bitmap *bm, uint32_t i)
+{
+	if (!get_bitmap(bm->bits, i))
+		bm->free[i / BM_BLOCK_BITS]--;
+	set_bitmap(bm->bits, i);
+	bm_write(bm, i / BM_BLOCK_BITS);
+}
+
+void bm_clear(struct disk_bitmap *bm, uint32_t i)
+{
+	if (get_bitmap(bm->bits, i))
+		bm->free[i / BM_BLOCK_BITS]++;
+	unset_bitmap(bm->bits, i);
+	bm_write(bm, i / BM_BLOCK_BITS);
+}
+
+uint32_t bm_used(struct disk_bitmap *bm)
+{
+	uint32_t used = bm->nbits;
+	for (uint32_t b = 0; b < bm->len; b++)
+		used -= bm->free[b];
+	return used;
+}
+
+/*
+ * Find a clear bit, the first one at or after goal, wrapping around. returns -1 if there is none
+ */
+int bm_find_free(struct disk_bitmap *bm, uint32_t goal)
+{
+	if (goal >= bm->nbits)
+		goal = 0;
+	uint32_t first = goal / BM_BLOCK_BITS;
+	for (uint32_t n = 0; n <= bm->len; n++)
+	{
+		uint32_t b = (first + n) % bm->len;
+		if (bm->free[b] == 0)
+			continue;
+		// bit i of the bitmap is bit i%64 of its little endian word. the goal block is looked at
+		// from the goal first, and its bits before the goal only once everything else is full
+		uint64_t *words = (uint64_t *)(bm->bits + (size_t)b * BLOCK_SIZE);
+		int k = 0;
+		uint64_t skip = 0;
+		if (n == 0)
+		{
+			k = goal % BM_BLOCK_BITS / 64;
+			skip = (1ULL << (goal % 64)) - 1;
+		}
+		for (; k < BLOCK_SIZE / sizeof(uint64_t); k++, skip = 0)
+		{
+			uint64_t used = words[k] | skip;
+			if (used == ~0ULL)
+				continue;
+			uint32_t i = b * BM_BLOCK_BITS + k * 64 + __builtin_ctzll(~used);
+			if (i >= bm->nbits)
+				break;
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Find and set count clear bits in a row, from the block holding goal on, wrapping around.
+ * returns the first one, -1 if there is no such run
+ */
+int bm_take_run(struct disk_bitmap *bm, uint32_t count, uint32_t goal)
+{
+	uint32_t start = (goal < bm->nbits) ? goal / BM_BLOCK_BITS : 0;
+	uint32_t run = 0;
+	for (uint32_t n = 0; n < bm->len; n++)
+	{
+		uint32_t b = (start + n) % bm->len;
+		uint32_t nbits = bm_block_bits(bm, b);
+		// a run can not wrap from the last block to the first
+		if (bm->free[b] == 0 || b == 0)
+			run = 0;
+		if (bm->free[b] == 0)
+			continue;
+		if (bm->free[b] == nbits && run + nbits < count)
+		{
+			run += nbits;
+			continue;
+		}
+		uint64_t *words = (uint64_t *)(bm->bits + (size_t)b * BLOCK_SIZE);
+		uint32_t i = b * BM_BLOCK_BITS;
+		while (i < b * BM_BLOCK_BITS + nbits && run < count)
+		{
+			if (i % 64 == 0 && words[i % BM_BLOCK_BITS / 64] == ~0ULL)
+			{
+				run = 0;
+				i += 64;
+				continue;
+			}
+			run = get_bitmap(bm->bits, i) ? 0 : run + 1;
+			i++;
+		}
+		if (run == count)
+		{
+			uint32_t first = i - count;
+			for (uint32_t j = first; j < i; j++)
+			{
+				set_bitmap(bm->bits, j);
+				bm->free[j / BM_BLOCK_BITS]--;
+			}
+			for (uint32_t k = first / BM_BLOCK_BITS; k <= (i - 1) / BM_BLOCK_BITS; k++)
+				bm_write(bm, k);
+			return first;
+		}
+	}
+	return -1;
+}
+
+int autogrow(uint32_t needed);
+int autogrow_inodes();
+
+/*
+ * Get available inode number from bitmap, the first one from goal on. returns -1 if every inode is taken
+ */
+int get_avail_ino(uint32_t goal)
+{
+	// Step 1: Traverse inode bitmap to find an available slot, growing the image if it is full
+	int i = bm_find_free(&inode_bm, goal);
+	if (i == -1 && autogrow_inodes() == 0)
+		i = bm_find_free(&inode_bm, goal);
+	if (i == -1)
+		return -1;
+	// Step 2: Update inode bitmap and write to disk
+	bm_set(&inode_bm, i);
+	return i;
+}
+
+/*
+ * Get available data block number from bitmap, the first one from goal on
+ */
+int get_avail_blkno(uint32_t goal)
+{
+	// Step 1: Traverse data block bitmap to find an available slot, growing the image if it is full
+	int i = bm_find_free(&dblock_bm, goal);
+	if (i == -1 && autogrow(1) == 0)
+		i = bm_find_free(&dblock_bm, goal);
+	if (i == -1)
+		return INVALID_DBLOCK;
+	// Step 2: Update data block bitmap and write to disk
+	//my_print_always("setting bitmap at i:%d", i);
+	bm_set(&dblock_bm, i);
+	return i;
+}
+
+/*
+ * Get a run of count contiguous free data blocks, looking from goal's group on. returns the first block
+ * of the run, INVALID_DBLOCK if no run is big enough
+ */
+int get_avail_blkrun(int count, uint32_t goal)
+{
+	int first = bm_take_run(&dblock_bm, count, goal);
+	if (first == -1 && autogrow(count) == 0)
+		first = bm_take_run(&dblock_bm, count, goal);
+	return (first == -1) ? INVALID_DBLOCK : first;
+}
+
+int amount_of_dblocks_used(){
+	return bm_used(&dblock_bm);
+}
+
+/*
+ * discard queue. freed data blocks are collected here as ranges and punched out of
+ * the DISKFILE in batches, so the host gets the space back without a syscall per block
+ */
+#define DISCARD_QUEUE_LEN 64		// max pending ranges before a forced flush
+#define DISCARD_BATCH_BLOCKS 256	// flush once this many blocks are pending (1MB)
+#define DISCARD_INTERVAL 1			// otherwise flush at most once a second
+
+struct discard_range {
+	int start;	// first data block (not disk block)
+	int count;
+};
+struct discard_range discard_q[DISCARD_QUEUE_LEN];
+int discard_len = 0;
+int discard_pending = 0;
+time_t discard_last = 0;
+int discard_enabled = 1;
+
+int cmp_discard_range(const void *a, const void *b)
+{
+	return ((const struct discard_range *)a)->start - ((const struct discard_range *)b)->start;
+}
+
+/*
+ * Punch out every run of blocks in [start, start+count) that is still free in dblock_bm.
+ * blocks that got reallocated since they were queued are skipped
+ */
+int discard_free_runs(int start, int count)
+{
+	int punched = 0;
+	int run_start = -1;
+	for (int i = start; i <= start + count; i++)
+	{
+		int is_free = (i < start + count) && get_bitmap(dblock_bm.bits, i) == 0;
+		if (is_free && run_start == -1)
+			run_start = i;
+		else if (!is_free && run_start != -1)
+		{
+			dev_discard(sb->d_start_blk + run_start, i - run_start);
+			punched += i - run_start;
+			run_start = -1;
+		}
+	}
+	return punched;
+}
+
+/*
+ * Issue the queued discards. force=0 respects the throttle, force=1 always flushes
+ */
+void flush_discards(int force)
+{
+	if (discard_len == 0)
+		return;
+	if (!force && discard_len < DISCARD_QUEUE_LEN && discard_pending < DISCARD_BATCH_BLOCKS
+		&& time(NULL) - discard_last < DISCARD_INTERVAL)
+		return;
+
+	// sort and merge so neighbouring frees become one big punch
+	qsort(discard_q, discard_len, sizeof(struct discard_range), cmp_discard_range);
+	int start = discard_q[0].start;
+	int end = start + discard_q[0].count;
+	for (int i = 1; i <= discard_len; i++)
+	{
+		if (i < discard_len && discard_q[i].start <= end)
+		{
+			if (discard_q[i].start + discard_q[i].count > end)
+				end = discard_q[i].start + discard_q[i].count;
+			continue;
+		}
+		discard_free_runs(start, end - start);
+		if (i < discard_len)
+		{
+			start = discard_q[i].start;
+			end = start + discard_q[i].count;
+		}
+	}
+	my_print("Flushed |%d| discard ranges, |%d| blocks", discard_len, discard_pending);
+	discard_len = 0;
+	discard_pending = 0;
+	discard_last = time(NULL);
+}
+
+/*
+ * Queue a freed data block to be punched out of the DISKFILE
+ */
+void queue_discard(int blkno)
+{
+	if (!discard_enabled)
+		return;
+	// grow the last range when blocks are freed in order, which is the common case
+	if (discard_len > 0)
+	{
+		struct discard_range *last = &discard_q[discard_len - 1];
+		if (last->start + last->count == blkno)
+		{
+			last->count++;
+			discard_pending++;
+			flush_discards(0);
+			return;
+		}
+		if (last->start - 1 == blkno)
+		{
+			last->start--;
+			last->count++;
+			discard_pending++;
+			flush_discards(0);
+			return;
+		}
+	}
+	if (discard_len == DISCARD_QUEUE_LEN)
+		flush_discards(1);
+	discard_q[discard_len].start = blkno;
+	discard_q[discard_len].count = 1;
+	discard_len++;
+	discard_pending++;
+	flush_discards(0);
+}
+
+/*
+ * fingerprint operations. the fingerprint region is only a hint, a match is always compared byte for byte
+ * before a block is shared, so the region is written back lazily by flush_fprints()
+ */
+void set_fprint(int blkno, uint64_t fp)
+{
+	uint64_t *entry = fp_of(blkno);
+	if (*entry != 0)
+		fp_index_stale++;
+	*entry = fp;
+	region_dirty(&fp_region, blkno, sizeof(uint64_t));
+}
+
+void forget_fprint(int blkno)
+{
+	if (fp_region.data != NULL && *fp_of(blkno) != 0)
+		set_fprint(blkno, 0);
+}
+
+void flush_fprints()
+{
+	region_flush(&fp_region);
+}
+
+/*
+ * Give a data block back to the bitmap
+ */
+void release_blkno(int blkno)
+{
+	forget_fprint(blkno);
+	bm_clear(&dblock_bm, blkno);
+	queue_discard(blkno);
+}
+
+/*
+ * refcount operations. a data block with a refcount of 0 has exactly one owner
+ */
+void write_blkref(int blkno)
+{
+	region_write(&ref_region, blkno, sizeof(uint16_t));
+}
+
+int blk_shared(int blkno)
+{
+	return ref_region.data != NULL && *ref_of(blkno) > 0;
+}
+
+/*
+ * Add an owner to a data block. returns 0 on sucess, -1 if the block can not take more owners
+ */
+int get_blkref(int blkno)
+{
+	if (ref_region.data == NULL || *ref_of(blkno) == REFCOUNT_MAX)
+		return -1;
+	(*ref_of(blkno))++;
+	write_blkref(blkno);
+	return 0;
+}
+
+/*
+ * Drop an owner of a data block. the last owner gives it back to the bitmap
+ */
+void put_blkno(int blkno)
+{
+	if (blk_shared(blkno))
+	{
+		(*ref_of(blkno))--;
+		write_blkref(blkno);
+		return;
+	}
+	release_blkno(blkno);
+}
+
+/*
+ * dedup index. open addressing table from fingerprint to data block, rebuilt from the fingerprint region
+ * at mount. entries are never deleted, an entry whose block no longer has that fingerprint
+ * is stale and gets reused by the next insert that probes over it
+ */
+struct fp_slot {
+	uint64_t fp;
+	int blkno;	// -1 if the slot was never used
+};
+#define FP_INDEX_MAX (1 << 22)		// slots (64MB). past that dedup only finds what fits
+struct fp_slot *fp_index = NULL;
+int fp_index_mask = 0;
+int fp_index_used = 0;
+
+#define FP_PRIME1 11400714785074694791ULL
+#define FP_PRIME2 14029467366897019727ULL
+#define FP_PRIME3 1609587929392839161ULL
+#define FP_PRIME4 9650029242287828579ULL
+#define FP_PRIME5 2870177450012600261ULL
+
+uint64_t fp_rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+uint64_t fp_round(uint64_t acc, uint64_t lane)
+{
+	acc += lane * FP_PRIME2;
+	acc = fp_rotl(acc, 31);
+	return acc * FP_PRIME1;
+}
+
+uint64_t fp_merge(uint64_t h, uint64_t acc)
+{
+	h ^= fp_round(0, acc);
+	return h * FP_PRIME1 + FP_PRIME4;
+}
+
+/*
+ * 64 bit hash of a data block (xxh64 over 4 lanes). never returns 0, that means no fingerprint
+ */
+uint64_t fingerprint_block(const void *buf)
+{
+	const uint64_t *words = buf;
+	uint64_t v1 = FP_PRIME1 + FP_PRIME2;
+	uint64_t v2 = FP_PRIME2;
+	uint64_t v3 = 0;
+	uint64_t v4 = -FP_PRIME1;
+	for (int i = 0; i < BLOCK_SIZE / sizeof(uint64_t); i += 4)
+	{
+		v1 = fp_round(v1, words[i]);
+		v2 = fp_round(v2, words[i + 1]);
+		v3 = fp_round(v3, words[i + 2]);
+		v4 = fp_round(v4, words[i + 3]);
+	}
+	uint64_t h = fp_rotl(v1, 1) + fp_rotl(v2, 7) + fp_rotl(v3, 12) + fp_rotl(v4, 18);
+	h = fp_merge(h, v1);
+	h = fp_merge(h, v2);
+	h = fp_merge(h, v3);
+	h = fp_merge(h, v4);
+	h += BLOCK_SIZE;
+	h ^= h >> 33;
+	h *= FP_PRIME2;
+	h ^= h >> 29;
+	h *= FP_PRIME3;
+	h ^= h >> 32;
+	return h ? h : 1;
+}
+
+/*
+ * returns a data block that had fingerprint fp, INVALID_DBLOCK if there is none
+ */
+int fp_lookup(uint64_t fp)
+{
+	for (int i = fp & fp_index_mask;; i = (i + 1) & fp_index_mask)
+	{
+		struct fp_slot *slot = &fp_index[i];
+		if (slot->blkno == -1)
+			return INVALID_DBLOCK;
+		if (slot->fp == fp && *fp_of(slot->blkno) == fp)
+			return slot->blkno;
+	}
+}
+
+void fp_index_rebuild();
+
+void fp_insert(uint64_t fp, int blkno)
+{
+	if (fp_index_used >= (fp_index_mask + 1) / 4 * 3)
+	{
+		// a rebuild only helps once enough entries went stale. until then a full index just
+		// stops learning new blocks, dedup is best effort
+		if (fp_index_stale < (fp_index_mask + 1) / 16)
+			return;
+		fp_index_rebuild();
+		if (fp_index_used >= (fp_index_mask + 1) / 4 * 3)
+			return;
+	}
+	int i;
+	for (i = fp & fp_index_mask;; i = (i + 1) & fp_index_mask)
+	{
+		struct fp_slot *slot = &fp_index[i];
+		if (slot->blkno == -1)
+		{
+			fp_index_used++;
+			break;
+		}
+		if (*fp_of(slot->blkno) != slot->fp || slot->blkno == blkno)
+			break;
+	}
+	fp_index[i].fp = fp;
+	fp_index[i].blkno = blkno;
+}
+
+/*
+ * (re)build the dedup index from the fingerprint region. fingerprints of blocks that are free are dropped
+ */
+void fp_index_rebuild()
+{
+	if (fp_index == NULL)
+	{
+		int size = 1;
+		while (size < 2 * sb->nr_dblocks && size < FP_INDEX_MAX)
+			size <<= 1;
+		fp_index = malloc(size * sizeof(struct fp_slot));
+		fp_index_mask = size - 1;
+	}
+	for (int i = 0; i <= fp_index_mask; i++)
+		fp_index[i].blkno = -1;
+	fp_index_used = 0;
+
+	fp_index_stale = 0;
+	for (int b = 0; b < sb->nr_dblocks; b++)
+	{
+		uint64_t fp = *fp_of(b);
+		if (fp == 0)
+			continue;
+		if (get_bitmap(dblock_bm.bits, b) == 0)
+		{
+			set_fprint(b, 0);
+			continue;
+		}
+		fp_insert(fp, b);
+	}
+}
+
+/*
+ * Point block i of a file at a block that already holds the same bytes as buf.
+ * the caller writes the inode. returns 0 if it did, -1 if buf still has to be written
+ */
+int dedup_fblock(struct inode *f_inode, int i, const void *buf, uint64_t fp)
+{
+	int ptr = f_inode->direct_ptr[i];
+	int cand = fp_lookup(fp);
+	if (cand == INVALID_DBLOCK)
+		return -1;
+
+	// the hash only says where to look, the bytes decide
+	void *data_block = blkbuf_get();
+	data_read(cand, data_block);
+	int same = memcmp(data_block, buf, BLOCK_SIZE) == 0;
+	blkbuf_put(data_block);
+	if (!same)
+		return -1;
+
+	if (ptr == cand)
+		return 0; // rewriting what is already there
+	if (get_blkref(cand) == -1)
+		return -1;
+	if (ptr != INVALID_DBLOCK)
+		put_blkno(DBLOCK_NUM(ptr));
+	f_inode->direct_ptr[i] = cand;
+	dedup_hits++;
+	my_print("Dedup Block at i:%d -> |%d|", i, cand);
+	return 0;
+}
+
+/*
+ * images made before FEATURE_GEOMETRY have the fixed 32MB layout. fill in the fields mkfs sets now
+ */
+void fill_geometry()
+{
+	if (!(sb->features & FEATURE_GEOMETRY))
+	{
+		sb->nr_blocks = MAX_DNUM;
+		sb->nr_inodes = sb->max_inum;
+		sb->nr_dblocks = sb->max_dnum;
+		sb->i_bitmap_len = 1;
+		sb->d_bitmap_len = 1;
+		sb->features |= FEATURE_GEOMETRY;
+	}
+	// and ones from before online grow have no room past their size
+	if (sb->max_blocks == 0)
+	{
+		sb->max_blocks = sb->nr_blocks;
+		sb->max_inodes = sb->nr_inodes;
+	}
+}
+
+/*
+ * Data blocks the image can grow to. the old fixed layout counts its disk size in data blocks
+ */
+uint64_t max_dblocks()
+{
+	return sb->nr_dblocks + (sb->max_blocks - sb->nr_blocks);
+}
+
+/*
+ * Inodes an image of nr_blocks gets. one per 8 blocks like the original 32MB layout, in whole inode table blocks
+ */
+uint32_t inodes_for(uint64_t nr_blocks)
+{
+	uint64_t nr_inodes = nr_blocks / 8;
+	if (nr_inodes < MAX_INUM)
+		nr_inodes = MAX_INUM;
+	if (nr_inodes > MAX_INUM_LIMIT)
+		nr_inodes = MAX_INUM_LIMIT;
+	return nr_inodes - nr_inodes % (BLOCK_SIZE / sizeof(struct inode));
+}
+
+/*
+ * Lay out the bitmaps and per block regions in sb for an image of nr_blocks, in block groups.
+ * the regions are sized for the whole disk, a little more than the data region needs, and
+ * nr_dblocks is whatever is left over for data. the inode table is cut into slices of ipg inodes
+ * at the start of each group, 0 picks ipg so nr_blocks gets its usual share of inodes
+ */
+void layout_for(uint64_t nr_blocks, uint32_t ipg)
+{
+	sb->d_bitmap_len = BITMAP_BLOCKS(nr_blocks > MAX_DNUM_LIMIT ? MAX_DNUM_LIMIT : nr_blocks);
+	uint32_t ngroups = sb->d_bitmap_len;
+	if (ipg == 0)
+	{
+		ipg = inodes_for(nr_blocks) / ngroups;
+		ipg -= ipg % INODES_PER_BLOCK;
+		if (ipg < INODES_PER_BLOCK)
+			ipg = INODES_PER_BLOCK;
+	}
+	// inode numbers are uint16_t, so past MAX_INUM_LIMIT the groups have no slice and only hold data
+	uint64_t max_inodes = (uint64_t)ipg * ngroups;
+	if (max_inodes > MAX_INUM_LIMIT)
+		max_inodes = MAX_INUM_LIMIT - MAX_INUM_LIMIT % ipg;
+	sb->inodes_per_group = ipg;
+	sb->max_inodes = max_inodes;
+	sb->i_bitmap_len = BITMAP_BLOCKS(sb->max_inodes);
+	sb->i_bitmap_blk = 1;
+	sb->d_bitmap_blk = sb->i_bitmap_blk + sb->i_bitmap_len;
+	sb->i_start_blk = sb->d_bitmap_blk + sb->d_bitmap_len;
+	sb->r_start_blk = sb->i_start_blk;
+	sb->f_start_blk = sb->r_start_blk + REFCOUNT_BLOCKS(nr_blocks);
+	sb->c_start_blk = sb->f_start_blk + FPRINT_BLOCKS(nr_blocks);
+	sb->d_start_blk = sb->c_start_blk + CSUM_BLOCKS(nr_blocks);
+	sb->nr_dblocks = (nr_blocks - sb->d_start_blk > MAX_DNUM_LIMIT) ? MAX_DNUM_LIMIT : nr_blocks - sb->d_start_blk;
+	sb->nr_blocks = sb->d_start_blk + sb->nr_dblocks;
+	sb->max_blocks = sb->nr_blocks;
+}
+
+/*
+ * block group operations. images without FEATURE_BGROUPS have their inode table in its own
+ * region and count as a single group
+ */
+uint32_t itable_blocks()
+{
+	return sb->inodes_per_group / INODES_PER_BLOCK;
+}
+
+uint32_t ino_group(uint16_t ino)
+{
+	return (sb->features & FEATURE_BGROUPS) ? ino / sb->inodes_per_group : 0;
+}
+
+/*
+ * Disk block holding inode ino
+ */
+uint64_t inode_blk(uint16_t ino)
+{
+	if (!(sb->features & FEATURE_BGROUPS))
+		return sb->i_start_blk + ino / INODES_PER_BLOCK;
+	return sb->d_start_blk + (uint64_t)ino_group(ino) * BLOCKS_PER_GROUP + (ino % sb->inodes_per_group) / INODES_PER_BLOCK;
+}
+
+/*
+ * Cut a data region short if its last group could not even hold its inode table slice
+ */
+uint64_t fit_groups(uint64_t nr_dblocks)
+{
+	uint64_t tail = nr_dblocks % BLOCKS_PER_GROUP;
+	uint64_t group = nr_dblocks / BLOCKS_PER_GROUP;
+	if ((sb->features & FEATURE_BGROUPS) && tail > 0 && tail <= itable_blocks() && group * sb->inodes_per_group < sb->max_inodes)
+		return nr_dblocks - tail;
+	return nr_dblocks;
+}
+
+/*
+ * Inodes a data region of nr_dblocks has room for, ipg for every group that has its slice
+ */
+uint32_t inodes_in(uint64_t nr_dblocks)
+{
+	uint64_t groups = (nr_dblocks + BLOCKS_PER_GROUP - 1) / BLOCKS_PER_GROUP;
+	uint64_t nr_inodes = groups * sb->inodes_per_group;
+	return (nr_inodes > sb->max_inodes) ? sb->max_inodes : nr_inodes;
+}
+
+/*
+ * Take the inode table slices of the groups holding inodes [from, to) out of the data block bitmap
+ */
+void reserve_itables(uint32_t from, uint32_t to)
+{
+	for (uint32_t g = from / sb->inodes_per_group; g < to / sb->inodes_per_group; g++)
+	{
+		for (uint32_t k = 0; k < itable_blocks(); k++)
+		{
+			uint32_t blkno = g * BLOCKS_PER_GROUP + k;
+			set_bitmap(dblock_bm.bits, blkno);
+			dblock_bm.free[blkno / BM_BLOCK_BITS]--;
+		}
+		bm_write(&dblock_bm, g);
+	}
+}
+
+int inode_inline(struct inode *f_inode);
+
+/*
+ * Data block to look for a free one from, for block i of an inode: right after its block i-1 so
+ * the file is laid out in order, or else at the start of its group
+ */
+uint32_t blk_goal(struct inode *inode, int i)
+{
+	if (i > 0 && i <= MAX_DIRECT_PTRS && !inode_inline(inode) && inode->direct_ptr[i - 1] != INVALID_DBLOCK)
+		return DBLOCK_NUM(inode->direct_ptr[i - 1]) + 1;
+	return ino_group(inode->ino) * BLOCKS_PER_GROUP;
+}
+
+/*
+ * Inode number to look for a free inode from. files go in their parent's group, next to their
+ * siblings and the parent's blocks. directories go to the group with the most free data blocks,
+ * staying with the parent on a tie, so the trees under them spread out and have room to grow
+ */
+uint32_t ino_goal(struct inode *parent, int is_dir)
+{
+	if (!(sb->features & FEATURE_BGROUPS))
+		return 0;
+	uint32_t best = ino_group(parent->ino);
+	if (is_dir)
+	{
+		uint32_t ngroups = sb->nr_inodes / sb->inodes_per_group;
+		for (uint32_t g = 0; g < ngroups; g++)
+		{
+			if (dblock_bm.free[g] > dblock_bm.free[best])
+				best = g;
+		}
+	}
+	return best * sb->inodes_per_group;
+}
+
+/*
+ * Grow the mounted image to nr_dblocks data blocks. mkfs laid the metadata out for sb->max_blocks,
+ * so this only makes the DISKFILE longer and opens up more of the bitmaps. no block moves.
+ * returns 0 on sucess, -EINVAL for a shrink, -EFBIG past the room mkfs left
+ */
+int grow_image(uint64_t nr_dblocks)
+{
+	nr_dblocks = fit_groups(nr_dblocks);
+	if (nr_dblocks < sb->nr_dblocks)
+		return -EINVAL;
+	if (nr_dblocks > max_dblocks())
+		return -EFBIG;
+	if (nr_dblocks == sb->nr_dblocks)
+		return 0;
+
+	// Step 1: extend the DISKFILE. the new blocks are a hole and read as zeros
+	if (dev_grow((sb->d_start_blk + nr_dblocks) * BLOCK_SIZE) < 0)
+		return -EIO;
+
+	// Step 2: let the bitmaps hand out the new blocks and inodes. new groups get their inode table slice first
+	bm_grow(&dblock_bm, nr_dblocks);
+	uint32_t nr_inodes = (sb->features & FEATURE_BGROUPS) ? inodes_in(nr_dblocks) : inodes_for(nr_dblocks);
+	if (nr_inodes > sb->max_inodes)
+		nr_inodes = sb->max_inodes;
+	if (nr_inodes > sb->nr_inodes)
+	{
+		if (sb->features & FEATURE_BGROUPS)
+			reserve_itables(sb->nr_inodes, nr_inodes);
+		bm_grow(&inode_bm, nr_inodes);
+	}
+	else
+		nr_inodes = sb->nr_inodes;
+
+	// Step 3: superblock last. a crash before it leaves the old image with a longer DISKFILE
+	my_print_always("GROW: %u -> %llu dblocks, %u -> %u inodes", sb->nr_dblocks, (unsigned long long)nr_dblocks, sb->nr_inodes, nr_inodes);
+	sb->nr_dblocks = nr_dblocks;
+	sb->nr_blocks = sb->d_start_blk + nr_dblocks;
+	sb->nr_inodes = nr_inodes;
+	sb->max_inum = nr_inodes;
+	sb->max_dnum = (sb->nr_dblocks <= UINT16_MAX) ? sb->nr_dblocks : 0;
+	bio_write(0, sb);
+	return 0;
+}
+
+/*
+ * The data region is full. grow it by an eighth (at least 64MB and at least needed blocks) if
+ * mkfs left room. returns 0 if it grew
+ */
+int autogrow(uint32_t needed)
+{
+	uint64_t room = sb->max_blocks - sb->nr_blocks;
+	if (room == 0)
+		return -1;
+	uint64_t step = sb->nr_dblocks / 8;
+	if (step < AUTOGROW_MIN)
+		step = AUTOGROW_MIN;
+	if (step < needed)
+		step = needed;
+	if (step > room)
+		step = room;
+	if (step < needed)
+		return -1;
+	return grow_image(sb->nr_dblocks + step);
+}
+
+/*
+ * The inode table is full. inodes come with the data region: grow it at least far enough into
+ * the next group to hold that group's inode table slice. returns 0 if there are more inodes now
+ */
+int autogrow_inodes()
+{
+	if (sb->nr_inodes >= sb->max_inodes)
+		return -1;
+	uint32_t needed = 1;
+	if (sb->features & FEATURE_BGROUPS)
+		needed = (uint64_t)(sb->nr_inodes / sb->inodes_per_group) * BLOCKS_PER_GROUP + itable_blocks() + 1 - sb->nr_dblocks;
+	uint32_t nr_inodes = sb->nr_inodes;
+	if (autogrow(needed) != 0)
+		return -1;
+	return (sb->nr_inodes > nr_inodes) ? 0 : -1;
+}
+
+/*
+ * Offline trim. punch out every free data block in dblock_bm. returns 0 on sucess, -1 on failure
+ */
+int rufs_trim(const char *diskfile)
+{
+	snprintf(diskfile_path, PATH_MAX, "%s", diskfile);
+	if (dev_open(diskfile_path) < 0)
+		return -1;
+	sb = malloc(BLOCK_SIZE);
+	bio_read(0, sb);
+	if (sb->magic_num != MAGIC_NUM)
+	{
+		my_print_always("TRIM: %s is not a rufs image", diskfile_path);
+		free(sb);
+		dev_close();
+		return -1;
+	}
+	fill_geometry();
+	bm_open(&dblock_bm, sb->d_bitmap_blk, sb->d_bitmap_len, sb->nr_dblocks, 0);
+	int punched = discard_free_runs(0, sb->nr_dblocks);
+	my_print_always("TRIM: punched out %d free dblocks (%d KB)", punched, punched * (BLOCK_SIZE / 1024));
+	free(sb);
+	bm_close(&dblock_bm);
+	dev_close();
+	return 0;
+}
+
+/*
+ * Current time as the inodes keep it, ns since the epoch
+ */
+int64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * inode operations
+ * unit16_t ino = [0 to MAX_INUM) = [0 to 1024)
+ * 128
+ */
+
+/*
+ * inode table block cache. readi/writei go through it, and readdir fills it ahead of the getattr
+ * of every child (prefetch_inodes()). direct mapped by block number, and written through
+ */
+void *icache_get(uint64_t block_num)
+{
+	struct icache_slot *slot = &icache[block_num % ICACHE_SLOTS];
+	return (slot->block_num == block_num) ? slot->data : NULL;
+}
+
+void icache_put(uint64_t block_num, const void *block)
+{
+	struct icache_slot *slot = &icache[block_num % ICACHE_SLOTS];
+	slot->block_num = block_num;
+	memcpy(slot->data, block, BLOCK_SIZE);
+}
+
+void icache_drop()
+{
+	for (int k = 0; k < ICACHE_SLOTS; k++)
+		icache[k].block_num = 0;
+}
+
+int readi(uint16_t ino, struct inode *inode)
+{
+	// Step 1: Get the inode's on-disk block number = start of its table slice + ino/number of inodes per block
+	uint64_t block_num = inode_blk(ino);
+
+	// Step 2: Get offset of the inode in the inode on-disk block
+	uint16_t offset = (ino % (BLOCK_SIZE / sizeof(struct inode)) * sizeof(struct inode));
+
+	// Step 3: Read the block from the cache or disk and then copy into inode structure
+	void *cached = icache_get(block_num);
+	if (cached != NULL)
+	{
+		icache_hits++;
+		memcpy(inode, cached + offset, sizeof(struct inode));
+		return 0;
+	}
+	icache_misses++;
+	void *block = blkbuf_get();
+	int stat = meta_read(block_num, block);
+	memcpy(inode, block + offset, sizeof(struct inode));
+	if (stat == 0)
+		icache_put(block_num, block);
+	blkbuf_put(block);
+	return stat;
+}
+
+int writei(uint16_t ino, struct inode *inode)
+{
+	// Step 1: Get the block number where this inode resides on disk
+	uint64_t block_num = inode_blk(ino);
+
+	// Step 2: Get the offset in the block where this inode resides on disk
+	uint16_t offset = (ino % (BLOCK_SIZE / sizeof(struct inode)) * sizeof(struct inode));
+
+	// Step 3: Write inode to disk, and to the cache
+	void *block = blkbuf_get();
+	void *cached = icache_get(block_num);
+	if (cached != NULL)
+		memcpy(block, cached, BLOCK_SIZE);
+	else
+		meta_read(block_num, block);
+	memcpy(block + offset, inode, sizeof(struct inode));
+	meta_write(block_num, block);
+	icache_put(block_num, block);
+	blkbuf_put(block);
+
+	return 0;
+}
+
+/*
+ * dir bloom filters. a name that is not in its dir's filter is not in the dir, so a lookup that
+ * is going to fail (create checks the name is free first) reads no dir blocks. names are never
+ * taken out, a removed one just costs a scan
+ */
+uint64_t name_hash(const char *name)
+{
+	uint64_t h = FP_PRIME5;
+	for (; *name; name++)
+		h = (h ^ (uint8_t)*name) * FP_PRIME1;
+	h ^= h >> 33;
+	h *= FP_PRIME2;
+	h ^= h >> 29;
+	return h;
+}
+
+struct dir_bloom *bloom_of(uint16_t ino)
+{
+	if (!bloom_enabled)
+		return NULL;
+	if (dir_blooms == NULL)
+		dir_blooms = calloc(BLOOM_SLOTS, sizeof(struct dir_bloom));
+	return &dir_blooms[ino % BLOOM_SLOTS];
+}
+
+void bloom_add(struct dir_bloom *bf, const char *name)
+{
+	uint64_t h = name_hash(name);
+	uint32_t h1 = h, h2 = (h >> 32) | 1;
+	for (int k = 0; k < BLOOM_HASHES; k++)
+	{
+		uint32_t bit = (h1 + k * h2) % BLOOM_BITS;
+		bf->bits[bit / 64] |= 1ULL << (bit % 64);
+	}
+}
+
+int bloom_maybe(struct dir_bloom *bf, const char *name)
+{
+	uint64_t h = name_hash(name);
+	uint32_t h1 = h, h2 = (h >> 32) | 1;
+	for (int k = 0; k < BLOOM_HASHES; k++)
+	{
+		uint32_t bit = (h1 + k * h2) % BLOOM_BITS;
+		if (!(bf->bits[bit / 64] & (1ULL << (bit % 64))))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * A name was added to dir ino, keep its filter (if it has one) in step
+ */
+void bloom_note(uint16_t ino, const char *name)
+{
+	struct dir_bloom *bf = bloom_of(ino);
+	if (bf != NULL && bf->ino == ino && bf->built)
+		bloom_add(bf, name);
+}
+
+/*
+ * returns 0 on sucess, -1 on failure
+ */
+int dir_find(uint16_t ino, const char *fname, size_t name_len, struct dirent *final_dirent)
+{
+	// Step 1: a name the dir's bloom filter has not seen is not there. without a filter, this scan
+	// goes through the whole dir and builds one
+	struct dir_bloom *bf = bloom_of(ino);
+	if (bf != NULL && bf->ino == ino && bf->built)
+	{
+		if (!bloom_maybe(bf, fname))
+		{
+			bloom_misses++;
+			return -1;
+		}
+		bf = NULL;
+	}
+	else if (bf != NULL)
+	{
+		memset(bf, 0, sizeof(*bf));
+		bf->ino = ino;
+	}
+
+	// Step 2: Call readi() to get the inode using ino (inode number of current directory)
+	struct inode curr_dir;
+	struct inode *curr_dir_inode = &curr_dir;
+	readi(ino, curr_dir_inode);
+
+	if (S_ISREG(curr_dir_inode->type))
+		return -1;
+	struct dirent *dirents = blkbuf_get();
+
+	// Step 3: Read directory's data block and check each directory entry.
+	// If the name matches, then copy directory entry to dirent structure
+	int found = -1;
+	for (int i = 0; i < MAX_DIRECT_PTRS; i++)
+	{
+		if (curr_dir_inode->direct_ptr[i] == INVALID_DBLOCK)
+		{
+			break;
+		}
+		// a filter built from a bad block could hide the names it really has
+		if (meta_read(sb->d_start_blk + curr_dir_inode->direct_ptr[i], dirents) == -1)
+			bf = NULL;
+		for (int j = 0; j < MAX_DIRENTS_PER_DIRECT_PTR; j++)
+		{
+			if (dirents[j].valid == INVALID_DIRENT)
+			{
+				continue;
+			}
+			if (bf != NULL)
+				bloom_add(bf, dirents[j].name);
+			if (found == -1 && strcmp(dirents[j].name, fname) == 0)
+			{
+				// match found
+				if (final_dirent != NULL)
+					memcpy(final_dirent, &dirents[j], sizeof(struct dirent));
+				found = 0;
+				if (bf == NULL)
+					break;
+			}
+		}
+		if (found == 0 && bf == NULL)
+			break;
+	}
+	if (bf != NULL)
+		bf->built = 1;
+	blkbuf_put(dirents);
+	return found;
+}
+/*
+ * returns 0 on sucess, -1 on failure
+ */
+int dir_add(struct inode dir_inode, uint16_t f_ino, const char *fname, size_t name_len)
+{
+	my_print_mag("In Dir Add");
+	// if (S_ISREG(dir_inode.type))
+	// 	return -1;
+
+	// Step 1: Check if fname (directory name) is already used in other entries
+	if (dir_find(dir_inode.ino, fname, name_len, NULL) == 0)
+	{
+		my_print("Dir add error. same name already exists");
+		return -1;
+	}
+
+	// Step 2: Read dir_inode's data block and check each directory entry of dir_inode
+	struct dirent *dirents = blkbuf_get();
+
+	// Step 3: Add directory entry in dir_inode's data block and write to disk
+	int i;
+	for (i = 0; i < MAX_DIRECT_PTRS; i++)
+	{
+		if (dir_inode.direct_ptr[i] == INVALID_DBLOCK)
+		{
+			my_print_mag("Going to add new Dirent Block at i:|%d|", i);
+			break;
+		}
+		meta_read(sb->d_start_blk + dir_inode.direct_ptr[i], dirents);
+		for (int j = 0; j < MAX_DIRENTS_PER_DIRECT_PTR; j++)
+		{
+			if (dirents[j].valid == INVALID_DIRENT)
+			{
+				dirents[j].valid = VALID_DIRENT;
+				dirents[j].ino = f_ino;
+				strcpy(dirents[j].name, fname);
+				dirents[j].len = name_len;
+
+				dir_inode.link += 1;
+				dir_inode.mtime_ns = dir_inode.ctime_ns = now_ns();
+
+				writei(dir_inode.ino, &dir_inode);
+				meta_write(sb->d_start_blk + dir_inode.direct_ptr[i], dirents);
+				bloom_note(dir_inode.ino, fname);
+				blkbuf_put(dirents);
+				my_print_mag("New Dirent Added |%s| at i:|%d| index:j|%d|", fname, i , j);
+				return 0;
+			}
+		}
+	}
+	if (i == MAX_DIRECT_PTRS){
+		my_print("Dir add error. max amount of dirents reached");
+		my_print_mag("Exiting Dir Add");
+		blkbuf_put(dirents);
+		return -1;
+	}
+		
+	my_print_mag("New Dirent Block Adding at I: |%d|", i);
+	// Allocate a new data block for this directory if it does not exist
+	int new_block = get_avail_blkno(blk_goal(&dir_inode, i));
+	if (new_block == INVALID_DBLOCK)
+	{
+		my_print("Dir add error. out of data blocks");
+		blkbuf_put(dirents);
+		return -1;
+	}
+	// the block the scan used is free again, start the new one from it
+	struct dirent *new_dirents = dirents;
+	memset(new_dirents, 0, BLOCK_SIZE);
+
+	// Update directory inode
+	dir_inode.direct_ptr[i] = new_block;
+	dir_inode.size += BLOCK_SIZE;
+	dir_inode.link += 1;
+	dir_inode.mtime_ns = dir_inode.ctime_ns = now_ns();
+	writei(dir_inode.ino, &dir_inode);
+
+	// Write directory entry
+	new_dirents->valid = VALID_DIRENT;
+	new_dirents->ino = f_ino;
+	strcpy(new_dirents->name, fname);
+	new_dirents->len = name_len;
+	meta_write(sb->d_start_blk + dir_inode.direct_ptr[i], new_dirents);
+	bloom_note(dir_inode.ino, fname);
+
+	blkbuf_put(new_dirents);
+
+	return 0;
+}
+
+// Required for 518
+int dir_remove(struct inode dir_inode, const char *fname, size_t name_len)
+{
+
+	// Step 1: Read dir_inode's data block and checks each directory entry of dir_inode
+
+	// Step 2: Check if fname exist
+
+	// Step 3: If exist, then remove it from dir_inode's data block and write to disk.
+	// the name stays in the dir's bloom filter, it only costs the next lookup of it a scan
+
+	return 0;
+}
+
+/*
+ * absulute pathnames only. return 0 on sucess, -1 on failure.
+ */
+int get_node_by_path(const char *const_path, uint16_t ino, struct inode *final_inode)
+{
+	my_print("get_node_by_path on |%s|", const_path);
+	if(strcmp("/", const_path) == 0){
+		return readi(0, final_inode);
+	}
+		
+	// Step 1: Resolve the path name, walk through path, and finally, find its inode.
+	// Note: You could either implement it in a iterative way or recursive way
+	if (const_path[0] == '/')
+		const_path += 1;
+	char *second_part = strchr(const_path, '/');
+
+	int len_child;
+
+	if (second_part == NULL)
+	{
+		// end of path
+		len_child = strlen(const_path);
+	}
+	else
+	{
+		len_child = second_part - const_path;
+	}
+	ARENA_SCOPE;
+	char *child = arena_alloc(len_child + 1);
+	memcpy(child, const_path, len_child);
+	child[len_child] = '\0';
+
+	my_print("Child of len %d is |%s|", len_child, child);
+
+	struct dirent child_de;
+	struct dirent *child_dirent = &child_de;
+	int found = dir_find(ino, child, len_child, child_dirent);
+
+	if (second_part == NULL)
+	{
+		if (found == 0)
+		{
+			my_print("Path Resolved at inode %d", child_dirent->ino);
+			if(final_inode != NULL)
+				return readi(child_dirent->ino, final_inode);
+			return 0;
+		}
+		else
+		{
+			return -1;
+		}
+	}
+	else
+	{
+		if (found == 0)
+		{
+			return get_node_by_path(second_part, child_dirent->ino, final_inode);
+		}
+		{
+			return -1;
+		}
+	}
+}
+
+/*
+ * file block operations. i is the direct_ptr index of the block in the file
+ */
+
+int inode_inline(struct inode *f_inode)
+{
+	return (sb->features & FEATURE_IFLAGS) && (f_inode->flags & INODE_INLINE);
+}
+
+int compress_enabled(struct inode *f_inode)
+{
+	if (compress_all)
+		return 1;
+	return (sb->features & FEATURE_IFLAGS) && (f_inode->flags & INODE_COMPRESS);
+}
+
+int cluster_compressed(struct inode *f_inode, int c)
+{
+	if (inode_inline(f_inode))
+		return 0;
+	int ptr = f_inode->direct_ptr[c * CLUSTER_BLOCKS];
+	return ptr != INVALID_DBLOCK && (ptr & DBLOCK_COMPRESSED);
+}
+
+// the last cluster we decompressed, so reading it block by block only decompresses once
+struct zcluster_cache {
+	int ino;
+	int c;
+	int head;	// first compressed block. a rewritten cluster always gets a new one
+	char data[CLUSTER_SIZE];
+} zcache = {.ino = -1};
+
+/*
+ * Decompress cluster c of a file into zcache. returns 0 on sucess, -1 if the cluster is corrupt
+ */
+int load_zcluster(struct inode *f_inode, int c)
+{
+	int *slots = &f_inode->direct_ptr[c * CLUSTER_BLOCKS];
+	if (zcache.ino == f_inode->ino && zcache.c == c && zcache.head == slots[0])
+		return 0;
+
+	ARENA_SCOPE;
+	char *zbuf = arena_alloc((CLUSTER_BLOCKS - 1) * BLOCK_SIZE);
+	int k, bad = 0;
+	for (k = 0; k < CLUSTER_BLOCKS - 1 && slots[k] != INVALID_DBLOCK; k++)
+		bad |= data_read(DBLOCK_NUM(slots[k]), zbuf + k * BLOCK_SIZE);
+	uint32_t clen;
+	memcpy(&clen, zbuf, sizeof(clen));
+	zcache.ino = -1;
+	if (!bad && clen <= k * BLOCK_SIZE - sizeof(clen)
+		&& lz_decompress(zbuf + sizeof(clen), clen, zcache.data, CLUSTER_SIZE) == CLUSTER_SIZE)
+	{
+		zcache.ino = f_inode->ino;
+		zcache.c = c;
+		zcache.head = slots[0];
+	}
+	if (zcache.ino == -1)
+	{
+		my_print_always("Corrupt compressed cluster %d of inode %d", c, f_inode->ino);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Get count data blocks near goal, as one run if possible. returns 0 on sucess, -1 (and nothing taken) if the disk is full
+ */
+int get_avail_blknos(int *blknos, int count, uint32_t goal)
+{
+	int run = get_avail_blkrun(count, goal);
+	for (int k = 0; k < count; k++)
+	{
+		blknos[k] = (run != INVALID_DBLOCK) ? run + k : get_avail_blkno(goal);
+		if (blknos[k] == INVALID_DBLOCK)
+		{
+			for (int j = 0; j < k; j++)
+				release_blkno(blknos[j]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Read block i of a file. holes and unwritten blocks come back as zeros without touching the disk
+ */
+int read_fblock(struct inode *f_inode, int i, void *buf)
+{
+	if (inode_inline(f_inode))
+	{
+		memset(buf, 0, BLOCK_SIZE);
+		if (i == 0)
+			memcpy(buf, f_inode->inline_data, f_inode->size);
+		return 0;
+	}
+	if (cluster_compressed(f_inode, i / CLUSTER_BLOCKS))
+	{
+		if (load_zcluster(f_inode, i / CLUSTER_BLOCKS) == -1)
+		{
+			memset(buf, 0, BLOCK_SIZE);
+			return -1;
+		}
+		memcpy(buf, zcache.data + (i % CLUSTER_BLOCKS) * BLOCK_SIZE, BLOCK_SIZE);
+		return BLOCK_SIZE;
+	}
+	int ptr = f_inode->direct_ptr[i];
+	if (ptr == INVALID_DBLOCK || (ptr & DBLOCK_UNWRITTEN))
+	{
+		memset(buf, 0, BLOCK_SIZE);
+		return 0;
+	}
+	return data_read(ptr, buf);
+}
+
+/*
+ * Write a full block i of a file. allocates a block for holes and copies shared blocks
+ * before writing (copy on write). the caller writes the inode.
+ * returns 0 on sucess, -1 when out of data blocks
+ */
+int write_fblock(struct inode *f_inode, int i, const void *buf)
+{
+	uint64_t fp = 0;
+	if (dedup_enabled)
+	{
+		fp = fingerprint_block(buf);
+		if (dedup_fblock(f_inode, i, buf, fp) == 0)
+			return 0;
+	}
+
+	int ptr = f_inode->direct_ptr[i];
+	if (ptr == INVALID_DBLOCK)
+	{
+		ptr = get_avail_blkno(blk_goal(f_inode, i));
+		if (ptr == INVALID_DBLOCK)
+			return -1;
+		my_print("New Block Allocated at i:%d|%d|", i, ptr);
+	}
+	else if (blk_shared(DBLOCK_NUM(ptr)))
+	{
+		int new_ptr = get_avail_blkno(blk_goal(f_inode, i));
+		if (new_ptr == INVALID_DBLOCK)
+			return -1;
+		my_print("COW Block at i:%d|%d| -> |%d|", i, DBLOCK_NUM(ptr), new_ptr);
+		put_blkno(DBLOCK_NUM(ptr));
+		ptr = new_ptr;
+	}
+	// first write into a fallocate'd block turns it into a normal block
+	f_inode->direct_ptr[i] = DBLOCK_NUM(ptr);
+	data_write(f_inode->direct_ptr[i], buf);
+	if (fp != 0)
+	{
+		set_fprint(f_inode->direct_ptr[i], fp);
+		fp_insert(fp, f_inode->direct_ptr[i]);
+	}
+	else
+		forget_fprint(f_inode->direct_ptr[i]);
+	return 0;
+}
+
+/*
+ * Write count full blocks from block i of a file that are all holes. they get one run of data
+ * blocks if there is one, so the whole span goes to the DISKFILE in one write (a write per
+ * run otherwise). no dedup, the caller checks. returns 0 on sucess, -1 when out of data blocks
+ */
+int write_fblock_run(struct inode *f_inode, int i, int count, const void *buf)
+{
+	int *blknos = arena_alloc(count * sizeof(int));
+	if (get_avail_blknos(blknos, count, blk_goal(f_inode, i)) == -1)
+		return -1;
+	for (int k = 0; k < count; )
+	{
+		int n = 1;
+		while (k + n < count && blknos[k + n] == blknos[k] + n)
+			n++;
+		data_write_run(blknos[k], n, buf + k * BLOCK_SIZE);
+		k += n;
+	}
+	for (int k = 0; k < count; k++)
+	{
+		f_inode->direct_ptr[i + k] = blknos[k];
+		forget_fprint(blknos[k]);
+	}
+	return 0;
+}
+
+/*
+ * Move the data of an inline file out to a data block so it can grow like any other file.
+ * returns 0 on sucess, -1 (and the file still inline) if the disk is full
+ */
+int spill_inline(struct inode *f_inode)
+{
+	if (!inode_inline(f_inode))
+		return 0;
+	void *data_block = blkbuf_get();
+	memset(data_block, 0, BLOCK_SIZE);
+	memcpy(data_block, f_inode->inline_data, f_inode->size);
+	f_inode->flags &= ~INODE_INLINE;
+	for (int i = 0; i < MAX_DIRECT_PTRS; i++)
+		f_inode->direct_ptr[i] = INVALID_DBLOCK;
+	memset(f_inode->indirect_ptr, 0, sizeof(f_inode->indirect_ptr));
+	int ret = 0;
+	if (f_inode->size > 0 && write_fblock(f_inode, 0, data_block) == -1)
+	{
+		memset(f_inode->inline_data, 0, INLINE_DATA_MAX);
+		memcpy(f_inode->inline_data, data_block, f_inode->size);
+		f_inode->flags |= INODE_INLINE;
+		ret = -1;
+	}
+	blkbuf_put(data_block);
+	return ret;
+}
+
+/*
+ * Read the whole cluster c of a file
+ */
+void read_cluster(struct inode *f_inode, int c, void *buf)
+{
+	for (int k = 0; k < CLUSTER_BLOCKS; k++)
+		read_fblock(f_inode, c * CLUSTER_BLOCKS + k, buf + k * BLOCK_SIZE);
+}
+
+/*
+ * Write the first nblocks blocks of cluster c of a file. when try_compress is set and the
+ * cluster is full it is stored compressed if that saves a block, otherwise as plain blocks.
+ * the caller writes the inode. returns 0 on sucess, -1 when out of data blocks
+ */
+int write_cluster(struct inode *f_inode, int c, const void *buf, int nblocks, int try_compress)
+{
+	int *slots = &f_inode->direct_ptr[c * CLUSTER_BLOCKS];
+	if (zcache.ino == f_inode->ino && zcache.c == c)
+		zcache.ino = -1;
+
+	if (try_compress && nblocks == CLUSTER_BLOCKS)
+	{
+		ARENA_SCOPE;
+		char *zbuf = arena_alloc((CLUSTER_BLOCKS - 1) * BLOCK_SIZE);
+		memset(zbuf, 0, (CLUSTER_BLOCKS - 1) * BLOCK_SIZE);
+		uint32_t clen = 0;
+		int stat = lz_compress(buf, CLUSTER_SIZE, zbuf + sizeof(clen), (CLUSTER_BLOCKS - 1) * BLOCK_SIZE - sizeof(clen));
+		int new_slots[CLUSTER_BLOCKS];
+		int need = 0;
+		if (stat > 0)
+		{
+			clen = stat;
+			memcpy(zbuf, &clen, sizeof(clen));
+			need = (sizeof(clen) + clen + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		}
+		// new blocks first, the old ones are only let go once the new copy is on disk
+		if (need > 0 && get_avail_blknos(new_slots, need, blk_goal(f_inode, c * CLUSTER_BLOCKS)) == 0)
+		{
+			for (int k = 0; k < need; k++)
+				data_write(new_slots[k], zbuf + k * BLOCK_SIZE);
+			for (int k = 0; k < CLUSTER_BLOCKS; k++)
+			{
+				if (slots[k] != INVALID_DBLOCK)
+					put_blkno(DBLOCK_NUM(slots[k]));
+				slots[k] = (k < need) ? (new_slots[k] | DBLOCK_COMPRESSED) : INVALID_DBLOCK;
+			}
+			my_print("Compressed cluster %d of inode %d into %d blocks", c, f_inode->ino, need);
+			return 0;
+		}
+	}
+
+	if (cluster_compressed(f_inode, c))
+	{
+		// going back to plain blocks. make sure the whole cluster fits before touching it
+		int needed = 0;
+		for (int k = 0; k < nblocks; k++)
+		{
+			if (slots[k] == INVALID_DBLOCK || blk_shared(DBLOCK_NUM(slots[k])))
+				needed++;
+		}
+		if (sb->nr_dblocks - amount_of_dblocks_used() < needed)
+			return -1;
+		for (int k = 0; k < CLUSTER_BLOCKS; k++)
+		{
+			if (slots[k] == INVALID_DBLOCK)
+				continue;
+			if (k < nblocks)
+				slots[k] = DBLOCK_NUM(slots[k]);
+			else
+			{
+				put_blkno(DBLOCK_NUM(slots[k]));
+				slots[k] = INVALID_DBLOCK;
+			}
+		}
+	}
+	for (int k = 0; k < nblocks; k++)
+	{
+		if (write_fblock(f_inode, c * CLUSTER_BLOCKS + k, buf + k * BLOCK_SIZE) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Turn a compressed cluster back into plain blocks. returns 0 on sucess, -1 when out of data blocks
+ */
+int expand_cluster(struct inode *f_inode, int c)
+{
+	if (!cluster_compressed(f_inode, c))
+		return 0;
+	ARENA_SCOPE;
+	void *cluster_buf = arena_alloc(CLUSTER_SIZE);
+	read_cluster(f_inode, c, cluster_buf);
+	return write_cluster(f_inode, c, cluster_buf, CLUSTER_BLOCKS, 0);
+}
+
+/*
+ * Make file system
+ */
+int rufs_mkfs()
+{
+	my_print("MKFS START");
+
+	// write superblock information
+	// geometry comes from the disk size. with --max-size the metadata is laid out for that instead,
+	// and the image starts with the data and inodes a --size image would have. the extra metadata
+	// is never written until the image grows into it, so it is just a hole in the DISKFILE
+	sb = calloc(1, BLOCK_SIZE);
+	sb->magic_num = MAGIC_NUM;
+	sb->features = FEATURE_REFCOUNT | FEATURE_IFLAGS | FEATURE_FPRINT | FEATURE_CSUM | FEATURE_GEOMETRY | FEATURE_BGROUPS;
+	layout_for(disk_size / BLOCK_SIZE, 0);
+	uint32_t nr_dblocks = sb->nr_dblocks;
+	if (max_disk_size > disk_size)
+		layout_for(max_disk_size / BLOCK_SIZE, sb->inodes_per_group);
+	sb->nr_dblocks = fit_groups(nr_dblocks);
+	sb->nr_blocks = sb->d_start_blk + sb->nr_dblocks;
+	sb->nr_inodes = inodes_in(sb->nr_dblocks);
+	// the old fields still describe images that fit in them, so older builds can mount those
+	sb->max_inum = sb->nr_inodes;
+	sb->max_dnum = (sb->nr_dblocks <= UINT16_MAX) ? sb->nr_dblocks : 0;
+
+	// Call dev_init() to initialize (Create) Diskfile
+	dev_init(diskfile_path, sb->nr_blocks * BLOCK_SIZE);
+	sb->state = SB_MOUNTED | SB_CSUM_INTENT;
+	sb->version = SB_VERSION;
+	bio_write(0, sb);
+
+	// checksum region first, every block written from here on gets its crc recorded.
+	// the new DISKFILE reads as zeros, so none of the regions or bitmaps have to be written out
+	region_open(&csum_region, sb->c_start_blk, CSUM_BLOCKS(sb->max_blocks), 1, 1);
+
+	// initialize refcount region, every block starts with a single owner
+	region_open(&ref_region, sb->r_start_blk, REFCOUNT_BLOCKS(max_dblocks()), 0, 1);
+
+	// initialize fingerprint region, no block has one yet
+	region_open(&fp_region, sb->f_start_blk, FPRINT_BLOCKS(max_dblocks()), 0, 1);
+
+	// initialize inode bitmap
+	bm_open(&inode_bm, sb->i_bitmap_blk, sb->i_bitmap_len, sb->nr_inodes, 1);
+
+	// initialize data block bitmap, the inode table slices take the first blocks of each group
+	bm_open(&dblock_bm, sb->d_bitmap_blk, sb->d_bitmap_len, sb->nr_dblocks, 1);
+	reserve_itables(0, sb->nr_inodes);
+
+	// update bitmap information for root directory
+	int root_ino = get_avail_ino(0);
+	int root_dno = get_avail_blkno(0);
+	my_print("Root Inode at inode: |%d|", root_ino);
+	my_print("Root DataBlock at num: |%d|", root_dno);
+
+	// update inode for root directory
+	struct inode *root_inode = malloc(sizeof(struct inode));
+	root_inode->ino = root_ino;
+	root_inode->valid = VALID_INODE;
+	root_inode->link = 2;
+	root_inode->size = BLOCK_SIZE;
+	root_inode->type = __S_IFDIR;
+	for (int i = 0; i < MAX_DIRECT_PTRS; i++)
+	{
+		root_inode->direct_ptr[i] = INVALID_DBLOCK;
+	}
+	root_inode->direct_ptr[0] = root_dno;
+	root_inode->mtime_ns = root_inode->ctime_ns = now_ns();
+	root_inode->uid = getuid();
+	root_inode->gid = getgid();
+	root_inode->flags = 0;
+
+	writei(root_ino, root_inode);
+
+	struct dirent* dirents = calloc(1, BLOCK_SIZE);
+	dirents[0].ino = root_inode->ino;
+	strcpy(dirents[0].name, ".");
+	dirents[0].len = strlen(dirents[0].name);
+	dirents[0].valid = VALID_DIRENT;
+
+	// no need for dot-dot 
+	// dirents[1].ino = root_inode->ino;
+	// strcpy(dirents[1].name, "..");
+	// dirents[1].len = strlen(dirents[1].name);
+	// dirents[1].valid = VALID_DIRENT;
+
+	meta_write(sb->d_start_blk + root_inode->direct_ptr[0], dirents);
+
+	// struct dirent *dot = dirents;
+	// struct dirent *dotdot = dirents + sizeof(struct dirent);
+	// dot->ino = root_inode->ino;
+	// strcpy(dot->name, ".");
+	// dot->len = strlen(dot->name);
+	// dot->valid = VALID_DIRENT;
+	// dotdot->ino = root_inode->ino;
+	// strcpy(dotdot->name, "..");
+	// dotdot->len = strlen(dotdot->name);
+	// dotdot->valid = VALID_DIRENT;
+	// meta_write(sb->d_start_blk + root_inode->direct_ptr[0], dirents);
+
+	free(root_inode);
+	free(dirents);
+	flush_csums();
+	return 0;
+}
+
+/*
+ * After a crash the checksum region can be behind the blocks written since it was last written
+ * back. those are under the set bits of sb->csum_intent and are taken as they are. every other
+ * block is only checked: a mismatch there is damage, it keeps its checksum so reads of it still
+ * fail. metadata gets checksums, data blocks only if they had one. an image last mounted without
+ * SB_CSUM_INTENT has every checksum retaken, after counting the mismatches
+ */
+void reseed_csums()
+{
+	int tracked = sb->state & SB_CSUM_INTENT;
+	uint32_t retaken = 0, damaged = 0;
+	void *block = malloc(BLOCK_SIZE);
+	for (uint64_t b = 1; b < sb->nr_blocks; b++)
+	{
+		if (b >= sb->c_start_blk && b < sb->c_start_blk + csum_region.len)
+			continue;
+		uint32_t want = *csum_of(b);
+		if (b >= sb->d_start_blk && want == 0)
+			continue;
+		bio_read(b, block);
+		uint32_t crc = crc32c(block, BLOCK_SIZE);
+		if (crc == want)
+			continue;
+		if (!tracked || want == 0 || get_bitmap(sb->csum_intent, csum_intent_bit(b)))
+		{
+			set_csum(b, crc);
+			retaken++;
+			continue;
+		}
+		my_print_always("Checksum mismatch on block %llu, which was not being written at the crash. keeping its checksum", (unsigned long long)b);
+		damaged++;
+	}
+	free(block);
+	flush_csums();
+	if (tracked)
+		my_print_always("Checksums: %u retaken for blocks written at the crash, %u blocks damaged", retaken, damaged);
+	else
+		my_print_always("Checksums: %u retaken, last mount did not record which blocks it was writing so damage can not be told apart", retaken);
+}
+
+/*
+ * Parse a size like 4096, 64K, 512M or 200G. returns 0 if it is not one
+ */
+uint64_t parse_size(const char *str)
+{
+	char *end;
+	uint64_t size = strtoull(str, &end, 10);
+	switch (*end)
+	{
+	case 'T': size <<= 10; /* fall through */
+	case 'G': size <<= 10; /* fall through */
+	case 'M': size <<= 10; /* fall through */
+	case 'K': size <<= 10; end++; break;
+	}
+	return (*end == '\0') ? size : 0;
+}
+
+/*
+ * Refuse to mount an image with the old inode format, rufs_migrate has to convert it first.
+ * returns 0 if the image is fine or does not exist yet, -1 otherwise
+ */
+int rufs_check_version(const char *diskfile)
+{
+	snprintf(diskfile_path, PATH_MAX, "%s", diskfile);
+	if (dev_open(diskfile_path) < 0)
+		return 0;
+	struct superblock *disk_sb = malloc(BLOCK_SIZE);
+	bio_read(0, disk_sb);
+	int ret = 0;
+	if (disk_sb->magic_num == MAGIC_NUM && disk_sb->version != SB_VERSION)
+	{
+		my_print_always("%s has v%d inodes, run ./rufs_migrate on it first", diskfile_path, disk_sb->version ? disk_sb->version : 1);
+		ret = -1;
+	}
+	free(disk_sb);
+	dev_close();
+	return ret;
+}
+
+/*
+ * file system operations. rufs.c hands them to FUSE, see librufs.h
+ */
+int rufs_mount(const char *diskfile)
+{
+	my_print("INIT START");
+	if (rufs_check_version(diskfile) == -1)
+		return -1;
+	trace_enabled = (trace_file != NULL);
+	// a packed image is only mapped, there is nothing else to set up
+	int packed = pack_open(diskfile);
+	if (packed != -1)
+		return packed == 0 ? 0 : -1;
+	// nothing cached from an earlier mount, the DISKFILE may have changed since
+	icache_drop();
+	zcache.ino = -1;
+	memset(ra_table, 0, sizeof(ra_table));
+	free(dir_blooms);
+	dir_blooms = NULL;
+	if (dev_open(diskfile_path) < 0)
+	{
+		my_print("Making DISK. Calling mkfs");
+		rufs_mkfs();
+	}
+	else
+	{
+		my_print("DISK Already Exists");
+		sb = malloc(BLOCK_SIZE);
+		bio_read(0, sb);
+		fill_geometry();
+		if (sb->features & FEATURE_CSUM)
+		{
+			region_open(&csum_region, sb->c_start_blk, CSUM_BLOCKS(sb->max_blocks), 1, 0);
+			if (sb->state & SB_MOUNTED)
+			{
+				my_print_always("DISKFILE was not unmounted cleanly, recomputing checksums");
+				reseed_csums();
+			}
+			clear_csum_intent();
+			sb->state |= SB_CSUM_INTENT;
+		}
+		sb->state |= SB_MOUNTED;
+		bio_write(0, sb);
+		// so we do not have to read the bitmaps from disk everytime doing bitmap ops
+		bm_open(&inode_bm, sb->i_bitmap_blk, sb->i_bitmap_len, sb->nr_inodes, 0);
+		bm_open(&dblock_bm, sb->d_bitmap_blk, sb->d_bitmap_len, sb->nr_dblocks, 0);
+		if (sb->features & FEATURE_REFCOUNT)
+			region_open(&ref_region, sb->r_start_blk, REFCOUNT_BLOCKS(max_dblocks()), 0, 0);
+		if (sb->features & FEATURE_FPRINT)
+			region_open(&fp_region, sb->f_start_blk, FPRINT_BLOCKS(max_dblocks()), 0, 0);
+
+		//tests file io
+
+		// tests. passed
+		// TODO: delete tests
+		
+		// my_print("Magic Num: %d", sb->magic_num);
+
+		// int next = get_avail_blkno();
+		// my_print("Next Block %d", next);
+		// next = get_avail_ino();
+		// my_print("Next Inode %d", next);
+
+		// struct inode *root_inode = malloc(sizeof(struct inode));
+		// readi(0, root_inode);
+		// my_print("RootNode Valid Check: %d", root_inode->valid);
+		// my_print("RootNode Last mtime: %d", root_inode->vstat.st_mtime);
+
+		// struct dirent *dirents = malloc(BLOCK_SIZE);
+		// bio_read(sb->d_start_blk + root_inode->direct_ptr[0], dirents);
+
+		// my_print("Dot Found at |%s|", dirents[0].name);
+		// my_print("DotDot Found at |%s|", dirents[1].name);
+
+		// my_print("Finding |.| in root: status |%d|", dir_find(root_inode->ino, ".", strlen("."), NULL));
+		// my_print("Finding |..| in root: status |%d|", dir_find(root_inode->ino, "..", strlen(".."), NULL));
+		// my_print("Adding |.| in root: status |%d|", dir_add(*root_inode, 10, ".", strlen(".")));
+		// my_print("Adding |..| in root: status |%d|", dir_add(*root_inode, 10, "..", strlen("..")));
+		// my_print("Finding |temp| in root: status |%d|", dir_find(root_inode->ino, "temp2", strlen("temp"), NULL));
+
+		// struct inode *inode_temp = malloc(sizeof(struct inode));
+		// inode_temp->ino = get_avail_ino();
+		// inode_temp->valid = VALID_INODE;
+		// inode_temp->link = 2;
+		// inode_temp->size = BLOCK_SIZE;
+		// inode_temp->type = __S_IFDIR;
+		// for (int i = 0; i < MAX_DIRECT_PTRS; i++)
+		// {
+		// 	inode_temp->direct_ptr[i] = INVALID_DBLOCK;
+		// }
+		// inode_temp->direct_ptr[0] = get_avail_blkno();
+		// time(&inode_temp->vstat.st_mtime);
+		// writei(inode_temp->ino, inode_temp);
+		// my_print("Adding |temp| w/ inode |%d| in root: status |%d|", inode_temp->ino, dir_add(*root_inode, inode_temp->ino, "temp2", strlen("temp2")));
+		
+		// struct inode *inode_cd = malloc(sizeof(struct inode));
+		// inode_cd->ino = get_avail_ino();
+		// inode_cd->valid = VALID_INODE;
+		// inode_cd->link = 2;
+		// inode_cd->size = BLOCK_SIZE;
+		// inode_cd->type = __S_IFDIR;
+		// for (int i = 0; i < MAX_DIRECT_PTRS; i++)
+		// {
+		// 	inode_cd->direct_ptr[i] = INVALID_DBLOCK;
+		// }
+		// inode_cd->direct_ptr[0] = get_avail_blkno();
+		// time(&inode_cd->vstat.st_mtime);
+		// writei(inode_cd->ino, inode_cd);
+		// my_print("Adding |temp/cd| w/ inode |%d| in temp: status |%d|", inode_cd->ino, dir_add(*inode_temp, inode_cd->ino, "cd", strlen("cd")));
+
+
+		// my_print("Finding |temp| in root: status |%d|", dir_find(root_inode->ino, "temp", strlen("temp"), NULL));
+		// bio_read(sb->d_start_blk + root_inode->direct_ptr[0], dirents);
+		// struct dirent *temp = dirents + sizeof(struct dirent) * 2;
+		// my_print("Dot Found at |%s|", dirents[0].name);
+		// my_print("DotDot Found at |%s|", dirents[1].name);
+		// my_print("Temp Found at |%s|", dirents[2].name);
+		
+		// struct inode* new_in = malloc(sizeof(struct inode));
+		// char* path = "/././temp/cd";
+		// int stat = get_node_by_path(path, root_inode->ino, new_in);
+		// my_print("Get Node at |%s| with stat |%d| and inode |%d|", path, stat, new_in->ino);
+
+		// my_print("%d %d",S_ISDIR(inode_temp->type), S_ISDIR(inode_cd->type));
+	}
+
+	// Step 1a: If disk file is not found, call mkfs
+
+	// Step 1b: If disk file is found, just initialize in-memory data structures
+	// and read superblock from disk
+
+	if (dedup_enabled)
+	{
+		// dedup shares blocks, so it needs the refcount and fingerprint regions on disk
+		if (ref_region.data == NULL || fp_region.data == NULL)
+		{
+			my_print_always("This DISKFILE has no fingerprint region, running without --dedup");
+			dedup_enabled = 0;
+		}
+		else
+			fp_index_rebuild();
+	}
+	return 0;
+}
+
+static void dump_trace()
+{
+	if (trace_enabled)
+	{
+		trace_enabled = 0;
+		int n = trace_dump(trace_file);
+		if (n >= 0)
+			my_print_always("Trace: %d events written to %s", n, trace_file);
+	}
+}
+
+void rufs_unmount()
+{
+	my_print("DESTROY START");
+	if (pack_mounted())
+	{
+		pack_close();
+		dump_trace();
+		return;
+	}
+	//calculate how many d blocks used for report:
+	my_print_always("Amount of dblocks used on this DISKFILE: %d dblocks", amount_of_dblocks_used());
+	
+	if (dedup_enabled)
+		my_print_always("Dedup shared %d dblocks instead of writing them", dedup_hits);
+	if (bloom_enabled)
+		my_print_always("Bloom: %d lookups answered without reading the dir", bloom_misses);
+	if (prefetch_enabled)
+		my_print_always("Prefetch: %d inode table blocks in %d reads", prefetch_blocks, prefetch_batches);
+	if (readahead_enabled)
+		my_print_always("Readahead: %d sequential reads, %d dblocks read ahead", ra_hits, ra_blocks);
+	flush_discards(1);
+	flush_fprints();
+	flush_csums();
+	clear_csum_intent();
+	sb->state &= ~SB_MOUNTED;
+	bio_write(0, sb);
+	dev_flush();
+
+	// Step 1: De-allocate in-memory data structures
+	free(sb);
+	bm_close(&inode_bm);
+	bm_close(&dblock_bm);
+	region_close(&ref_region);
+	region_close(&fp_region);
+	region_close(&csum_region);
+	free(fp_index);
+	fp_index = NULL;
+	scratch_free();
+	// Step 2: Close diskfile
+	dev_close();
+	dump_trace();
+}
+
+/*
+ * the stats file. STATS_DIR and STATS_FILE are not on disk, every lookup checks for them before
+ * the real tree, and they get inode numbers past MAX_INUM_LIMIT. the file is rendered again on
+ * each getattr and read, in the Prometheus text format
+ */
+#define STATS_DIR_INO 0xFFFE
+#define STATS_TEXT_MAX (64 * 1024)
+static const char *op_names[TRACE_OP_COUNT] = RUFS_OP_NAMES;
+
+static int stats_printf(char *buf, size_t size, int len, const char *format, ...)
+{
+	if (len >= size)
+		return len;
+	va_list args;
+	va_start(args, format);
+	len += vsnprintf(buf + len, size - len, format, args);
+	va_end(args);
+	return len;
+}
+
+/*
+ * One histogram series (_bucket, _sum, _count) of name, labeled label="value"
+ */
+static int stats_histogram(char *buf, size_t size, int len, const char *name, const char *label, const char *value, struct op_stat *st)
+{
+	uint64_t cum = 0;
+	for (int b = 0; b < HIST_BUCKETS - 1; b++)
+	{
+		cum += __atomic_load_n(&st->buckets[b], __ATOMIC_RELAXED);
+		len = stats_printf(buf, size, len, "%s_bucket{%s=\"%s\",le=\"%g\"} %lu\n", name, label, value,
+			(double)(1ULL << (b + HIST_MIN_SHIFT)) / 1e9, cum);
+	}
+	uint64_t count = __atomic_load_n(&st->count, __ATOMIC_RELAXED);
+	len = stats_printf(buf, size, len, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %lu\n", name, label, value, count);
+	len = stats_printf(buf, size, len, "%s_sum{%s=\"%s\"} %.9f\n", name, label, value, __atomic_load_n(&st->sum_ns, __ATOMIC_RELAXED) / 1e9);
+	return stats_printf(buf, size, len, "%s_count{%s=\"%s\"} %lu\n", name, label, value, count);
+}
+
+/*
+ * Render the stats into buf. returns the length of the whole text, which is cut at size
+ */
+int stats_render(char *buf, size_t size)
+{
+	int len = 0;
+	len = stats_printf(buf, size, len, "# HELP rufs_op_duration_seconds Latency of each FUSE operation\n# TYPE rufs_op_duration_seconds histogram\n");
+	for (int op = 0; op < OP_COUNT; op++)
+		len = stats_histogram(buf, size, len, "rufs_op_duration_seconds", "op", op_names[op], &op_stats[op]);
+	len = stats_printf(buf, size, len, "# HELP rufs_op_errors_total FUSE operations that returned an error\n# TYPE rufs_op_errors_total counter\n");
+	for (int op = 0; op < OP_COUNT; op++)
+		len = stats_printf(buf, size, len, "rufs_op_errors_total{op=\"%s\"} %lu\n", op_names[op], op_stats[op].errors);
+	len = stats_printf(buf, size, len, "# HELP rufs_file_bytes_total File data read and written\n# TYPE rufs_file_bytes_total counter\n");
+	len = stats_printf(buf, size, len, "rufs_file_bytes_total{io=\"read\"} %lu\nrufs_file_bytes_total{io=\"write\"} %lu\n",
+		op_stats[OP_READ].bytes, op_stats[OP_WRITE].bytes);
+
+	len = stats_printf(buf, size, len, "# HELP rufs_dev_duration_seconds Latency of DISKFILE reads and writes\n# TYPE rufs_dev_duration_seconds histogram\n");
+	len = stats_histogram(buf, size, len, "rufs_dev_duration_seconds", "io", "read", &dev_read_stat);
+	len = stats_histogram(buf, size, len, "rufs_dev_duration_seconds", "io", "write", &dev_write_stat);
+	len = stats_printf(buf, size, len, "# HELP rufs_dev_bytes_total Bytes moved to and from the DISKFILE\n# TYPE rufs_dev_bytes_total counter\n");
+	len = stats_printf(buf, size, len, "rufs_dev_bytes_total{io=\"read\"} %lu\nrufs_dev_bytes_total{io=\"write\"} %lu\n",
+		dev_read_stat.bytes, dev_write_stat.bytes);
+
+	len = stats_printf(buf, size, len, "# TYPE rufs_icache_hits_total counter\nrufs_icache_hits_total %lu\n", icache_hits);
+	len = stats_printf(buf, size, len, "# TYPE rufs_icache_misses_total counter\nrufs_icache_misses_total %lu\n", icache_misses);
+	len = stats_printf(buf, size, len, "# TYPE rufs_bloom_negatives_total counter\nrufs_bloom_negatives_total %d\n", bloom_misses);
+	len = stats_printf(buf, size, len, "# TYPE rufs_prefetch_blocks_total counter\nrufs_prefetch_blocks_total %d\n", prefetch_blocks);
+	len = stats_printf(buf, size, len, "# TYPE rufs_readahead_sequential_total counter\nrufs_readahead_sequential_total %d\n", ra_hits);
+	len = stats_printf(buf, size, len, "# TYPE rufs_readahead_blocks_total counter\nrufs_readahead_blocks_total %d\n", ra_blocks);
+	len = stats_printf(buf, size, len, "# TYPE rufs_dedup_hits_total counter\nrufs_dedup_hits_total %d\n", dedup_hits);
+	// a packed image has no data blocks
+	if (!pack_mounted())
+	{
+		len = stats_printf(buf, size, len, "# TYPE rufs_dblocks_used gauge\nrufs_dblocks_used %d\n", amount_of_dblocks_used());
+		len = stats_printf(buf, size, len, "# TYPE rufs_dblocks gauge\nrufs_dblocks %u\n", sb->nr_dblocks);
+	}
+	return len;
+}
+
+/*
+ * getattr of STATS_DIR and STATS_FILE. returns 0 if path is one of them, -1 if it is not
+ */
+int stats_getattr(const char *path, struct stat *stbuf)
+{
+	int is_dir = strcmp(path, STATS_DIR) == 0;
+	if (!is_dir && strcmp(path, STATS_FILE) != 0)
+		return -1;
+	if (stbuf == NULL)
+		return 0;
+	memset(stbuf, 0, sizeof(*stbuf));
+	stbuf->st_uid = getuid();
+	stbuf->st_gid = getgid();
+	clock_gettime(CLOCK_REALTIME, &stbuf->st_mtim);
+	stbuf->st_ctim = stbuf->st_mtim;
+	if (is_dir)
+	{
+		stbuf->st_mode = __S_IFDIR | 0555;
+		stbuf->st_nlink = 2;
+		return 0;
+	}
+	ARENA_SCOPE;
+	stbuf->st_mode = __S_IFREG | 0444;
+	stbuf->st_nlink = 1;
+	stbuf->st_size = stats_render(arena_alloc(STATS_TEXT_MAX), STATS_TEXT_MAX);
+	return 0;
+}
+
+int stats_read(char *buffer, size_t size, off_t offset)
+{
+	ARENA_SCOPE;
+	char *text = arena_alloc(STATS_TEXT_MAX);
+	int len = stats_render(text, STATS_TEXT_MAX);
+	if (len > STATS_TEXT_MAX - 1)
+		len = STATS_TEXT_MAX - 1;
+	if (offset >= len)
+		return 0;
+	int n = (offset + size > len) ? len - offset : size;
+	memcpy(buffer, text + offset, n);
+	return n;
+}
+
+int rufs_getattr(const char *path, struct stat *stbuf)
+{
+	ARENA_SCOPE;
+	my_print("GET_ATTR START");
+	if(stats_getattr(path, stbuf) == 0)
+		return 0;
+	if(pack_mounted()){
+		int ino = pack_lookup(path);
+		if(ino >= 0 && stbuf != NULL)
+			pack_stat(ino, stbuf);
+		return (ino >= 0) ? 0 : ino;
+	}
+
+	// Step 1: call get_node_by_path() to get inode from path
+	struct inode* in = arena_alloc(sizeof(struct inode));
+	int stat = get_node_by_path(path, 0, in);
+	if(stat == -1){
+		errno = ENOENT;
+		return -ENOENT;  
+	}
+	// Step 2: fill attribute of file into stbuf from inode
+
+	// stbuf->st_mode = __S_IFDIR | 0755;
+	
+	// stbuf->st_nlink = 2;
+	// time(&stbuf->st_mtime);
+	
+	// st_uid
+	// st_gid
+	// st_nlink
+	// st_size
+	// st_mtime
+	// st_mode
+	if(stbuf != NULL){
+		stbuf->st_uid = in->uid;
+		stbuf->st_gid = in->gid;
+		stbuf->st_nlink = in->link;
+		stbuf->st_size = in->size;
+		stbuf->st_mtim.tv_sec = in->mtime_ns / 1000000000;
+		stbuf->st_mtim.tv_nsec = in->mtime_ns % 1000000000;
+		stbuf->st_ctim.tv_sec = in->ctime_ns / 1000000000;
+		stbuf->st_ctim.tv_nsec = in->ctime_ns % 1000000000;
+		//blocks really held on disk, so du shows what holes and compression save
+		stbuf->st_blocks = 0;
+		for(int i = 0; i < MAX_DIRECT_PTRS && !inode_inline(in); i++){
+			if(in->direct_ptr[i] != INVALID_DBLOCK)
+				stbuf->st_blocks += BLOCK_SIZE / 512;
+		}
+		if(S_ISDIR(in->type))
+			stbuf->st_mode = in->type | 0755; //0777
+		else //reg file
+			stbuf->st_mode = in->type | 0644;  //rw-r--r--. the bechmarks makes files with rw-rw-rw-
+	}
+
+	return 0;
+}
+
+int rufs_opendir(const char *path, uint16_t *ino)
+{
+	ARENA_SCOPE;
+	my_print("OPEN DIR START");
+	if(strcmp(path, STATS_DIR) == 0){
+		if(ino != NULL)
+			*ino = STATS_DIR_INO;
+		return 0;
+	}
+	if(pack_mounted()){
+		int pino = pack_lookup(path);
+		if(pino < 0 || !pack_is_dir(pino))
+			return -1;
+		if(ino != NULL)
+			*ino = pino;
+		return 0;
+	}
+
+	// Step 1: Call get_node_by_path() to get inode from path
+	// Step 2: If not find, return -1
+	struct inode* in = arena_alloc(sizeof(struct inode));
+	int stat = get_node_by_path(path, 0, in);
+	if(stat == -1 || !S_ISDIR(in->type)){
+		return -1;
+	}
+	if(ino != NULL)
+		*ino = in->ino;
+	return 0;
+}
+
+int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * A listed dir is usually followed by a getattr of every child, so read the inode table blocks
+ * of all of them now: sorted, and each run of neighbouring blocks in one read. the first dirent
+ * block of child dirs is handed to dev_readahead() too, for tree walks going one level down
+ */
+void prefetch_inodes(const uint16_t *inos, int count)
+{
+	ARENA_SCOPE;
+	// Step 1: the inode table blocks not in the cache yet, sorted and without repeats
+	uint64_t *blks = arena_alloc(count * sizeof(uint64_t));
+	int n = 0;
+	for (int k = 0; k < count; k++)
+	{
+		uint64_t b = inode_blk(inos[k]);
+		if (icache_get(b) == NULL)
+			blks[n++] = b;
+	}
+	qsort(blks, n, sizeof(uint64_t), cmp_u64);
+	int uniq = 0;
+	for (int k = 0; k < n; k++)
+	{
+		if (uniq == 0 || blks[uniq - 1] != blks[k])
+			blks[uniq++] = blks[k];
+	}
+
+	// Step 2: read them a run at a time and cache the ones that match their checksum.
+	// gaps of a few blocks are read along rather than split into another read
+	char *run_buf = arena_alloc(PREFETCH_RUN_MAX * BLOCK_SIZE);
+	for (int k = 0; k < uniq;)
+	{
+		int end = k + 1;
+		while (end < uniq && blks[end] - blks[k] < PREFETCH_RUN_MAX && blks[end] - blks[end - 1] <= PREFETCH_GAP)
+			end++;
+		int len = blks[end - 1] - blks[k] + 1;
+		bio_read_blocks(blks[k], len, run_buf);
+		for (int j = k; j < end; j++)
+		{
+			void *block = run_buf + (blks[j] - blks[k]) * BLOCK_SIZE;
+			if (csum_region.data == NULL || check_csum(blks[j], crc32c(block, BLOCK_SIZE)) == 0)
+				icache_put(blks[j], block);
+		}
+		prefetch_batches++;
+		prefetch_blocks += len;
+		k = end;
+	}
+
+	// Step 3: the first dirent block of each child dir, without waiting for it
+	struct inode child;
+	for (int k = 0; k < count; k++)
+	{
+		if (icache_get(inode_blk(inos[k])) == NULL || readi(inos[k], &child) == -1)
+			continue;
+		if (S_ISDIR(child.type) && child.direct_ptr[0] != INVALID_DBLOCK)
+			dev_readahead(sb->d_start_blk + DBLOCK_NUM(child.direct_ptr[0]), 1);
+	}
+}
+
+int rufs_readdir(const char *path, rufs_filler_t filler, void *ctx)
+{
+	ARENA_SCOPE;
+	my_print("READ DIR START |%s|", path);
+	if(strcmp(path, STATS_DIR) == 0){
+		filler(ctx, ".");
+		filler(ctx, "..");
+		filler(ctx, STATS_FILE + strlen(STATS_DIR) + 1);
+		return 0;
+	}
+	if(pack_mounted()){
+		int ino = pack_lookup(path);
+		if(ino < 0 || !pack_is_dir(ino))
+			return -1;
+		pack_readdir(ino, filler, ctx);
+		if(ino == 0)
+			filler(ctx, STATS_DIR + 1);
+		return 0;
+	}
+
+	// Step 1: Call get_node_by_path() to get inode from path
+	struct inode* in = arena_alloc(sizeof(struct inode));
+	int stat = get_node_by_path(path, 0, in);
+	if(stat == -1 || !S_ISDIR(in->type)){
+		return -1;
+	}
+	// Step 2: Read directory entries from its data blocks, and copy them to filler
+	struct inode* temp = arena_alloc(sizeof(struct inode));
+	struct dirent* dirents = blkbuf_get();
+	uint16_t* child_inos = arena_alloc(MAX_DIRECT_PTRS * MAX_DIRENTS_PER_DIRECT_PTR * sizeof(uint16_t));
+	int nchildren = 0;
+	for(int i = 0; i < MAX_DIRECT_PTRS; i++){
+		if(in->direct_ptr[i] == INVALID_DBLOCK)
+			break;
+		meta_read(sb->d_start_blk + in->direct_ptr[i], dirents);
+		for(int j = 0; j < MAX_DIRENTS_PER_DIRECT_PTR; j++){
+			if(dirents[j].valid == VALID_DIRENT){
+				my_print("filling in |%s|", dirents[j].name);
+				filler(ctx, dirents[j].name);
+				child_inos[nchildren++] = dirents[j].ino;
+			}
+
+		}
+	}
+	if(in->ino == 0)
+		filler(ctx, STATS_DIR + 1);
+	// Step 3: get the children's inodes in ahead of their getattr
+	if(prefetch_enabled && nchildren > 0)
+		prefetch_inodes(child_inos, nchildren);
+	blkbuf_put(dirents);
+	return 0;
+}
+
+
+int rufs_mkdir(const char *path, mode_t mode)
+{
+	ARENA_SCOPE;
+	my_print("MAKE DIR |%s|", path);
+	if(pack_mounted())
+		return -EROFS;
+	
+
+	//note 2:, must call getattr() to see if file already exisits
+	if(strlen(path) == 0){
+		return -1;
+	}
+	if(rufs_getattr(path, NULL) == 0){
+		return -1;
+	}
+
+	// Step 1: Use dirname() and basename() to separate parent directory path and target directory name
+	// int len_path = strlen(path);
+	// char* non_const_path = malloc(len_path+ 1);
+	// strcpy(non_const_path, path);
+	// my_print("%s -> %s", path, non_const_path);
+	char* base_name = basename(arena_strdup(path));
+	char* dir_name = dirname(arena_strdup(path));
+	my_print("Splting |%s| into Dirname: |%s| Basname: |%s|", path, dir_name, base_name);
+	if(strlen(dir_name) == 0 || strlen(base_name) == 0){
+		return -1;
+	}
+
+	// Step 2: Call get_node_by_path() to get inode of parent directory
+	struct inode* parrent_inode = arena_alloc(sizeof(struct inode));
+	int stat = get_node_by_path(dir_name, 0, parrent_inode);
+	if(stat == -1){
+		return -1;
+	}
+
+
+	// Step 3: Call get_avail_ino() to get an available inode number, in a group with room for the dir to grow
+	int base_ino = get_avail_ino(ino_goal(parrent_inode, 1));
+	my_print("NEW DIR INODE |%d| ----------------", base_ino);
+	if(base_ino == -1){
+		return -ENOSPC;
+	}
+
+	// Step 4: Call dir_add() to add directory entry of target directory to parent directory
+	stat = dir_add(*parrent_inode, base_ino, base_name, strlen(base_name));
+	if(stat == -1){
+		my_print("MKDIR ERRO: could not add in dir add");
+		return -1;
+	}
+
+	// Step 5: Update inode for target directory
+	struct inode* base_inode = arena_alloc(sizeof(struct inode));
+	base_inode->ino = base_ino;
+	base_inode->link = 2;
+	base_inode->size = BLOCK_SIZE;
+	base_inode->type = __S_IFDIR;
+	base_inode->valid = VALID_INODE;
+	for(int i = 0; i < MAX_DIRECT_PTRS; i++){
+		base_inode->direct_ptr[i] = INVALID_DBLOCK;
+	}
+	base_inode->direct_ptr[0] = get_avail_blkno(blk_goal(base_inode, 0));
+	base_inode->mtime_ns = base_inode->ctime_ns = now_ns();
+	base_inode->uid = getuid();
+	base_inode->gid = getgid();
+	// new files and dirs take the compress flag from their parent like chattr +c does
+	base_inode->flags = (sb->features & FEATURE_IFLAGS) ? (parrent_inode->flags & INODE_COMPRESS) : 0;
+
+	struct dirent* dirents = blkbuf_get();
+	memset(dirents, 0, BLOCK_SIZE);
+	dirents[0].ino = base_ino;
+	strcpy(dirents[0].name, ".");
+	dirents[0].len = strlen(dirents[0].name);
+	dirents[0].valid = VALID_DIRENT;
+	dirents[1].ino = parrent_inode->ino;
+	strcpy(dirents[1].name, "..");
+	dirents[1].len = strlen(dirents[1].name);
+	dirents[1].valid = VALID_DIRENT;
+
+	// Step 6: Call writei() to write inode to disk
+	meta_write(sb->d_start_blk + base_inode->direct_ptr[0], dirents);
+	blkbuf_put(dirents);
+	writei(base_ino, base_inode);
+	return 0;
+}
+
+// Required for 518
+int rufs_rmdir(const char *path)
+{
+	if(pack_mounted())
+		return -EROFS;
+
+	// Step 1: Use dirname() and basename() to separate parent directory path and target directory name
+
+	// Step 2: Call get_node_by_path() to get inode of target directory
+
+	// Step 3: Clear data block bitmap of target directory
+
+	// Step 4: Clear inode bitmap and its data block
+
+	// Step 5: Call get_node_by_path() to get inode of parent directory
+
+	// Step 6: Call dir_remove() to remove directory entry of target directory in its parent directory
+
+	return 0;
+}
+
+int rufs_create(const char *path, mode_t mode, uint16_t *ino)
+{
+	ARENA_SCOPE;
+	my_print("CREATE FILE at |%s|", path);
+	if(pack_mounted())
+		return -EROFS;
+
+	//note 2:, must call getattr() to see if file already exisits
+	if(strlen(path) == 0){
+		return -1;
+	}
+	if(rufs_getattr(path, NULL) == 0){
+		return -1;
+	}
+
+	// Step 1: Use dirname() and basename() to separate parent directory path and target file name
+	char* base_name = basename(arena_strdup(path));
+	char* dir_name = dirname(arena_strdup(path));
+	if(strlen(dir_name) == 0 || strlen(base_name) == 0){
+		return -1;
+	}
+
+	// Step 2: Call get_node_by_path() to get inode of parent directory
+	struct inode* parrent_inode = arena_alloc(sizeof(struct inode));
+	int stat = get_node_by_path(dir_name, 0, parrent_inode);
+	if(stat == -1){
+		return -1;
+	}
+
+	// Step 3: Call get_avail_ino() to get an available inode number, next to its parent
+	int base_ino = get_avail_ino(ino_goal(parrent_inode, 0));
+	my_print("NEW FILE INODE |%d| ----------------", base_ino);
+	if(base_ino == -1){
+		return -ENOSPC;
+	}
+	if(ino != NULL)
+		*ino = base_ino;
+
+	// Step 4: Call dir_add() to add directory entry of target file to parent directory
+	stat = dir_add(*parrent_inode, base_ino, base_name, strlen(base_name));
+	if(stat == -1){
+		return -1;
+	}
+
+	// Step 5: Update inode for target file
+	struct inode* base_inode = arena_alloc(sizeof(struct inode));
+	base_inode->ino = base_ino;
+	base_inode->link = 1;
+	base_inode->size = 0;
+	base_inode->type = __S_IFREG;
+	base_inode->valid = VALID_INODE;
+	for(int i = 0; i < MAX_DIRECT_PTRS; i++){
+		base_inode->direct_ptr[i] = INVALID_DBLOCK;
+	}
+	// //TODO: remove
+	// base_inode->direct_ptr[0] = get_avail_blkno();
+	// base_inode->direct_ptr[1] = get_avail_blkno();
+	// base_inode->direct_ptr[2] = get_avail_blkno();
+	
+	base_inode->mtime_ns = base_inode->ctime_ns = now_ns();
+	base_inode->uid = getuid();
+	base_inode->gid = getgid();
+	// new files and dirs take the compress flag from their parent like chattr +c does
+	base_inode->flags = (sb->features & FEATURE_IFLAGS) ? (parrent_inode->flags & INODE_COMPRESS) : 0;
+	// and start out inline, the first block is only taken once the file outgrows the inode
+	if(sb->features & FEATURE_IFLAGS){
+		base_inode->flags |= INODE_INLINE;
+		memset(base_inode->inline_data, 0, INLINE_DATA_MAX);
+	}
+
+	// Step 6: Call writei() to write inode to disk
+	writei(base_ino, base_inode);
+	return 0;
+}
+
+int rufs_open(const char *path, uint16_t *ino)
+{
+	ARENA_SCOPE;
+	my_print("OPEN FILE START");
+	if(strcmp(path, STATS_FILE) == 0){
+		if(ino != NULL)
+			*ino = STATS_INO;
+		return 0;
+	}
+	if(pack_mounted()){
+		int pino = pack_lookup(path);
+		if(pino < 0 || pack_is_dir(pino))
+			return -1;
+		if(ino != NULL)
+			*ino = pino;
+		return 0;
+	}
+
+	// Step 1: Call get_node_by_path() to get inode from path
+	// Step 2: If not find, return -1
+	struct inode* in = arena_alloc(sizeof(struct inode));
+	int stat = get_node_by_path(path, 0, in);
+	if(stat == -1 || !S_ISREG(in->type)){
+		return -1;
+	}
+	if(ino != NULL)
+		*ino = in->ino;
+	return 0;
+}
+
+/*
+ * readahead. a read that starts where the last read of the same file ended is sequential and
+ * doubles the window of blocks asked for ahead of it, anything else collapses the window. the
+ * blocks past what has been asked for already go to dev_readahead(), so the host reads them into
+ * its page cache while the reader is still busy with this request
+ */
+void readahead_after(struct inode *f_inode, off_t offset, int total)
+{
+	struct ra_state *ra = &ra_table[f_inode->ino % RA_SLOTS];
+	if (ra->ino != f_inode->ino)
+	{
+		memset(ra, 0, sizeof(*ra));
+		ra->ino = f_inode->ino;
+	}
+	if (offset == ra->next_off)
+	{
+		ra->window = (ra->window == 0) ? RA_MIN : ra->window * 2;
+		if (ra->window > RA_MAX)
+			ra->window = RA_MAX;
+		ra_hits++;
+	}
+	else
+	{
+		ra->window = 0;
+		ra->ahead_i = 0;
+	}
+	ra->next_off = offset + total;
+	if (ra->window == 0 || total == 0)
+		return;
+
+	// Step 1: the blocks of the window that were not asked for yet, up to the end of the file
+	int first = (offset + total + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	if (first < ra->ahead_i)
+		first = ra->ahead_i;
+	int last = (offset + total - 1) / BLOCK_SIZE + ra->window;
+	int file_blocks = (f_inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	if (last >= file_blocks)
+		last = file_blocks - 1;
+	if (last >= MAX_DIRECT_PTRS)
+		last = MAX_DIRECT_PTRS - 1;
+
+	// Step 2: one hint per run of neighbouring blocks. holes and reserved blocks have nothing to read
+	int run_start = -1, run_len = 0;
+	for (int i = first; i <= last + 1; i++)
+	{
+		int ptr = (i <= last) ? f_inode->direct_ptr[i] : INVALID_DBLOCK;
+		int blkno = (ptr == INVALID_DBLOCK || (ptr & DBLOCK_UNWRITTEN)) ? -1 : DBLOCK_NUM(ptr);
+		if (blkno != -1 && run_len > 0 && blkno == run_start + run_len)
+		{
+			run_len++;
+			continue;
+		}
+		if (run_len > 0)
+		{
+			dev_readahead(sb->d_start_blk + run_start, run_len);
+			ra_blocks += run_len;
+		}
+		run_start = blkno;
+		run_len = (blkno != -1) ? 1 : 0;
+	}
+	if (last + 1 > ra->ahead_i)
+		ra->ahead_i = last + 1;
+}
+
+int rufs_read(uint16_t ino, char *buffer, size_t size, off_t offset)
+{
+	ARENA_SCOPE;
+	// offset = 10;
+	// size = 4 * BLOCK_SIZE - 1000;
+	my_print("READ |%d| bytes from inode |%d| starting from |%d|", size, ino, offset);
+	if(ino == STATS_INO)
+		return stats_read(buffer, size, offset);
+	if(pack_mounted())
+		return pack_read(ino, buffer, size, offset);
+
+	// Step 1: Use fi to get ino of the file
+	struct inode* f_inode = arena_alloc(sizeof(struct inode));
+	if(readi(ino, f_inode) == -1){
+		return -EIO;
+	}
+	if(offset > f_inode->size){
+		return -1;
+	}
+	//tiny files are all in the inode, nothing else to read
+	if(inode_inline(f_inode)){
+		int rem = (offset + size > f_inode->size) ? f_inode->size - offset : size;
+		memcpy(buffer, f_inode->inline_data + offset, rem);
+		return rem;
+	}
+	// Step 2: Based on size and offset, read its data blocks from disk
+	// plain blocks are all read first and checksummed together, full blocks go straight
+	// into buffer and only the partial first and last block go through edge
+	char* edge = arena_alloc(2 * BLOCK_SIZE);
+	int blknos[MAX_DIRECT_PTRS];
+	void* bufs[MAX_DIRECT_PTRS];
+	int n = 0;
+	int err = 0;
+
+	int sor_i = offset / BLOCK_SIZE; //starting direct pointer index
+	int i = sor_i;
+	//never read past the end of the file
+	int rem = (offset + size > f_inode->size) ? f_inode->size - offset : size;
+	int total = 0;
+	char* out = buffer;
+	my_print("Starting Block: %d", sor_i);
+	my_print("Remaing to read: %d", rem);
+	while(rem > 0 && i < MAX_DIRECT_PTRS) {
+		//if at starting block (aka the block that contatins the offset), make sure you start to read from the offset
+		int start = (i == sor_i) ? (offset % BLOCK_SIZE): 0;
+		//the amount of bytes to read based on how much is left to read
+		int bytes_to_read = (rem > BLOCK_SIZE - start) ? BLOCK_SIZE - start : rem;
+		int partial = bytes_to_read != BLOCK_SIZE;
+		char* dst = partial ? edge + (i == sor_i ? 0 : BLOCK_SIZE) : out;
+
+		int ptr = f_inode->direct_ptr[i];
+		if(ptr == INVALID_DBLOCK || (ptr & DBLOCK_FLAGS) || cluster_compressed(f_inode, i / CLUSTER_BLOCKS)){
+			if(read_fblock(f_inode, i, dst) == -1)
+				err = 1;
+		}else{
+			blknos[n] = ptr;
+			bufs[n++] = dst;
+		}
+		my_print("Queued |%d| starting from |%d| @ block i:%d|%d|", bytes_to_read, start, i, ptr);
+
+		//update ptrs and counts
+		out += bytes_to_read;
+		total += bytes_to_read;
+		rem -= bytes_to_read;
+		i++;
+	}
+	if(data_read_batch(blknos, bufs, n) == -1)
+		err = 1;
+
+	// Step 3: copy the partial edge blocks into place
+	if(!err && total > 0){
+		int start = offset % BLOCK_SIZE;
+		int first = (total < BLOCK_SIZE - start) ? total : BLOCK_SIZE - start;
+		if(first != BLOCK_SIZE)
+			memcpy(buffer, edge + start, first);
+		int last = (total - first) % BLOCK_SIZE;
+		if(total > first && last != 0)
+			memcpy(buffer + total - last, edge + BLOCK_SIZE, last);
+	}
+	my_print("TOTAL AMOUNT READ |%d| bytes", total);
+	if(!err && readahead_enabled)
+		readahead_after(f_inode, offset, total);
+	return err ? -EIO : total;
+}
+
+int rufs_write(uint16_t ino, const char *buffer, size_t size, off_t offset)
+{
+	ARENA_SCOPE;
+	my_print("WRITE |%d| bytes to inode |%d| starting from |%d|", size, ino, offset);
+	if(ino == STATS_INO)
+		return -EACCES;
+	if(pack_mounted())
+		return -EROFS;
+
+	// Step 1: Use fi to get ino of file
+	struct inode* f_inode = arena_alloc(sizeof(struct inode));
+	if(readi(ino, f_inode) == -1){
+		return -EIO;
+	}
+
+	if(offset > f_inode->size){
+		return -1;
+	}
+	void* data_block = blkbuf_get();
+	void* cluster_buf = NULL;
+
+	int sow_i = offset / BLOCK_SIZE;
+	int i = sow_i;
+	int rem = size;
+	int total = 0;
+	if(inode_inline(f_inode)){
+		if(offset + size <= INLINE_DATA_MAX){
+			memcpy(f_inode->inline_data + offset, buffer, size);
+			total = size;
+			rem = 0;
+		}else if(spill_inline(f_inode) == -1){
+			rem = 0;
+		}
+	}
+	my_print("starting in Block i:%d|%d|", i, f_inode->direct_ptr[i]);
+	my_print("starting while loop");
+	while(rem > 0 && i < MAX_DIRECT_PTRS) {
+		int c = i / CLUSTER_BLOCKS;
+		if(compress_enabled(f_inode) || cluster_compressed(f_inode, c)) {
+			//compressed files are written a whole cluster at a time
+			off_t pos = offset + total;
+			int start = pos - (off_t)c * CLUSTER_SIZE;
+			int bytes_to_write = (rem > CLUSTER_SIZE - start) ? CLUSTER_SIZE - start : rem;
+			if(cluster_buf == NULL)
+				cluster_buf = arena_alloc(CLUSTER_SIZE);
+			if(bytes_to_write != CLUSTER_SIZE)
+				read_cluster(f_inode, c, cluster_buf);
+			memcpy(cluster_buf + start, buffer, bytes_to_write);
+
+			//only the blocks below EOF hold data, and only a full cluster gets compressed
+			off_t file_end = (pos + bytes_to_write > f_inode->size) ? pos + bytes_to_write : f_inode->size;
+			off_t in_cluster = file_end - (off_t)c * CLUSTER_SIZE;
+			int nblocks = (in_cluster >= CLUSTER_SIZE) ? CLUSTER_BLOCKS : (in_cluster + BLOCK_SIZE - 1) / BLOCK_SIZE;
+			if(write_cluster(f_inode, c, cluster_buf, nblocks, compress_enabled(f_inode)) == -1) {
+				my_print("Out of data blocks at cluster:%d", c);
+				break;
+			}
+			my_print("Writen |%d| starting from |%d| @ cluster c:%d", bytes_to_write, start, c);
+
+			buffer += bytes_to_write;
+			total += bytes_to_write;
+			rem -= bytes_to_write;
+			i = (c + 1) * CLUSTER_BLOCKS;
+			continue;
+		}
+
+		int start = (i == sow_i) ? (offset % BLOCK_SIZE) : 0;
+		//full blocks into holes, like a new file being filled, go out as one run
+		int run = 0;
+		while(start == 0 && !dedup_enabled && (run + 1) * BLOCK_SIZE <= rem && i + run < MAX_DIRECT_PTRS
+			&& f_inode->direct_ptr[i + run] == INVALID_DBLOCK && !cluster_compressed(f_inode, (i + run) / CLUSTER_BLOCKS))
+			run++;
+		if(run > 1) {
+			if(write_fblock_run(f_inode, i, run, buffer) == -1) {
+				my_print("Out of data blocks for a run of %d at i:%d", run, i);
+				break;
+			}
+			buffer += run * BLOCK_SIZE;
+			total += run * BLOCK_SIZE;
+			rem -= run * BLOCK_SIZE;
+			i += run;
+			continue;
+		}
+		int bytes_to_write = (rem > (BLOCK_SIZE - start)) ? (BLOCK_SIZE - start) : rem;
+
+		//keep the bytes around the part we are writing
+		if(bytes_to_write != BLOCK_SIZE)
+			read_fblock(f_inode, i, data_block);
+		memcpy(data_block + start, buffer, bytes_to_write);
+		if(write_fblock(f_inode, i, data_block) == -1) {
+			my_print("Out of data blocks at i:%d", i);
+			break;
+		}
+		my_print("Writen |%d| starting from |%d| @ block i:%d|%d|w|%d|", bytes_to_write, start, i, f_inode->direct_ptr[i], (BLOCK_SIZE - start));
+
+		buffer += bytes_to_write;
+		total += bytes_to_write;
+		rem -= bytes_to_write;
+		i++;
+	}
+	// Step 2: Based on size and offset, read its data blocks from disk
+
+	// Step 3: Write the correct amount of data from offset to disk
+
+	// Step 4: Update the inode info and write it to disk
+
+	// Note: this function should return the amount of bytes you write to disk
+	my_print("TOTAL AMOUNT WRiting |%d| bytes", total);
+	if(offset + total > f_inode->size)
+		f_inode->size = offset + total;
+	f_inode->mtime_ns = f_inode->ctime_ns = now_ns();
+	writei(f_inode->ino, f_inode);
+	blkbuf_put(data_block);
+	if(total == 0 && size > 0)
+		return -ENOSPC;
+	return total;
+}
+
+/*
+ * preallocate or punch out the blocks in [offset, offset+length).
+ * preallocated blocks are marked DBLOCK_UNWRITTEN, so they read as zeros until the first write
+ */
+int rufs_fallocate(uint16_t ino, int mode, off_t offset, off_t length)
+{
+	ARENA_SCOPE;
+	my_print("FALLOCATE inode |%d| mode |%d| from |%d| len |%d|", ino, mode, offset, length);
+	if(ino == STATS_INO)
+		return -EACCES;
+	if(pack_mounted())
+		return -EROFS;
+
+	if(mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE))
+		return -EOPNOTSUPP;
+	//same rule as the kernel: a hole punch never changes the size
+	if((mode & FALLOC_FL_PUNCH_HOLE) && !(mode & FALLOC_FL_KEEP_SIZE))
+		return -EOPNOTSUPP;
+	if(offset < 0 || length <= 0)
+		return -EINVAL;
+	if(offset + length > MAX_FILE_SIZE)
+		return -EFBIG;
+
+	struct inode* f_inode = arena_alloc(sizeof(struct inode));
+	readi(ino, f_inode);
+	if(!S_ISREG(f_inode->type)){
+		return -ENODEV;
+	}
+
+	off_t end = offset + length;
+	int first_i = offset / BLOCK_SIZE;
+	int last_i = (end - 1) / BLOCK_SIZE;
+	int ret = 0;
+
+	if(inode_inline(f_inode) && (end <= INLINE_DATA_MAX || (mode & FALLOC_FL_PUNCH_HOLE))){
+		//the range is in the inode already, bytes past the size are always zero
+		if(mode & FALLOC_FL_PUNCH_HOLE){
+			if(offset < f_inode->size)
+				memset(f_inode->inline_data + offset, 0, ((end < f_inode->size) ? end : f_inode->size) - offset);
+		}else if(!(mode & FALLOC_FL_KEEP_SIZE) && end > f_inode->size){
+			f_inode->size = end;
+		}
+		f_inode->mtime_ns = f_inode->ctime_ns = now_ns();
+		writei(f_inode->ino, f_inode);
+		return 0;
+	}
+	if(spill_inline(f_inode) == -1){
+		return -ENOSPC;
+	}
+
+	if(mode & FALLOC_FL_PUNCH_HOLE){
+		//a hole has to line up with blocks, so compressed clusters in the way go back to plain blocks
+		for(int c = first_i / CLUSTER_BLOCKS; c <= last_i / CLUSTER_BLOCKS; c++){
+			if(expand_cluster(f_inode, c) == -1){
+				return -ENOSPC;
+			}
+		}
+		void* data_block = blkbuf_get();
+		for(int i = first_i; i <= last_i; i++){
+			int ptr = f_inode->direct_ptr[i];
+			if(ptr == INVALID_DBLOCK)
+				continue;
+			off_t blk_start = (off_t)i * BLOCK_SIZE;
+			int start = (offset > blk_start) ? offset - blk_start : 0;
+			int stop = (end < blk_start + BLOCK_SIZE) ? end - blk_start : BLOCK_SIZE;
+			if(start == 0 && stop == BLOCK_SIZE){
+				//whole block is inside the hole, give it back
+				put_blkno(DBLOCK_NUM(ptr));
+				f_inode->direct_ptr[i] = INVALID_DBLOCK;
+			} else if(!(ptr & DBLOCK_UNWRITTEN)){
+				//partial block, just zero the range
+				read_fblock(f_inode, i, data_block);
+				memset(data_block + start, 0, stop - start);
+				if(write_fblock(f_inode, i, data_block) == -1){
+					//a shared block needs a copy and the disk is full. keep what was punched so far
+					ret = -ENOSPC;
+					break;
+				}
+			}
+		}
+		blkbuf_put(data_block);
+	} else {
+		//count the blocks that still need backing so we can ask for a single contiguous run
+		//compressed clusters are always fully backed, their empty slots are not holes
+		int missing = 0;
+		for(int i = first_i; i <= last_i; i++){
+			if(f_inode->direct_ptr[i] == INVALID_DBLOCK && !cluster_compressed(f_inode, i / CLUSTER_BLOCKS))
+				missing++;
+		}
+		int run = (missing > 0) ? get_avail_blkrun(missing, blk_goal(f_inode, first_i)) : INVALID_DBLOCK;
+		int fresh[MAX_DIRECT_PTRS] = {0};
+		for(int i = first_i; i <= last_i; i++){
+			if(f_inode->direct_ptr[i] != INVALID_DBLOCK || cluster_compressed(f_inode, i / CLUSTER_BLOCKS))
+				continue;
+			int blkno = (run != INVALID_DBLOCK) ? run++ : get_avail_blkno(blk_goal(f_inode, i));
+			if(blkno == INVALID_DBLOCK){
+				//disk is full. undo what this call reserved
+				for(int j = first_i; j < i; j++){
+					if(fresh[j])
+						release_blkno(DBLOCK_NUM(f_inode->direct_ptr[j]));
+				}
+				return -ENOSPC;
+			}
+			f_inode->direct_ptr[i] = blkno | DBLOCK_UNWRITTEN;
+			fresh[i] = 1;
+		}
+		if(!(mode & FALLOC_FL_KEEP_SIZE) && end > f_inode->size)
+			f_inode->size = end;
+	}
+
+	f_inode->mtime_ns = f_inode->ctime_ns = now_ns();
+	writei(f_inode->ino, f_inode);
+	return ret;
+}
+
+/*
+ * Share blocks of src into dst (reflink). no data is copied, both inodes point at the same
+ * data blocks and rufs_write copies a block the first time either side changes it.
+ * offsets and len are in bytes and must be block aligned, except len may end at src EOF if
+ * it also reaches dst EOF.
+ * the caller writes dst to disk, also on failure since blocks cloned before an -ENOSPC stay.
+ * returns 0 on sucess, -errno on failure
+ */
+int clone_range(struct inode *src, off_t src_off, struct inode *dst, off_t dst_off, off_t len)
+{
+	if (ref_region.data == NULL)
+		return -EOPNOTSUPP;
+	if (!S_ISREG(src->type) || !S_ISREG(dst->type))
+		return -EINVAL;
+	if (src_off < 0 || dst_off < 0 || src_off % BLOCK_SIZE != 0 || dst_off % BLOCK_SIZE != 0)
+		return -EINVAL;
+	if (src_off > src->size)
+		return -EINVAL;
+	if (len == 0 || src_off + len > src->size)
+		len = src->size - src_off;
+	if (len == 0)
+		return 0;
+	if (len % BLOCK_SIZE != 0 && src_off + len != src->size)
+		return -EINVAL;
+	// the tail block is shared whole, so it would put what lies past src EOF over dst bytes
+	if (len % BLOCK_SIZE != 0 && dst_off + len < dst->size)
+		return -EINVAL;
+	if (dst_off + len > MAX_FILE_SIZE)
+		return -EFBIG;
+	if (src->ino == dst->ino && src_off < dst_off + len && dst_off < src_off + len)
+		return -EINVAL;
+
+	// an inline dst needs real blocks to point at. an inline src has none to share, so
+	// its bytes are copied below instead
+	if (spill_inline(dst) == -1)
+		return -ENOSPC;
+
+	int count = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	int src_i = src_off / BLOCK_SIZE;
+	int dst_i = dst_off / BLOCK_SIZE;
+
+	// compressed clusters of dst that are only partly replaced go back to plain blocks
+	for (int c = dst_i / CLUSTER_BLOCKS; c <= (dst_i + count - 1) / CLUSTER_BLOCKS; c++)
+	{
+		if (c * CLUSTER_BLOCKS < dst_i || (c + 1) * CLUSTER_BLOCKS > dst_i + count)
+		{
+			if (expand_cluster(dst, c) == -1)
+				return -ENOSPC;
+		}
+	}
+
+	ARENA_SCOPE;
+	void *data_block = arena_alloc(BLOCK_SIZE);
+	for (int k = 0; k < count; k++)
+	{
+		int ptr = src->direct_ptr[src_i + k];
+		int old = dst->direct_ptr[dst_i + k];
+		int sc = (src_i + k) / CLUSTER_BLOCKS;
+
+		// dst keeps its old block until the new one is in place, so running out of space
+		// leaves it as it was
+
+		// inline bytes are copied, and a compressed cluster can only be shared whole and at
+		// the same place in its cluster
+		if (inode_inline(src) || (cluster_compressed(src, sc) && (sc * CLUSTER_BLOCKS < src_i || (sc + 1) * CLUSTER_BLOCKS > src_i + count
+			|| src_i % CLUSTER_BLOCKS != dst_i % CLUSTER_BLOCKS)))
+		{
+			read_fblock(src, src_i + k, data_block);
+			dst->direct_ptr[dst_i + k] = INVALID_DBLOCK;
+			if (write_fblock(dst, dst_i + k, data_block) == -1)
+			{
+				dst->direct_ptr[dst_i + k] = old;
+				return -ENOSPC;
+			}
+		}
+		else
+		{
+			if (ptr != INVALID_DBLOCK && get_blkref(DBLOCK_NUM(ptr)) == -1)
+			{
+				// block has as many owners as it can count, give dst a private copy
+				int new_ptr = get_avail_blkno(blk_goal(dst, dst_i + k));
+				if (new_ptr == INVALID_DBLOCK)
+					return -ENOSPC;
+				data_read(DBLOCK_NUM(ptr), data_block);
+				data_write(new_ptr, data_block);
+				ptr = new_ptr | (ptr & DBLOCK_FLAGS);
+			}
+			dst->direct_ptr[dst_i + k] = ptr;
+		}
+		if (old != INVALID_DBLOCK)
+			put_blkno(DBLOCK_NUM(old));
+	}
+
+	if (dst_off + len > dst->size)
+		dst->size = dst_off + len;
+	dst->mtime_ns = dst->ctime_ns = now_ns();
+	return 0;
+}
+
+int rufs_ioctl(uint16_t ino, int cmd, void *data)
+{
+	ARENA_SCOPE;
+	my_print("IOCTL inode |%d| cmd |%x|", ino, cmd);
+	if(ino == STATS_INO || ino == STATS_DIR_INO || pack_mounted())
+		return -ENOTTY;
+
+	switch (cmd)
+	{
+	case RUFS_IOC_CLONE_RANGE:
+	{
+		struct rufs_clone_range *args = data;
+		args->src_path[RUFS_CLONE_PATH_MAX - 1] = '\0';
+
+		struct inode *src = arena_alloc(sizeof(struct inode));
+		if (get_node_by_path(args->src_path, 0, src) == -1)
+		{
+			return -ENOENT;
+		}
+		struct inode *dst = arena_alloc(sizeof(struct inode));
+		readi(ino, dst);
+		// cloning within one file has to work on a single copy of the inode
+		int stat = clone_range(src, args->src_offset, src->ino == dst->ino ? src : dst, args->dest_offset, args->length);
+		writei(dst->ino, src->ino == dst->ino ? src : dst);
+		return stat;
+	}
+	case RUFS_IOC_GROW:
+	{
+		uint64_t size = *(uint64_t *)data;
+		if (size / BLOCK_SIZE <= sb->d_start_blk)
+			return -EINVAL;
+		return grow_image(size / BLOCK_SIZE - sb->d_start_blk);
+	}
+	case FS_IOC_GETFLAGS:
+	{
+		struct inode *in = arena_alloc(sizeof(struct inode));
+		readi(ino, in);
+		*(uint32_t *)data = compress_enabled(in) ? FS_COMPR_FL : 0;
+		return 0;
+	}
+	case FS_IOC_SETFLAGS:
+	{
+		uint32_t fl = *(uint32_t *)data;
+		if (!(sb->features & FEATURE_IFLAGS) || (fl & ~FS_COMPR_FL))
+			return -EOPNOTSUPP;
+		struct inode *in = arena_alloc(sizeof(struct inode));
+		readi(ino, in);
+		// only new writes are affected, clusters already on disk stay as they are
+		if (fl & FS_COMPR_FL)
+			in->flags |= INODE_COMPRESS;
+		else
+			in->flags &= ~INODE_COMPRESS;
+		in->ctime_ns = now_ns();
+		writei(in->ino, in);
+		return 0;
+	}
+	default:
+		return -ENOTTY;
+	}
+}
+
+// Required for 518
+
+int rufs_unlink(const char *path)
+{
+	if(pack_mounted())
+		return -EROFS;
+
+	// Step 1: Use dirname() and basename() to separate parent directory path and target file name
+
+	// Step 2: Call get_node_by_path() to get inode of target file
+
+	// Step 3: Clear data block bitmap of target file
+
+	// Step 4: Clear inode bitmap and its data block
+
+	// Step 5: Call get_node_by_path() to get inode of parent directory
+
+	// Step 6: Call dir_remove() to remove directory entry of target file in its parent directory
+
+	return 0;
+}
+
+/*
+ * Write back the discards, fingerprints and checksums held in memory
+ */
+int rufs_flush()
+{
+	if (pack_mounted())
+		return 0;
+	flush_discards(0);
+	flush_fprints();
+	flush_csums();
+	return 0;
+}
+
+/*
+ * offline fsck of an image that is not mounted. threads scan the inode table and then the dirs,
+ * each taking the next few blocks or the next dir off a shared counter, and keep what they
+ * find in bitsets (atomic or) and per thread lists. the cross checks and repairs run after
+ * them in one thread, through the usual bitmap, inode and dirent code so checksums stay right.
+ * the tree only ever grows (no rename or rmdir), so an inode no dir names is all an
+ * unreachable one can be
+ */
+#define FSCK_BATCH 16			// inode table blocks a thread takes at a time
+#define FSCK_SHOW 10			// problems of a kind printed one by one, the rest are only counted
+#define FSCK_MAX_THREADS 64
+#define LOST_FOUND "/lost+found"
+
+enum {
+	FSCK_CSUM,
+	FSCK_PTR,
+	FSCK_DANGLING,
+	FSCK_LINK,
+	FSCK_IBITMAP,
+	FSCK_DBITMAP,
+	FSCK_REFCOUNT,
+	FSCK_SHARED,
+	FSCK_ORPHAN,
+	FSCK_KINDS
+};
+static const char *fsck_kinds[FSCK_KINDS] = {
+	"blocks failing their checksum", "block pointers out of the data region", "dirents of free inodes",
+	"wrong link counts", "inode bitmap bits", "data block bitmap bits", "wrong refcounts",
+	"shared blocks on an image without refcounts", "inodes in no dir",
+};
+
+struct fsck_vec {
+	void *data;
+	size_t len, cap;	// in entries
+};
+
+// a direct_ptr that has to go
+struct fsck_ptr {
+	uint16_t ino;
+	uint16_t i;
+	int ptr;
+};
+
+// a valid dirent naming a free inode, in block i slot j of dir
+struct fsck_slot {
+	uint16_t dir;
+	uint16_t ino;
+	uint16_t i;
+	uint16_t j;
+};
+
+struct fsck_dir {
+	uint16_t ino;
+	int ptr[MAX_DIRECT_PTRS];	// INVALID_DBLOCK for the ones in bad_ptrs
+};
+
+struct fsck_thread {
+	pthread_t thread;
+	struct fsck_vec dirs, dups, bad_ptrs, dangling;
+	uint32_t bad_csums;
+};
+
+static struct {
+	int checksums;			// csum_region is loaded, the threads can check against it
+	uint32_t next;			// work counter of the running scan
+	uint64_t *ino_valid, *ino_dir, *blk_owned;		// bitsets
+	uint32_t *links;		// link of each valid inode
+	uint32_t *refs;			// dirents (not . or ..) naming each inode
+	uint16_t *entries;		// dirents (not . or ..) of each dir that name a valid inode
+	struct fsck_dir *dirs;
+	uint32_t ndirs;
+	uint32_t found[FSCK_KINDS], fixed[FSCK_KINDS];
+} fsck;
+
+static void fsck_push(struct fsck_vec *v, const void *entry, size_t size)
+{
+	if (v->len == v->cap)
+	{
+		v->cap = v->cap ? v->cap * 2 : 64;
+		v->data = realloc(v->data, v->cap * size);
+	}
+	memcpy((char *)v->data + v->len * size, entry, size);
+	v->len++;
+}
+
+static int fsck_test(uint64_t *set, uint32_t i)
+{
+	return (set[i / 64] >> (i % 64)) & 1;
+}
+
+/* set bit i, returns what it was */
+static int fsck_mark(uint64_t *set, uint32_t i)
+{
+	uint64_t bit = 1ULL << (i % 64);
+	return (__atomic_fetch_or(&set[i / 64], bit, __ATOMIC_RELAXED) & bit) != 0;
+}
+
+static void fsck_problem(int kind, const char *format, ...)
+{
+	if (fsck.found[kind]++ >= FSCK_SHOW)
+		return;
+	char msg[256];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(msg, sizeof(msg), format, args);
+	va_end(args);
+	my_print_always("FSCK: %s", msg);
+}
+
+/*
+ * A data block a pointer can not be at: past the data region, or in an inode table slice
+ */
+static int fsck_bad_blk(uint32_t b)
+{
+	if (b >= sb->nr_dblocks)
+		return 1;
+	return (sb->features & FEATURE_BGROUPS) && b % BLOCKS_PER_GROUP < itable_blocks()
+		&& b / BLOCKS_PER_GROUP < sb->nr_inodes / sb->inodes_per_group;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static int fsck_dot(struct dirent *de)
+{
+	return de->name[0] == '.' && (de->len == 1 || (de->len == 2 && de->name[1] == '.'));
+}
+
+static void fsck_inode(struct fsck_thread *t, uint16_t ino, struct inode *inode)
+{
+	if (inode->valid != VALID_INODE)
+		return;
+	fsck_mark(fsck.ino_valid, ino);
+	fsck.links[ino] = inode->link;
+	int is_dir = S_ISDIR(inode->type);
+	if (is_dir)
+		fsck_mark(fsck.ino_dir, ino);
+	struct fsck_dir dir = { .ino = ino };
+	for (int i = 0; i < MAX_DIRECT_PTRS; i++)
+		dir.ptr[i] = INVALID_DBLOCK;
+
+	if (!inode_inline(inode))
+	{
+		// Step 1: a compressed cluster with a bad pointer can not be read back at all, it goes whole
+		int bad_cluster[MAX_CLUSTERS] = { 0 };
+		for (int i = 0; i < MAX_DIRECT_PTRS; i++)
+		{
+			int ptr = inode->direct_ptr[i];
+			if (ptr != INVALID_DBLOCK && (ptr & DBLOCK_COMPRESSED) && fsck_bad_blk(DBLOCK_NUM(ptr)))
+				bad_cluster[i / CLUSTER_BLOCKS] = 1;
+		}
+		// Step 2: every other pointer is one owner of its block, a second one goes on the dups list
+		for (int i = 0; i < MAX_DIRECT_PTRS; i++)
+		{
+			int ptr = inode->direct_ptr[i];
+			if (ptr == INVALID_DBLOCK)
+				continue;
+			uint32_t b = DBLOCK_NUM(ptr);
+			if (fsck_bad_blk(b) || ((ptr & DBLOCK_COMPRESSED) && bad_cluster[i / CLUSTER_BLOCKS]))
+			{
+				struct fsck_ptr bad = { ino, i, ptr };
+				fsck_push(&t->bad_ptrs, &bad, sizeof(bad));
+				continue;
+			}
+			dir.ptr[i] = ptr;
+			if (fsck_mark(fsck.blk_owned, b))
+				fsck_push(&t->dups, &b, sizeof(b));
+		}
+	}
+	if (is_dir)
+		fsck_push(&t->dirs, &dir, sizeof(dir));
+}
+
+static void *fsck_scan_inodes(void *arg)
+{
+	struct fsck_thread *t = arg;
+	uint32_t nblocks = sb->nr_inodes / INODES_PER_BLOCK;
+	char *blocks = malloc(FSCK_BATCH * BLOCK_SIZE);
+	uint32_t k;
+	while ((k = __atomic_fetch_add(&fsck.next, FSCK_BATCH, __ATOMIC_RELAXED)) < nblocks)
+	{
+		uint32_t end = (k + FSCK_BATCH < nblocks) ? k + FSCK_BATCH : nblocks;
+		while (k < end)
+		{
+			// one read for the blocks next to each other on disk, a group's slice ends a run
+			uint32_t first = k * INODES_PER_BLOCK;
+			uint32_t n = end - k;
+			if ((sb->features & FEATURE_BGROUPS) && n > itable_blocks() - k % itable_blocks())
+				n = itable_blocks() - k % itable_blocks();
+			uint64_t blk = inode_blk(first);
+			bio_read_blocks(blk, n, blocks);
+			for (uint32_t b = 0; b < n; b++)
+			{
+				struct inode *inodes = (struct inode *)(blocks + b * BLOCK_SIZE);
+				if (fsck.checksums && check_csum(blk + b, crc32c(inodes, BLOCK_SIZE)) == -1)
+					t->bad_csums++;
+				for (int s = 0; s < INODES_PER_BLOCK; s++)
+					fsck_inode(t, first + b * INODES_PER_BLOCK + s, &inodes[s]);
+			}
+			k += n;
+		}
+	}
+	free(blocks);
+	return NULL;
+}
+
+static void *fsck_scan_dirs(void *arg)
+{
+	struct fsck_thread *t = arg;
+	struct dirent *dirents = malloc(BLOCK_SIZE);
+	uint32_t d;
+	while ((d = __atomic_fetch_add(&fsck.next, 1, __ATOMIC_RELAXED)) < fsck.ndirs)
+	{
+		struct fsck_dir *dir = &fsck.dirs[d];
+		for (int i = 0; i < MAX_DIRECT_PTRS; i++)
+		{
+			if (dir->ptr[i] == INVALID_DBLOCK)
+				continue;
+			uint64_t blk = sb->d_start_blk + DBLOCK_NUM(dir->ptr[i]);
+			bio_read(blk, dirents);
+			if (fsck.checksums && check_csum(blk, crc32c(dirents, BLOCK_SIZE)) == -1)
+				t->bad_csums++;
+			for (int j = 0; j < MAX_DIRENTS_PER_DIRECT_PTR; j++)
+			{
+				struct dirent *de = &dirents[j];
+				if (de->valid != VALID_DIRENT)
+					continue;
+				if (de->ino >= sb->nr_inodes || !fsck_test(fsck.ino_valid, de->ino))
+				{
+					struct fsck_slot slot = { dir->ino, de->ino, i, j };
+					fsck_push(&t->dangling, &slot, sizeof(slot));
+					continue;
+				}
+				if (fsck_dot(de))
+					continue;
+				// only this thread has the dir, but the inode can be named from anywhere
+				fsck.entries[dir->ino]++;
+				__atomic_fetch_add(&fsck.refs[de->ino], 1, __ATOMIC_RELAXED);
+			}
+		}
+	}
+	free(dirents);
+	return NULL;
+}
+
+static void fsck_run(void *(*scan)(void *), struct fsck_thread *threads, int nthreads)
+{
+	fsck.next = 0;
+	for (int k = 0; k < nthreads; k++)
+		pthread_create(&threads[k].thread, NULL, scan, &threads[k]);
+	for (int k = 0; k < nthreads; k++)
+		pthread_join(threads[k].thread, NULL);
+}
+
+/*
+ * Link count the tree says inode ino should have. a dir has 2 and one more for every entry
+ * dir_add() put in it, a file one per name
+ */
+static uint32_t fsck_want_link(uint16_t ino)
+{
+	return fsck_test(fsck.ino_dir, ino) ? 2 + fsck.entries[ino] : fsck.refs[ino];
+}
+
+static int fsck_orphan(uint16_t ino)
+{
+	return ino != 0 && fsck_test(fsck.ino_valid, ino) && fsck.refs[ino] == 0;
+}
+
+/*
+ * Compare a bitmap with the bits the scan wants, and make it match on repair. every bitmap
+ * block is written once. data blocks that are freed lose their fingerprint, dedup must not find them
+ */
+static void fsck_bitmap(struct disk_bitmap *bm, uint64_t *want, int kind, const char *what, int repair)
+{
+	uint64_t *have = (uint64_t *)bm->bits;
+	uint8_t *dirty = calloc(bm->len, 1);
+	for (uint32_t w = 0; w < (bm->nbits + 63) / 64; w++)
+	{
+		uint64_t mask = (w == bm->nbits / 64) ? (1ULL << (bm->nbits % 64)) - 1 : ~0ULL;
+		uint64_t diff = (have[w] ^ want[w]) & mask;
+		if (diff == 0)
+			continue;
+		for (uint64_t left = diff; left != 0; left &= left - 1)
+		{
+			uint32_t i = w * 64 + __builtin_ctzll(left);
+			if (fsck_test(want, i))
+				fsck_problem(kind, "%s %u is in use but free in the bitmap", what, i);
+			else
+				fsck_problem(kind, "%s %u is marked used but nothing has it", what, i);
+			if (repair && bm == &dblock_bm && !fsck_test(want, i))
+				forget_fprint(i);
+		}
+		if (repair)
+		{
+			have[w] ^= diff;
+			dirty[w * 64 / BM_BLOCK_BITS] = 1;
+			fsck.fixed[kind] += __builtin_popcountll(diff);
+		}
+	}
+	for (uint32_t b = 0; b < bm->len; b++)
+	{
+		if (dirty[b])
+		{
+			bm_count_free(bm, b);
+			bm_write(bm, b);
+		}
+	}
+	free(dirty);
+}
+
+/*
+ * Refcount of every data block against the owners the scan counted. dups is sorted
+ */
+static void fsck_refcounts(uint32_t *dups, size_t ndups, int repair)
+{
+	if (ref_region.data == NULL)
+	{
+		for (size_t d = 0; d < ndups; d++)
+			fsck_problem(FSCK_SHARED, "dblock %u has more than one owner", dups[d]);
+		return;
+	}
+	size_t d = 0;
+	for (uint32_t b = 0; b < sb->nr_dblocks; b++)
+	{
+		uint32_t want = 0;
+		for (; d < ndups && dups[d] == b; d++)
+			want++;
+		if (want > REFCOUNT_MAX)
+			want = REFCOUNT_MAX;
+		uint16_t *ref = ref_of(b);
+		if (*ref == want)
+			continue;
+		fsck_problem(FSCK_REFCOUNT, "dblock %u has %u owners beyond the first, refcount says %u", b, want, *ref);
+		if (repair)
+		{
+			*ref = want;
+			region_dirty(&ref_region, b, sizeof(uint16_t));
+			fsck.fixed[FSCK_REFCOUNT]++;
+		}
+	}
+	if (repair)
+		region_flush(&ref_region);
+}
+
+/*
+ * Give an inode no dir names a name in LOST_FOUND, "#ino" like e2fsck does. returns 0 on sucess
+ */
+static int fsck_reconnect(uint16_t ino)
+{
+	struct inode lf, inode;
+	if (get_node_by_path(LOST_FOUND, 0, &lf) == -1)
+	{
+		if (rufs_mkdir(LOST_FOUND, 0755) != 0 || get_node_by_path(LOST_FOUND, 0, &lf) == -1)
+			return -1;
+	}
+	char name[16];
+	snprintf(name, sizeof(name), "#%u", ino);
+	if (!S_ISDIR(lf.type) || dir_add(lf, ino, name, strlen(name)) == -1)
+		return -1;
+
+	readi(ino, &inode);
+	inode.link = fsck_want_link(ino);
+	if (S_ISDIR(inode.type))
+	{
+		// its .. goes to the new parent
+		struct dirent *dirents = blkbuf_get();
+		if (inode.direct_ptr[0] != INVALID_DBLOCK && meta_read(sb->d_start_blk + DBLOCK_NUM(inode.direct_ptr[0]), dirents) == 0)
+		{
+			for (int j = 0; j < MAX_DIRENTS_PER_DIRECT_PTR; j++)
+			{
+				if (dirents[j].valid == VALID_DIRENT && dirents[j].len == 2 && fsck_dot(&dirents[j]))
+				{
+					dirents[j].ino = lf.ino;
+					meta_write(sb->d_start_blk + DBLOCK_NUM(inode.direct_ptr[0]), dirents);
+					break;
+				}
+			}
+		}
+		blkbuf_put(dirents);
+	}
+	else
+		inode.link = 1;
+	writei(ino, &inode);
+	return 0;
+}
+
+/*
+ * Check the image at diskfile with nthreads threads, and with repair fix what it can.
+ * returns 0 if it is clean, 1 if every problem was fixed, 2 if some are left, -1 if it could not be checked
+ */
+int rufs_fsck(const char *diskfile, int repair, int nthreads)
+{
+	// Step 1: open the image like a mount would, but write nothing unless repairing
+	snprintf(diskfile_path, PATH_MAX, "%s", diskfile);
+	if (dev_open(diskfile_path) < 0)
+		return -1;
+	sb = malloc(BLOCK_SIZE);
+	bio_read(0, sb);
+	if (sb->magic_num != MAGIC_NUM || sb->version != SB_VERSION)
+	{
+		my_print_always("FSCK: %s is not a rufs image, or needs ./rufs_migrate first", diskfile_path);
+		free(sb);
+		dev_close();
+		return -1;
+	}
+	fill_geometry();
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > FSCK_MAX_THREADS)
+		nthreads = FSCK_MAX_THREADS;
+	memset(&fsck, 0, sizeof(fsck));
+	icache_drop();
+	free(dir_blooms);
+	dir_blooms = NULL;
+	uint64_t start = stat_clock();
+
+	// checksums of an image that was not unmounted cleanly can be behind, a repair takes the
+	// blocks as they are first like a mount does, a check leaves them alone
+	int unclean = sb->state & SB_MOUNTED;
+	if (unclean)
+		my_print_always("FSCK: %s was not unmounted cleanly", diskfile_path);
+	if ((sb->features & FEATURE_CSUM) && (!unclean || repair))
+	{
+		region_open(&csum_region, sb->c_start_blk, CSUM_BLOCKS(sb->max_blocks), 1, 0);
+		if (unclean)
+			reseed_csums();
+		// the threads look checksums up, so none can be left to load lazily
+		for (uint64_t blk = 0; blk < CSUM_BLOCKS(sb->nr_blocks); blk++)
+			region_at(&csum_region, blk * BLOCK_SIZE, 1);
+		fsck.checksums = 1;
+	}
+	if (bm_open(&inode_bm, sb->i_bitmap_blk, sb->i_bitmap_len, sb->nr_inodes, 0) == -1)
+		fsck.found[FSCK_CSUM]++;
+	if (bm_open(&dblock_bm, sb->d_bitmap_blk, sb->d_bitmap_len, sb->nr_dblocks, 0) == -1)
+		fsck.found[FSCK_CSUM]++;
+	if (sb->features & FEATURE_REFCOUNT)
+		region_open(&ref_region, sb->r_start_blk, REFCOUNT_BLOCKS(max_dblocks()), 0, 0);
+	if (sb->features & FEATURE_FPRINT)
+		region_open(&fp_region, sb->f_start_blk, FPRINT_BLOCKS(max_dblocks()), 0, 0);
+
+	uint32_t ino_words = (sb->nr_inodes + 63) / 64;
+	uint32_t blk_words = (sb->nr_dblocks + 63) / 64;
+	fsck.ino_valid = calloc(ino_words, sizeof(uint64_t));
+	fsck.ino_dir = calloc(ino_words, sizeof(uint64_t));
+	fsck.blk_owned = calloc(blk_words, sizeof(uint64_t));
+	fsck.links = calloc(sb->nr_inodes, sizeof(uint32_t));
+	fsck.refs = calloc(sb->nr_inodes, sizeof(uint32_t));
+	fsck.entries = calloc(sb->nr_inodes, sizeof(uint16_t));
+	struct fsck_thread *threads = calloc(nthreads, sizeof(struct fsck_thread));
+
+	// Step 2: the inode table. which inodes are valid, and who owns each data block
+	fsck_run(fsck_scan_inodes, threads, nthreads);
+	for (int k = 0; k < nthreads; k++)
+		fsck.ndirs += threads[k].dirs.len;
+	fsck.dirs = malloc((fsck.ndirs + 1) * sizeof(struct fsck_dir));
+	size_t ndups = 0;
+	for (int k = 0, d = 0; k < nthreads; k++)
+	{
+		memcpy(&fsck.dirs[d], threads[k].dirs.data, threads[k].dirs.len * sizeof(struct fsck_dir));
+		d += threads[k].dirs.len;
+		ndups += threads[k].dups.len;
+	}
+
+	// Step 3: the dirs. who names each inode, and which names are of free inodes
+	fsck_run(fsck_scan_dirs, threads, nthreads);
+	my_print_always("FSCK: scanned %u inodes and %u dirs in %.1f ms with %d threads", sb->nr_inodes, fsck.ndirs,
+		(stat_clock() - start) / 1e6, nthreads);
+
+	// Step 4: cross check, and repair in an order where each fix can trust the ones before it.
+	// the orphans are last, they may need LOST_FOUND made, and that allocates
+	int ret = 0;
+	if (!fsck_test(fsck.ino_dir, 0))
+	{
+		my_print_always("FSCK: inode 0 is not a directory, the image has no root");
+		ret = 2;
+		goto out;
+	}
+	for (int k = 0; k < nthreads; k++)
+		fsck.found[FSCK_CSUM] += threads[k].bad_csums;
+
+
+	for (int k = 0; k < nthreads; k++)
+	{
+		struct fsck_ptr *bad = threads[k].bad_ptrs.data;
+		for (size_t n = 0; n < threads[k].bad_ptrs.len; n++)
+		{
+			fsck_problem(FSCK_PTR, "inode %u block %u points at dblock %u", bad[n].ino, bad[n].i, DBLOCK_NUM(bad[n].ptr));
+			if (!repair)
+				continue;
+			// a hole reads back as zeros
+			struct inode inode;
+			readi(bad[n].ino, &inode);
+			inode.direct_ptr[bad[n].i] = INVALID_DBLOCK;
+			writei(bad[n].ino, &inode);
+			fsck.fixed[FSCK_PTR]++;
+		}
+	}
+
+	struct dirent *dirents = malloc(BLOCK_SIZE);
+	for (int k = 0; k < nthreads; k++)
+	{
+		struct fsck_slot *slot = threads[k].dangling.data;
+		for (size_t n = 0; n < threads[k].dangling.len; n++)
+		{
+			fsck_problem(FSCK_DANGLING, "dir %u names inode %u, which is free", slot[n].dir, slot[n].ino);
+			if (!repair)
+				continue;
+			struct inode dir;
+			readi(slot[n].dir, &dir);
+			uint64_t blk = sb->d_start_blk + DBLOCK_NUM(dir.direct_ptr[slot[n].i]);
+			meta_read(blk, dirents);
+			dirents[slot[n].j].valid = INVALID_DIRENT;
+			meta_write(blk, dirents);
+			fsck.fixed[FSCK_DANGLING]++;
+		}
+	}
+	free(dirents);
+
+	for (uint32_t ino = 0; ino < sb->nr_inodes; ino++)
+	{
+		if (!fsck_test(fsck.ino_valid, ino) || fsck_orphan(ino) || fsck.links[ino] == fsck_want_link(ino))
+			continue;
+		fsck_problem(FSCK_LINK, "inode %u has link %u, should be %u", ino, fsck.links[ino], fsck_want_link(ino));
+		if (!repair)
+			continue;
+		struct inode inode;
+		readi(ino, &inode);
+		inode.link = fsck_want_link(ino);
+		writei(ino, &inode);
+		fsck.fixed[FSCK_LINK]++;
+	}
+
+	fsck_bitmap(&inode_bm, fsck.ino_valid, FSCK_IBITMAP, "inode", repair);
+	// the inode table slices are in the data block bitmap as used
+	if (sb->features & FEATURE_BGROUPS)
+	{
+		for (uint32_t g = 0; g < sb->nr_inodes / sb->inodes_per_group; g++)
+			for (uint32_t k = 0; k < itable_blocks(); k++)
+				fsck_mark(fsck.blk_owned, g * BLOCKS_PER_GROUP + k);
+	}
+	fsck_bitmap(&dblock_bm, fsck.blk_owned, FSCK_DBITMAP, "dblock", repair);
+
+	uint32_t *dups = malloc((ndups + 1) * sizeof(uint32_t));
+	for (int k = 0, d = 0; k < nthreads; k++)
+	{
+		memcpy(&dups[d], threads[k].dups.data, threads[k].dups.len * sizeof(uint32_t));
+		d += threads[k].dups.len;
+	}
+	qsort(dups, ndups, sizeof(uint32_t), cmp_u32);
+	fsck_refcounts(dups, ndups, repair);
+	free(dups);
+
+	for (uint32_t ino = 0; ino < sb->nr_inodes; ino++)
+	{
+		if (!fsck_orphan(ino))
+			continue;
+		fsck_problem(FSCK_ORPHAN, "inode %u is in no dir", ino);
+		if (!repair)
+			continue;
+		if (fsck_reconnect(ino) == 0)
+			fsck.fixed[FSCK_ORPHAN]++;
+		else
+			my_print_always("FSCK: could not put inode %u in " LOST_FOUND, ino);
+	}
+
+	// Step 5: what was found, and write back what the repairs left in memory
+	uint32_t found = 0, fixed = 0;
+	for (int kind = 0; kind < FSCK_KINDS; kind++)
+	{
+		found += fsck.found[kind];
+		fixed += fsck.fixed[kind];
+		if (fsck.found[kind] > 0)
+			my_print_always("FSCK: %u %s, %u fixed", fsck.found[kind], fsck_kinds[kind], fsck.fixed[kind]);
+	}
+	if (found == 0)
+		my_print_always("FSCK: %s is clean", diskfile_path);
+	ret = (found == 0) ? 0 : (fixed == found) ? 1 : 2;
+	if (repair)
+	{
+		flush_fprints();
+		flush_csums();
+		clear_csum_intent();
+		sb->state &= ~SB_MOUNTED;
+		bio_write(0, sb);
+	}
+
+out:
+	for (int k = 0; k < nthreads; k++)
+	{
+		free(threads[k].dirs.data);
+		free(threads[k].dups.data);
+		free(threads[k].bad_ptrs.data);
+		free(threads[k].dangling.data);
+	}
+	free(threads);
+	free(fsck.ino_valid);
+	free(fsck.ino_dir);
+	free(fsck.blk_owned);
+	free(fsck.links);
+	free(fsck.refs);
+	free(fsck.entries);
+	free(fsck.dirs);
+	free(sb);
+	bm_close(&inode_bm);
+	bm_close(&dblock_bm);
+	region_close(&ref_region);
+	region_close(&fp_region);
+	region_close(&csum_region);
+	free(dir_blooms);
+	dir_blooms = NULL;
+	scratch_free();
+	dev_close();
+	return ret;
+}
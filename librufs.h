@@ -0,0 +1,101 @@
+/*
+ *	Tiny File System
+ *	File:	librufs.h
+ *
+ *	in-process API of the file system, no FUSE or mount needed. one image at a time.
+ *	link librufs.a (and -lm -lpthread). rufs.c is the FUSE adapter over it
+ */
+
+#ifndef _LIBRUFS_H
+#define _LIBRUFS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+#include "trace.h"
+
+/*
+ * tunables, set them before rufs_mount(). they are the ./rufs command line flags
+ */
+extern uint64_t disk_size;			/* --size, of a DISKFILE rufs_mount() makes */
+extern uint64_t max_disk_size;		/* --max-size, 0 for none */
+extern int discard_enabled;			/* off with --nodiscard */
+extern int readahead_enabled;		/* off with --noreadahead */
+extern int prefetch_enabled;		/* off with --noprefetch */
+extern int bloom_enabled;			/* off with --nobloom */
+extern int compress_all;			/* --compress */
+extern int dedup_enabled;			/* --dedup */
+extern int data_csum_enabled;		/* --data-csum */
+extern const char *trace_file;		/* --trace=FILE, rufs_unmount() writes the event trace there */
+/* a size like 4096, 64K, 512M or 200G, as the size flags take them. returns 0 if it is not one */
+uint64_t parse_size(const char *str);
+
+/* called by rufs_readdir() with each name in the dir. ctx is passed through */
+typedef int (*rufs_filler_t)(void *ctx, const char *name);
+
+/*
+ * Open the image at diskfile, or make a new one there. a packed image (pack.h) is mounted
+ * read-only. returns 0 on sucess, -1 if it has to go through ./rufs_migrate first
+ */
+int rufs_mount(const char *diskfile);
+/* write everything back, print the stats and close the image */
+void rufs_unmount();
+/* returns -1 if diskfile has an inode format rufs_migrate has to convert, else 0 */
+int rufs_check_version(const char *diskfile);
+/* punch out the free data blocks of an image that is not mounted */
+int rufs_trim(const char *diskfile);
+/*
+ * check an image that is not mounted with nthreads threads, and with repair fix it. returns 0
+ * if it is clean, 1 if every problem was fixed, 2 if some are left, -1 if it could not be checked
+ */
+int rufs_fsck(const char *diskfile, int repair, int nthreads);
+
+/*
+ * paths are absolute. files and dirs are opened to an inode number, which is what the data
+ * calls take. returns 0 (or bytes for read and write) on sucess, -1 or -errno on failure
+ */
+int rufs_getattr(const char *path, struct stat *stbuf);
+int rufs_opendir(const char *path, uint16_t *ino);
+int rufs_readdir(const char *path, rufs_filler_t filler, void *ctx);
+int rufs_mkdir(const char *path, mode_t mode);
+int rufs_rmdir(const char *path);
+int rufs_create(const char *path, mode_t mode, uint16_t *ino);
+int rufs_open(const char *path, uint16_t *ino);
+int rufs_unlink(const char *path);
+
+int rufs_read(uint16_t ino, char *buffer, size_t size, off_t offset);
+int rufs_write(uint16_t ino, const char *buffer, size_t size, off_t offset);
+int rufs_fallocate(uint16_t ino, int mode, off_t offset, off_t length);
+/* the ioctls of rufs_ioctl.h and FS_IOC_GETFLAGS/SETFLAGS, data is the argument */
+int rufs_ioctl(uint16_t ino, int cmd, void *data);
+/* write back what is held in memory, like a FUSE flush */
+int rufs_flush();
+
+/*
+ * read-only file at the mount root with the counters and latency histograms below, in the
+ * Prometheus text format. STATS_DIR is listed in the root dir but is not on disk
+ */
+#define STATS_DIR "/.rufs"
+#define STATS_FILE "/.rufs/stats"
+#define STATS_INO 0xFFFF
+
+/* one op_stat per FUSE operation (enum rufs_op of trace.h), rufs.c times them */
+extern struct op_stat op_stats[OP_COUNT];
+/* the text of STATS_FILE into buf, returns its whole length like snprintf */
+int stats_render(char *buf, size_t size);
+
+/*
+ * print helpers, do not put a new line at the end. my_print() is only compiled in with
+ * DEBUG, so the silent ones cost nothing, not even their arguments
+ */
+#ifndef DEBUG
+#define DEBUG 0
+#endif
+#define my_print(...) do { if (DEBUG) my_print_debug(__VA_ARGS__); } while (0)
+void my_print_debug(const char *format, ...);
+void my_print_always(const char *format, ...);
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ *	Tiny File System
+ *	File:	lz.c
+ *
+ *	small LZ77 codec. the stream is a list of sequences, each one
+ *	  token (4 bits literal length | 4 bits match length - 4)
+ *	  [literal length extension bytes] literals
+ *	  2 byte little endian match offset [match length extension bytes]
+ *	a length nibble of 15 is followed by bytes that are added on until one is not 255.
+ *	the last sequence only has literals
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+#define LZ_LAST_LITERALS 5		// the last bytes are always literals
+#define LZ_MFLIMIT 12			// no match may start this close to the end
+#define LZ_SKIP_TRIGGER 6		// after 2^6 misses in a row start skipping ahead
+
+static uint32_t lz_read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t lz_hash(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+ * write a length that did not fit in its nibble. returns the new out ptr, NULL if it does not fit
+ */
+static uint8_t *lz_put_len(uint8_t *op, uint8_t *out_end, int len)
+{
+	for (; len >= 255; len -= 255)
+	{
+		if (op >= out_end)
+			return NULL;
+		*op++ = 255;
+	}
+	if (op >= out_end)
+		return NULL;
+	*op++ = len;
+	return op;
+}
+
+/*
+ * emit one sequence. match_len < 0 means literals only. returns the new out ptr, NULL if it does not fit
+ */
+static uint8_t *lz_put_seq(uint8_t *op, uint8_t *out_end, const uint8_t *lit, int lit_len, int offset, int match_len)
+{
+	if (op >= out_end)
+		return NULL;
+	uint8_t *token = op++;
+	*token = (lit_len >= 15 ? 15 : lit_len) << 4;
+	if (lit_len >= 15 && (op = lz_put_len(op, out_end, lit_len - 15)) == NULL)
+		return NULL;
+	if (out_end - op < lit_len)
+		return NULL;
+	memcpy(op, lit, lit_len);
+	op += lit_len;
+	if (match_len < 0)
+		return op;
+
+	if (out_end - op < 2)
+		return NULL;
+	*op++ = offset & 0xff;
+	*op++ = offset >> 8;
+	match_len -= LZ_MIN_MATCH;
+	*token |= (match_len >= 15) ? 15 : match_len;
+	if (match_len >= 15 && (op = lz_put_len(op, out_end, match_len - 15)) == NULL)
+		return NULL;
+	return op;
+}
+
+/*
+ * Compress src into dst. gives up as soon as the output would not fit in dst_cap, so
+ * incompressible data costs one pass that skips further ahead the longer it finds nothing.
+ * returns the compressed length, -1 if it does not fit
+ */
+int lz_compress(const void *src, int src_len, void *dst, int dst_cap)
+{
+	const uint8_t *in = src;
+	const uint8_t *ip = in;
+	const uint8_t *anchor = in;
+	const uint8_t *in_end = in + src_len;
+	uint8_t *op = dst;
+	uint8_t *out_end = op + dst_cap;
+	uint32_t table[1 << LZ_HASH_BITS];
+
+	if (src_len > LZ_MFLIMIT)
+	{
+		const uint8_t *match_limit = in_end - LZ_MFLIMIT;
+		memset(table, 0, sizeof(table));
+		unsigned misses = 1 << LZ_SKIP_TRIGGER;
+		ip++;
+		while (ip < match_limit)
+		{
+			uint32_t seq = lz_read32(ip);
+			uint32_t h = lz_hash(seq);
+			const uint8_t *ref = in + table[h];
+			table[h] = ip - in;
+			if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(ref) != seq)
+			{
+				ip += misses++ >> LZ_SKIP_TRIGGER;
+				continue;
+			}
+			misses = 1 << LZ_SKIP_TRIGGER;
+
+			// grow the match both ways
+			const uint8_t *mp = ip + LZ_MIN_MATCH;
+			const uint8_t *rp = ref + LZ_MIN_MATCH;
+			while (mp < in_end - LZ_LAST_LITERALS && *mp == *rp)
+			{
+				mp++;
+				rp++;
+			}
+			while (ip > anchor && ref > in && ip[-1] == ref[-1])
+			{
+				ip--;
+				ref--;
+			}
+
+			op = lz_put_seq(op, out_end, anchor, ip - anchor, ip - ref, mp - ip);
+			if (op == NULL)
+				return -1;
+			ip = mp;
+			anchor = ip;
+		}
+	}
+
+	op = lz_put_seq(op, out_end, anchor, in_end - anchor, 0, -1);
+	if (op == NULL)
+		return -1;
+	return op - (uint8_t *)dst;
+}
+
+/*
+ * read a length extension. returns the new in ptr, NULL on a truncated stream
+ */
+static const uint8_t *lz_get_len(const uint8_t *ip, const uint8_t *in_end, size_t *len)
+{
+	unsigned b;
+	do
+	{
+		if (ip >= in_end)
+			return NULL;
+		b = *ip++;
+		*len += b;
+	} while (b == 255);
+	return ip;
+}
+
+/*
+ * Decompress src into dst. every length and offset is checked, so a corrupt block can not
+ * write outside dst. returns the decompressed length, -1 on a corrupt stream
+ */
+int lz_decompress(const void *src, int src_len, void *dst, int dst_cap)
+{
+	const uint8_t *ip = src;
+	const uint8_t *in_end = ip + src_len;
+	uint8_t *out = dst;
+	uint8_t *op = out;
+	uint8_t *out_end = out + dst_cap;
+
+	while (ip < in_end)
+	{
+		unsigned token = *ip++;
+		size_t lit_len = token >> 4;
+		if (lit_len == 15 && (ip = lz_get_len(ip, in_end, &lit_len)) == NULL)
+			return -1;
+		if (lit_len > (size_t)(in_end - ip) || lit_len > (size_t)(out_end - op))
+			return -1;
+		memcpy(op, ip, lit_len);
+		op += lit_len;
+		ip += lit_len;
+		if (ip == in_end)
+			break;
+
+		if (in_end - ip < 2)
+			return -1;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - out))
+			return -1;
+		size_t match_len = token & 15;
+		if (match_len == 15 && (ip = lz_get_len(ip, in_end, &match_len)) == NULL)
+			return -1;
+		match_len += LZ_MIN_MATCH;
+		if (match_len > (size_t)(out_end - op))
+			return -1;
+
+		const uint8_t *match = op - offset;
+		if (offset >= match_len)
+		{
+			memcpy(op, match, match_len);
+			op += match_len;
+		}
+		else
+		{
+			// overlapping copy repeats the last offset bytes
+			while (match_len--)
+				*op++ = *match++;
+		}
+	}
+	return op - out;
+}
@@ -0,0 +1,14 @@
+/*
+ *	Tiny File System
+ *	File:	lz.h
+ *
+ *	small LZ77 codec (LZ4 style sequences) used for compressed clusters
+ */
+
+#ifndef _LZ_H
+#define _LZ_H
+
+int lz_compress(const void *src, int src_len, void *dst, int dst_cap);
+int lz_decompress(const void *src, int src_len, void *dst, int dst_cap);
+
+#endif
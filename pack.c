@@ -0,0 +1,202 @@
+/*
+ *	Tiny File System
+ *	File:	pack.c
+ *
+ *	the read side of pack.h. mounting is an open and an mmap, and every lookup, stat and read
+ *	after it works on the mapping, so what they cost is page faults into it. nothing changes
+ *	after the mount, so none of it takes a lock
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "pack.h"
+
+static struct pack_header *pack = NULL;
+static struct pack_inode *pack_inodes;
+static const char *pack_names;
+static const char *pack_data;
+
+/*
+ * Make sure nothing in the file points outside it, so lookups and reads can trust every offset
+ * after the mount: the regions have to follow each other inside the file, and each inode's
+ * name, data and dir run have to be inside theirs. one pass over the inodes, about 0.1ms for
+ * the largest pack. returns 0 if it is sound, -1 if not
+ */
+static int pack_check(const struct pack_header *hdr)
+{
+	if (hdr->ninodes == 0 || hdr->ninodes > PACK_MAX_INODES
+		|| hdr->names_off != sizeof(*hdr) + (uint64_t)hdr->ninodes * sizeof(struct pack_inode)
+		|| hdr->data_off < hdr->names_off || hdr->data_off > hdr->size)
+		return -1;
+	const struct pack_inode *inodes = (const struct pack_inode *)(hdr + 1);
+	const char *names = (const char *)hdr + hdr->names_off;
+	uint64_t names_len = hdr->data_off - hdr->names_off;
+	uint64_t data_len = hdr->size - hdr->data_off;
+	if (!S_ISDIR(inodes[0].mode))
+		return -1;
+	for (uint32_t k = 0; k < hdr->ninodes; k++)
+	{
+		const struct pack_inode *in = &inodes[k];
+		// names are read as C strings too (readdir), so the '\0' after one has to be there
+		if (in->name_off >= names_len || in->name_len > names_len - in->name_off - 1 || names[in->name_off + in->name_len] != '\0')
+			return -1;
+		if (in->parent >= hdr->ninodes || !S_ISDIR(inodes[in->parent].mode))
+			return -1;
+		uint64_t room = S_ISDIR(in->mode) ? hdr->ninodes : data_len;
+		if (in->off > room || in->size > room - in->off)
+			return -1;
+	}
+	return 0;
+}
+
+int pack_open(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	struct stat st;
+	char magic[8];
+	if (fstat(fd, &st) < 0 || pread(fd, magic, sizeof(magic), 0) != sizeof(magic) || memcmp(magic, PACK_MAGIC, sizeof(magic)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		perror(path);
+		return -2;
+	}
+	struct pack_header *hdr = map;
+	if (st.st_size < sizeof(*hdr) || hdr->inode_size != sizeof(struct pack_inode) || hdr->size != st.st_size)
+	{
+		fprintf(stderr, "%s: packed image from another version, or cut short\n", path);
+		munmap(map, st.st_size);
+		return -2;
+	}
+	if (pack_check(hdr) == -1)
+	{
+		fprintf(stderr, "%s: packed image is corrupt\n", path);
+		munmap(map, st.st_size);
+		return -2;
+	}
+	pack = hdr;
+	pack_inodes = (struct pack_inode *)(hdr + 1);
+	pack_names = (const char *)map + hdr->names_off;
+	pack_data = (const char *)map + hdr->data_off;
+	return 0;
+}
+
+void pack_close()
+{
+	if (pack == NULL)
+		return;
+	munmap(pack, pack->size);
+	pack = NULL;
+}
+
+int pack_mounted()
+{
+	return pack != NULL;
+}
+
+int pack_is_dir(int ino)
+{
+	return S_ISDIR(pack_inodes[ino].mode);
+}
+
+/*
+ * Entry name (len bytes) of dir ino, a binary search over its run of inodes
+ */
+static int pack_find(int ino, const char *name, size_t len)
+{
+	struct pack_inode *dir = &pack_inodes[ino];
+	uint64_t lo = dir->off, hi = dir->off + dir->size;
+	while (lo < hi)
+	{
+		uint64_t mid = lo + (hi - lo) / 2;
+		struct pack_inode *in = &pack_inodes[mid];
+		int c = pack_namecmp(name, len, pack_names + in->name_off, in->name_len);
+		if (c == 0)
+			return mid;
+		if (c < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return -ENOENT;
+}
+
+int pack_lookup(const char *path)
+{
+	int ino = 0;
+	while (*path != '\0')
+	{
+		// Step 1: the next component, without copying it
+		while (*path == '/')
+			path++;
+		size_t len = strcspn(path, "/");
+		if (len == 0)
+			break;
+		// Step 2: . stays, .. goes up a dir. the root is its own parent
+		if (!pack_is_dir(ino))
+			return -ENOTDIR;
+		if (len == 1 && path[0] == '.')
+			;
+		else if (len == 2 && path[0] == '.' && path[1] == '.')
+			ino = pack_inodes[ino].parent;
+		else if ((ino = pack_find(ino, path, len)) < 0)
+			return ino;
+		path += len;
+	}
+	return ino;
+}
+
+void pack_stat(int ino, struct stat *stbuf)
+{
+	struct pack_inode *in = &pack_inodes[ino];
+	memset(stbuf, 0, sizeof(*stbuf));
+	stbuf->st_ino = ino;
+	stbuf->st_mode = in->mode;
+	stbuf->st_nlink = in->nlink;
+	stbuf->st_uid = in->uid;
+	stbuf->st_gid = in->gid;
+	stbuf->st_size = S_ISDIR(in->mode) ? in->size * sizeof(struct pack_inode) : in->size;
+	stbuf->st_blocks = (stbuf->st_size + 511) / 512;
+	stbuf->st_mtim.tv_sec = in->mtime_ns / 1000000000;
+	stbuf->st_mtim.tv_nsec = in->mtime_ns % 1000000000;
+	stbuf->st_ctim = stbuf->st_mtim;
+}
+
+int pack_readdir(int ino, int (*filler)(void *ctx, const char *name), void *ctx)
+{
+	struct pack_inode *dir = &pack_inodes[ino];
+	filler(ctx, ".");
+	filler(ctx, "..");
+	for (uint64_t k = dir->off; k < dir->off + dir->size; k++)
+	{
+		if (filler(ctx, pack_names + pack_inodes[k].name_off) != 0)
+			break;
+	}
+	return 0;
+}
+
+int pack_read(int ino, char *buffer, size_t size, off_t offset)
+{
+	struct pack_inode *in = &pack_inodes[ino];
+	if (S_ISDIR(in->mode))
+		return -EISDIR;
+	if (offset >= in->size)
+		return 0;
+	if (offset + size > in->size)
+		size = in->size - offset;
+	memcpy(buffer, pack_data + in->off + offset, size);
+	return size;
+}
@@ -0,0 +1,71 @@
+/*
+ *	Tiny File System
+ *	File:	pack.h
+ *
+ *	read-only packed images, made by ./rufs_pack from a host dir. rufs mounts one in place of
+ *	a DISKFILE by mapping the whole file, there are no bitmaps and nothing in it is ever written
+ */
+
+#ifndef _PACK_H
+#define _PACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define PACK_MAGIC "RUFSPAK1"
+/* inode numbers are uint16_t like the fs's own, and STATS_INO and the one below it are taken */
+#define PACK_MAX_INODES 65504
+/* file data starts page aligned, so it can be mapped on its own */
+#define PACK_ALIGN 4096
+
+/*
+ * the file is the header, the inode table, the name table and then the file data.
+ * inodes are numbered breadth first from the root (0), so the entries of a dir are one run
+ * of inodes, sorted by name (pack_namecmp()) for a binary search. each file is one run of bytes
+ */
+struct pack_header {
+	char magic[8];
+	uint32_t inode_size;	// sizeof(struct pack_inode)
+	uint32_t ninodes;
+	uint64_t names_off;
+	uint64_t data_off;
+	uint64_t size;			// of the whole file
+};
+
+struct pack_inode {
+	uint64_t off;			// files: of their data, from data_off. dirs: inode number of their first entry
+	uint64_t size;			// files: bytes. dirs: entries
+	int64_t mtime_ns;
+	uint32_t mode;			// write bits cleared
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t nlink;			// dirs: 2 and one per subdir
+	uint32_t name_off;		// from names_off. a '\0' follows, name_len does not count it
+	uint16_t name_len;
+	uint16_t parent;		// inode number of its dir, 0 for the root
+};
+
+/* order of the names in a dir, bytes first and then length */
+static inline int pack_namecmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+	int c = memcmp(a, b, alen < blen ? alen : blen);
+	return c != 0 ? c : (alen > blen) - (alen < blen);
+}
+
+/* map path if it is a packed image. returns 0 if it is, -1 if it is not, -2 if it is one that is cut short or corrupt */
+int pack_open(const char *path);
+void pack_close();
+/* 1 while a packed image is mapped */
+int pack_mounted();
+/* inode number of an absolute path, -ENOENT or -ENOTDIR if it has none */
+int pack_lookup(const char *path);
+int pack_is_dir(int ino);
+void pack_stat(int ino, struct stat *stbuf);
+/* each entry of dir ino (after . and ..) to filler, like rufs_readdir() */
+int pack_readdir(int ino, int (*filler)(void *ctx, const char *name), void *ctx);
+int pack_read(int ino, char *buffer, size_t size, off_t offset);
+
+#endif
@@ -3,6 +3,7 @@
  *	Tiny File System
  *	File:	rufs.c
  *
+ *	FUSE adapter. every operation is passed on to librufs, see librufs.h
  */
 
 #define FUSE_USE_VERSION 26
@@ -10,995 +11,228 @@
 #include <fuse.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <sys/stat.h>
 #include <errno.h>
-#include <sys/time.h>
-#include <libgen.h>
 #include <limits.h>
 
 #include "block.h"
-#include "rufs.h"
+#include "librufs.h"
+#include "capture.h"
+#include "pack.h"
 
-#define DEBUG 0
-#define ANSI_COLOR_RED "\x1b[31m"
-#define ANSI_COLOR_GREEN "\x1b[32m"
-#define ANSI_COLOR_YELLOW "\x1b[33m"
-#define ANSI_COLOR_BLUE "\x1b[34m"
-#define ANSI_COLOR_MAGENTA "\x1b[35m"
-#define ANSI_COLOR_CYAN "\x1b[36m"
-#define ANSI_COLOR_RESET "\x1b[0m"
+// DISKFILE in the directory rufs was started from, or --image=FILE
+static char image_path[PATH_MAX];
 
-char diskfile_path[PATH_MAX];
+// --trace=FILE and --capture=FILE, made absolute since fuse_main() leaves the cwd
+static char trace_path[PATH_MAX];
+static char capture_path[PATH_MAX];
 
-/**
- * Do not put new line char at end
- */
-void my_print(const char *format, ...)
-{
-	if (DEBUG)
-	{
-		va_list args;
-		printf(ANSI_COLOR_RED);
-		va_start(args, format);
-		vprintf(format, args);
-		va_end(args);
-		printf(ANSI_COLOR_RESET "\n");
-	}
-}
-/**
- * Do not put new line char at end
- */
-void my_print_mag(const char *format, ...)
-{
-	if (DEBUG)
-	{
-		va_list args;
-		printf(ANSI_COLOR_MAGENTA);
-		va_start(args, format);
-		vprintf(format, args);
-		va_end(args);
-		printf(ANSI_COLOR_RESET "\n");
-	}
-}
-/**
- * Always print, no matter DEBUG
- */
-void my_print_always(const char *format, ...)
-{
-	va_list args;
-	printf(ANSI_COLOR_MAGENTA);
-	va_start(args, format);
-	vprintf(format, args);
-	va_end(args);
-	printf(ANSI_COLOR_RESET "\n");
-}
+// --capture: every operation goes to capture_out, see capture.h
+static FILE *capture_out = NULL;
+static uint64_t capture_t0;
+static int capture_threads = 0;
+static __thread int capture_tid = -1;
 
-// Declare your in-memory data structures here
-struct superblock *sb = NULL;
-// bitmap for indoes
-bitmap_t inode_bm = NULL;
-// bitmap for datablocks not diskblocks
-bitmap_t dblock_bm = NULL;
-/*
- * Get available inode number from bitmap
- */
-int get_avail_ino()
+static void capture_op(int op, const char *path, uint64_t offset, uint32_t size, uint32_t arg, uint64_t t0, uint64_t t1, int ret)
 {
-	// Step 1: Read inode bitmap from disk
-	bio_read(sb->i_bitmap_blk, inode_bm);
-	// Step 2: Traverse inode bitmap to find an available slot
-	int i;
-	for (i = 0; i < sb->max_inum; i++)
-	{
-		if (get_bitmap(inode_bm, i) == 0)
-			break;
-	}
-	// Step 3: Update inode bitmap and write to disk
-	set_bitmap(inode_bm, i);
-	bio_write(sb->i_bitmap_blk, inode_bm);
-	return i;
+	char buf[sizeof(struct capture_rec) + PATH_MAX];
+	struct capture_rec *rec = (struct capture_rec *)buf;
+	size_t len = strnlen(path, PATH_MAX);
+	if (capture_tid == -1)
+		capture_tid = __atomic_fetch_add(&capture_threads, 1, __ATOMIC_RELAXED);
+	memset(rec, 0, sizeof(*rec));
+	rec->ts_ns = t0 - capture_t0;
+	rec->offset = offset;
+	rec->dur_ns = (t1 - t0 > UINT32_MAX) ? UINT32_MAX : t1 - t0;
+	rec->size = size;
+	rec->arg = arg;
+	rec->ret = ret;
+	rec->path_len = len;
+	rec->op = op;
+	rec->tid = capture_tid;
+	memcpy(buf + sizeof(*rec), path, len);
+	// one fwrite per record, stdio locks the FILE so records of two threads never mix
+	fwrite(buf, sizeof(*rec) + len, 1, capture_out);
 }
 
 /*
- * Get available data block number from bitmap
+ * runs call and records how long it took in op_stats[op] (and the bytes of a read or write),
+ * in the trace and in the capture. ino, offset, size and arg are 0 where the op has none
  */
-int get_avail_blkno()
+#define TIMED(op, path, ino, offset, size, arg, call) ({ \
+	uint64_t t0 = stat_clock(); \
+	int ret = (call); \
+	uint64_t t1 = stat_clock(); \
+	op_stat_record(&op_stats[op], t1 - t0, ((op) == OP_READ || (op) == OP_WRITE) && ret > 0 ? ret : 0, ret < 0); \
+	TRACE_OP(op, ino, offset, size, t0, t1, ret); \
+	if (capture_out != NULL) \
+		capture_op(op, path, offset, size, arg, t0, t1, ret); \
+	ret; \
+})
+
+// arg as an absolute path into out
+static void abs_path(const char *arg, char *out)
 {
-
-	// Step 1: Read data block bitmap from disk
-	bio_read(sb->d_bitmap_blk, dblock_bm);
-	// Step 2: Traverse data block bitmap to find an available slot
-	int i;
-	for (i = 0; i < sb->max_dnum; i++)
+	if (arg[0] == '/')
 	{
-		if (get_bitmap(dblock_bm, i) == 0)
-			break;
+		snprintf(out, PATH_MAX, "%s", arg);
+		return;
 	}
-	// Step 3: Update data block bitmap and write to disk
-	//my_print_always("setting bitmap at i:%d", i);
-	set_bitmap(dblock_bm, i);
-	bio_write(sb->d_bitmap_blk, dblock_bm);
-	return i;
+	getcwd(out, PATH_MAX);
+	snprintf(out + strlen(out), PATH_MAX - strlen(out), "/%s", arg);
 }
 
-/*
- * inode operations
- * unit16_t ino = [0 to MAX_INUM) = [0 to 1024)
- * 256
- */
-
-int readi(uint16_t ino, struct inode *inode)
-{
-	// Step 1: Get the inode's on-disk block number = inodestart + ino/number of inodes per block
-	uint16_t block_num = sb->i_start_blk + (ino / (BLOCK_SIZE / sizeof(struct inode)));
-
-	// Step 2: Get offset of the inode in the inode on-disk block
-	uint16_t offset = (ino % (BLOCK_SIZE / sizeof(struct inode)) * sizeof(struct inode));
-
-	// Step 3: Read the block from disk and then copy into inode structure
-	void *block = malloc(BLOCK_SIZE);
-	bio_read(block_num, block);
-	memcpy(inode, block + offset, sizeof(struct inode));
-	free(block);
-	return 0;
-}
-
-int writei(uint16_t ino, struct inode *inode)
-{
-	// Step 1: Get the block number where this inode resides on disk
-	uint16_t block_num = sb->i_start_blk + (ino / (BLOCK_SIZE / sizeof(struct inode)));
-
-	// Step 2: Get the offset in the block where this inode resides on disk
-	uint16_t offset = (ino % (BLOCK_SIZE / sizeof(struct inode)) * sizeof(struct inode));
-
-	// Step 3: Write inode to disk
-	void *block = malloc(BLOCK_SIZE);
-	bio_read(block_num, block);
-	memcpy(block + offset, inode, sizeof(struct inode));
-	bio_write(block_num, block);
-	free(block);
-
-	return 0;
-}
-
-/*
- * returns 0 on sucess, -1 on failure
- */
-int dir_find(uint16_t ino, const char *fname, size_t name_len, struct dirent *final_dirent)
+static void *rufs_fuse_init(struct fuse_conn_info *conn)
 {
-	// Step 1: Call readi() to get the inode using ino (inode number of current directory)
-	struct inode *curr_dir_inode = malloc(sizeof(struct inode));
-	struct dirent *dirents = malloc(BLOCK_SIZE);
-	readi(ino, curr_dir_inode);
-
-	if (S_ISREG(curr_dir_inode->type))
-		return -1;
-
-	// Step 2: Get data block of current directory from inode
-	for (int i = 0; i < MAX_DIRECT_PTRS; i++)
+	// main() tried the image already, but never serve requests with nothing mounted
+	if (rufs_mount(image_path) == -1)
 	{
-		if (curr_dir_inode->direct_ptr[i] == INVALID_DBLOCK)
-		{
-			break;
-		}
-		bio_read(sb->d_start_blk + curr_dir_inode->direct_ptr[i], dirents);
-		for (int j = 0; j < MAX_DIRENTS_PER_DIRECT_PTR; j++)
-		{
-			if (dirents[j].valid == INVALID_DIRENT)
-			{
-				continue;
-			}
-			if (strcmp(dirents[j].name, fname) == 0)
-			{
-				// match found
-				if (final_dirent != NULL)
-					memcpy(final_dirent, &dirents[j], sizeof(struct dirent));
-				free(curr_dir_inode);
-				free(dirents);
-				return 0;
-			}
-		}
+		my_print_always("could not mount %s", image_path);
+		exit(EXIT_FAILURE);
 	}
-	// Step 3: Read directory's data block and check each directory entry.
-	// If the name matches, then copy directory entry to dirent structure
-	free(curr_dir_inode);
-	free(dirents);
-	return -1;
-}
-/*
- * returns 0 on sucess, -1 on failure
- */
-int dir_add(struct inode dir_inode, uint16_t f_ino, const char *fname, size_t name_len)
-{
-	my_print_mag("In Dir Add");
-	// Step 1: Read dir_inode's data block and check each directory entry of dir_inode
-	struct dirent *dirents = malloc(BLOCK_SIZE);
-	// if (S_ISREG(dir_inode.type))
-	// 	return -1;
-
-	// Step 2: Check if fname (directory name) is already used in other entries
-	if (dir_find(dir_inode.ino, fname, name_len, NULL) == 0)
+	if (capture_path[0] != '\0')
 	{
-		my_print("Dir add error. same name already exists");
-		return -1;
-	}
-
-	// Step 3: Add directory entry in dir_inode's data block and write to disk
-	int i;
-	for (i = 0; i < MAX_DIRECT_PTRS; i++)
-	{
-		if (dir_inode.direct_ptr[i] == INVALID_DBLOCK)
-		{
-			my_print_mag("Going to add new Dirent Block at i:|%d|", i);
-			break;
-		}
-		bio_read(sb->d_start_blk + dir_inode.direct_ptr[i], dirents);
-		for (int j = 0; j < MAX_DIRENTS_PER_DIRECT_PTR; j++)
-		{
-			if (dirents[j].valid == INVALID_DIRENT)
-			{
-				dirents[j].valid = VALID_DIRENT;
-				dirents[j].ino = f_ino;
-				strcpy(dirents[j].name, fname);
-				dirents[j].len = name_len;
-
-				dir_inode.link += 1;
-				time(&dir_inode.vstat.st_mtime);
-
-				writei(dir_inode.ino, &dir_inode);
-				bio_write(sb->d_start_blk + dir_inode.direct_ptr[i], dirents);
-				free(dirents);
-				my_print_mag("New Dirent Added |%s| at i:|%d| index:j|%d|", fname, i , j);
-				return 0;
-			}
-		}
-	}
-	if (i == MAX_DIRECT_PTRS){
-		my_print("Dir add error. max amount of dirents reached");
-		my_print_mag("Exiting Dir Add");
-		return -1;
+		capture_out = fopen(capture_path, "wb");
+		if (capture_out == NULL)
+			perror(capture_path);
+		else
+			fwrite(CAPTURE_MAGIC, 8, 1, capture_out);
+		capture_t0 = stat_clock();
 	}
-		
-	my_print_mag("New Dirent Block Adding at I: |%d|", i);
-	// Allocate a new data block for this directory if it does not exist
-	int new_block = get_avail_blkno();
-	struct dirent *new_dirents = calloc(1, BLOCK_SIZE);
-
-	// Update directory inode
-	dir_inode.direct_ptr[i] = new_block;
-	dir_inode.size += BLOCK_SIZE;
-	dir_inode.link += 1;
-	time(&dir_inode.vstat.st_mtime);
-	writei(dir_inode.ino, &dir_inode);
-
-	// Write directory entry
-	new_dirents->valid = VALID_DIRENT;
-	new_dirents->ino = f_ino;
-	strcpy(new_dirents->name, fname);
-	new_dirents->len = name_len;
-	bio_write(sb->d_start_blk + dir_inode.direct_ptr[i], new_dirents);
-	
-
-	free(new_dirents);
-	free(dirents);
-
-	return 0;
-}
-
-// Required for 518
-int dir_remove(struct inode dir_inode, const char *fname, size_t name_len)
-{
-
-	// Step 1: Read dir_inode's data block and checks each directory entry of dir_inode
-
-	// Step 2: Check if fname exist
-
-	// Step 3: If exist, then remove it from dir_inode's data block and write to disk
-
-	return 0;
+	return NULL;
 }
 
-/*
- * absulute pathnames only. return 0 on sucess, -1 on failure.
- */
-int get_node_by_path(const char *const_path, uint16_t ino, struct inode *final_inode)
+static void rufs_fuse_destroy(void *userdata)
 {
-	my_print("get_node_by_path on |%s|", const_path);
-	if(strcmp("/", const_path) == 0){
-		readi(0, final_inode);
-		return 0;
-	}
-		
-	// Step 1: Resolve the path name, walk through path, and finally, find its inode.
-	// Note: You could either implement it in a iterative way or recursive way
-	if (const_path[0] == '/')
-		const_path += 1;
-	char *second_part = strchr(const_path, '/');
-
-	int len_child;
-
-	if (second_part == NULL)
-	{
-		// end of path
-		len_child = strlen(const_path);
-	}
-	else
-	{
-		len_child = second_part - const_path;
-	}
-	char *child = malloc(len_child + 1);
-	strncpy(child, const_path, len_child);
-	child[len_child] = '\0';
-
-	my_print("Child of len %d is |%s|", len_child, child);
-
-	struct dirent *child_dirent = malloc(sizeof(struct dirent));
-	int found = dir_find(ino, child, len_child, child_dirent);
-	free(child);
-
-	if (second_part == NULL)
-	{
-		if (found == 0)
-		{
-			my_print("Path Resolved at inode %d", child_dirent->ino);
-			if(final_inode != NULL)
-				readi(child_dirent->ino, final_inode);
-			return 0;
-		}
-		else
-		{
-			return -1;
-		}
-	}
-	else
+	if (capture_out != NULL)
 	{
-		if (found == 0)
-		{
-			return get_node_by_path(second_part, child_dirent->ino, final_inode);
-		}
-		{
-			return -1;
-		}
+		fclose(capture_out);
+		capture_out = NULL;
 	}
+	rufs_unmount();
 }
 
-/*
- * Make file system
- */
-int rufs_mkfs()
+static int rufs_fuse_getattr(const char *path, struct stat *stbuf)
 {
-	my_print("MKFS START");
-
-	// Call dev_init() to initialize (Create) Diskfile
-	dev_init(diskfile_path);
-
-	// write superblock information
-	sb = calloc(1, BLOCK_SIZE);
-	sb->magic_num = MAGIC_NUM;
-	sb->i_bitmap_blk = 1;
-	sb->d_bitmap_blk = sb->i_bitmap_blk + 1;
-	sb->i_start_blk = sb->d_bitmap_blk + 1;
-	sb->d_start_blk = sb->i_start_blk + (MAX_INUM * sizeof(struct inode)) / BLOCK_SIZE;
-	sb->max_inum = MAX_INUM;
-	sb->max_dnum = MAX_DNUM - sb->d_start_blk;
-	bio_write(0, sb);
-
-	// initialize inode bitmap
-	inode_bm = calloc(1, BLOCK_SIZE);
-	bio_write(sb->i_bitmap_blk, inode_bm);
-
-	// initialize data block bitmap
-	dblock_bm = calloc(1, BLOCK_SIZE);
-	bio_write(sb->d_bitmap_blk, dblock_bm);
-
-	// update bitmap information for root directory
-	int root_ino = get_avail_ino();
-	int root_dno = get_avail_blkno();
-	my_print("Root Inode at inode: |%d|", root_ino);
-	my_print("Root DataBlock at num: |%d|", root_dno);
-
-	// update inode for root directory
-	struct inode *root_inode = malloc(sizeof(struct inode));
-	root_inode->ino = root_ino;
-	root_inode->valid = VALID_INODE;
-	root_inode->link = 2;
-	root_inode->size = BLOCK_SIZE;
-	root_inode->type = __S_IFDIR;
-	for (int i = 0; i < MAX_DIRECT_PTRS; i++)
-	{
-		root_inode->direct_ptr[i] = INVALID_DBLOCK;
-	}
-	root_inode->direct_ptr[0] = root_dno;
-	time(&root_inode->vstat.st_mtime);
-	root_inode->vstat.st_uid = getuid();
-	root_inode->vstat.st_gid = getgid();
-
-	writei(root_ino, root_inode);
-
-	struct dirent* dirents = calloc(1, BLOCK_SIZE);
-	dirents[0].ino = root_inode->ino;
-	strcpy(dirents[0].name, ".");
-	dirents[0].len = strlen(dirents[0].name);
-	dirents[0].valid = VALID_DIRENT;
-
-	// no need for dot-dot 
-	// dirents[1].ino = root_inode->ino;
-	// strcpy(dirents[1].name, "..");
-	// dirents[1].len = strlen(dirents[1].name);
-	// dirents[1].valid = VALID_DIRENT;
-
-	bio_write(sb->d_start_blk + root_inode->direct_ptr[0], dirents);
-
-	// struct dirent *dot = dirents;
-	// struct dirent *dotdot = dirents + sizeof(struct dirent);
-	// dot->ino = root_inode->ino;
-	// strcpy(dot->name, ".");
-	// dot->len = strlen(dot->name);
-	// dot->valid = VALID_DIRENT;
-	// dotdot->ino = root_inode->ino;
-	// strcpy(dotdot->name, "..");
-	// dotdot->len = strlen(dotdot->name);
-	// dotdot->valid = VALID_DIRENT;
-	// bio_write(sb->d_start_blk + root_inode->direct_ptr[0], dirents);
-
-	free(root_inode);
-	free(dirents);
-	return 0;
+	return TIMED(OP_GETATTR, path, 0, 0, 0, 0, rufs_getattr(path, stbuf));
 }
 
-/*
- * FUSE file operations
- */
-static void *rufs_init(struct fuse_conn_info *conn)
+static int rufs_fuse_opendir(const char *path, struct fuse_file_info *fi)
 {
-	my_print("INIT START");
-	if (dev_open(diskfile_path) < 0)
-	{
-		my_print("Making DISK. Calling mkfs");
-		rufs_mkfs();
-	}
-	else
-	{
-		my_print("DISK Already Exists");
-		sb = malloc(BLOCK_SIZE);
-		inode_bm = malloc(BLOCK_SIZE);	// so we do not have to malloc and free everytime doing bitmap ops
-		dblock_bm = malloc(BLOCK_SIZE); // so we do not have to malloc and free everytime doing bitmap ops
-		bio_read(0, sb);
-
-		//tests file io
-
-		// tests. passed
-		// TODO: delete tests
-		
-		// my_print("Magic Num: %d", sb->magic_num);
-
-		// int next = get_avail_blkno();
-		// my_print("Next Block %d", next);
-		// next = get_avail_ino();
-		// my_print("Next Inode %d", next);
-
-		// struct inode *root_inode = malloc(sizeof(struct inode));
-		// readi(0, root_inode);
-		// my_print("RootNode Valid Check: %d", root_inode->valid);
-		// my_print("RootNode Last mtime: %d", root_inode->vstat.st_mtime);
-
-		// struct dirent *dirents = malloc(BLOCK_SIZE);
-		// bio_read(sb->d_start_blk + root_inode->direct_ptr[0], dirents);
-
-		// my_print("Dot Found at |%s|", dirents[0].name);
-		// my_print("DotDot Found at |%s|", dirents[1].name);
-
-		// my_print("Finding |.| in root: status |%d|", dir_find(root_inode->ino, ".", strlen("."), NULL));
-		// my_print("Finding |..| in root: status |%d|", dir_find(root_inode->ino, "..", strlen(".."), NULL));
-		// my_print("Adding |.| in root: status |%d|", dir_add(*root_inode, 10, ".", strlen(".")));
-		// my_print("Adding |..| in root: status |%d|", dir_add(*root_inode, 10, "..", strlen("..")));
-		// my_print("Finding |temp| in root: status |%d|", dir_find(root_inode->ino, "temp2", strlen("temp"), NULL));
-
-		// struct inode *inode_temp = malloc(sizeof(struct inode));
-		// inode_temp->ino = get_avail_ino();
-		// inode_temp->valid = VALID_INODE;
-		// inode_temp->link = 2;
-		// inode_temp->size = BLOCK_SIZE;
-		// inode_temp->type = __S_IFDIR;
-		// for (int i = 0; i < MAX_DIRECT_PTRS; i++)
-		// {
-		// 	inode_temp->direct_ptr[i] = INVALID_DBLOCK;
-		// }
-		// inode_temp->direct_ptr[0] = get_avail_blkno();
-		// time(&inode_temp->vstat.st_mtime);
-		// writei(inode_temp->ino, inode_temp);
-		// my_print("Adding |temp| w/ inode |%d| in root: status |%d|", inode_temp->ino, dir_add(*root_inode, inode_temp->ino, "temp2", strlen("temp2")));
-		
-		// struct inode *inode_cd = malloc(sizeof(struct inode));
-		// inode_cd->ino = get_avail_ino();
-		// inode_cd->valid = VALID_INODE;
-		// inode_cd->link = 2;
-		// inode_cd->size = BLOCK_SIZE;
-		// inode_cd->type = __S_IFDIR;
-		// for (int i = 0; i < MAX_DIRECT_PTRS; i++)
-		// {
-		// 	inode_cd->direct_ptr[i] = INVALID_DBLOCK;
-		// }
-		// inode_cd->direct_ptr[0] = get_avail_blkno();
-		// time(&inode_cd->vstat.st_mtime);
-		// writei(inode_cd->ino, inode_cd);
-		// my_print("Adding |temp/cd| w/ inode |%d| in temp: status |%d|", inode_cd->ino, dir_add(*inode_temp, inode_cd->ino, "cd", strlen("cd")));
-
-
-		// my_print("Finding |temp| in root: status |%d|", dir_find(root_inode->ino, "temp", strlen("temp"), NULL));
-		// bio_read(sb->d_start_blk + root_inode->direct_ptr[0], dirents);
-		// struct dirent *temp = dirents + sizeof(struct dirent) * 2;
-		// my_print("Dot Found at |%s|", dirents[0].name);
-		// my_print("DotDot Found at |%s|", dirents[1].name);
-		// my_print("Temp Found at |%s|", dirents[2].name);
-		
-		// struct inode* new_in = malloc(sizeof(struct inode));
-		// char* path = "/././temp/cd";
-		// int stat = get_node_by_path(path, root_inode->ino, new_in);
-		// my_print("Get Node at |%s| with stat |%d| and inode |%d|", path, stat, new_in->ino);
-
-		// my_print("%d %d",S_ISDIR(inode_temp->type), S_ISDIR(inode_cd->type));
-	}
-
-	// Step 1a: If disk file is not found, call mkfs
+	uint16_t ino;
+	if (TIMED(OP_OPENDIR, path, 0, 0, 0, 0, rufs_opendir(path, &ino)) != 0)
+		return -1;
+	fi->fh = ino;
+	return 0;
+}
 
-	// Step 1b: If disk file is found, just initialize in-memory data structures
-	// and read superblock from disk
+// what rufs_readdir() calls back with, forwarded to the fuse filler
+struct fill_ctx {
+	void *buffer;
+	fuse_fill_dir_t filler;
+};
 
-	return NULL;
-}
-int amount_of_dblocks_used(){
-	bio_read(sb->d_bitmap_blk, dblock_bm);
-	int count = 0;
-	for (int i = 0; i < sb->max_dnum; i++)
-	{
-		if (get_bitmap(dblock_bm, i) == 1)
-			count++;
-	}
-	return count;
-	
-}
-static void rufs_destroy(void *userdata)
+static int fill_one(void *ctx, const char *name)
 {
-	my_print("DESTROY START");
-	//calculate how many d blocks used for report:
-	my_print_always("Amount of dblocks used on this DISKFILE: %d dblocks", amount_of_dblocks_used());
-	
-	// Step 1: De-allocate in-memory data structures
-	free(sb);
-	free(inode_bm);
-	free(dblock_bm);
-	// Step 2: Close diskfile
-	dev_close();
+	struct fill_ctx *fc = ctx;
+	return fc->filler(fc->buffer, name, NULL, 0);
 }
 
-static int rufs_getattr(const char *path, struct stat *stbuf)
+static int rufs_fuse_readdir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
 {
-	my_print("GET_ATTR START");
-
-	// Step 1: call get_node_by_path() to get inode from path
-	struct inode* in = malloc(sizeof(struct inode));
-	int stat = get_node_by_path(path, 0, in);
-	if(stat == -1){
-		free(in);
-		errno = ENOENT;
-		return -ENOENT;  
-	}
-	// Step 2: fill attribute of file into stbuf from inode
-
-	// stbuf->st_mode = __S_IFDIR | 0755;
-	
-	// stbuf->st_nlink = 2;
-	// time(&stbuf->st_mtime);
-	
-	// st_uid
-	// st_gid
-	// st_nlink
-	// st_size
-	// st_mtime
-	// st_mode
-	if(stbuf != NULL){
-		stbuf->st_uid = in->vstat.st_uid;
-		stbuf->st_gid = in->vstat.st_gid;
-		stbuf->st_nlink = in->link;
-		stbuf->st_size = in->size;
-		stbuf->st_mtime = in->vstat.st_mtime;
-		if(S_ISDIR(in->type))
-			stbuf->st_mode = in->type | 0755; //0777
-		else //reg file
-			stbuf->st_mode = in->type | 0644;  //rw-r--r--. the bechmarks makes files with rw-rw-rw-
-	}
-
-	free(in);
-	return 0;
+	struct fill_ctx fc = { buffer, filler };
+	return TIMED(OP_READDIR, path, 0, 0, 0, 0, rufs_readdir(path, fill_one, &fc));
 }
 
-static int rufs_opendir(const char *path, struct fuse_file_info *fi)
+static int rufs_fuse_mkdir(const char *path, mode_t mode)
 {
-	my_print("OPEN DIR START");
-
-	// Step 1: Call get_node_by_path() to get inode from path
-	// Step 2: If not find, return -1
-	struct inode* in = malloc(sizeof(struct inode));
-	int stat = get_node_by_path(path, 0, in);
-	if(stat == -1 || !S_ISDIR(in->type)){
-		free(in);
-		return -1;
-	}
-	free(in);
-	return 0;
+	return TIMED(OP_MKDIR, path, 0, 0, 0, mode, rufs_mkdir(path, mode));
 }
 
-static int rufs_readdir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
+static int rufs_fuse_rmdir(const char *path)
 {
-	my_print("READ DIR START |%s|", path);
-
-	// Step 1: Call get_node_by_path() to get inode from path
-	struct inode* in = malloc(sizeof(struct inode));
-	int stat = get_node_by_path(path, 0, in);
-	if(stat == -1 || !S_ISDIR(in->type)){
-		free(in);
-		return -1;
-	}
-	// Step 2: Read directory entries from its data blocks, and copy them to filler
-	struct inode* temp = malloc(sizeof(struct inode));
-	struct dirent* dirents = malloc(BLOCK_SIZE);
-	for(int i = 0; i < MAX_DIRECT_PTRS; i++){
-		if(in->direct_ptr[i] == INVALID_DBLOCK)
-			break;
-		bio_read(sb->d_start_blk + in->direct_ptr[i], dirents);
-		for(int j = 0; j < MAX_DIRENTS_PER_DIRECT_PTR; j++){
-			if(dirents[j].valid == VALID_DIRENT){
-				my_print("filling in |%s|", dirents[j].name);
-				filler(buffer, dirents[j].name, NULL, 0);
-			}
-
-		}
-	}
-	free(temp);
-	free(dirents);
-	free(in);
-	return 0;
+	return TIMED(OP_RMDIR, path, 0, 0, 0, 0, rufs_rmdir(path));
 }
 
-
-static int rufs_mkdir(const char *path, mode_t mode)
+static int rufs_fuse_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 {
-	my_print("MAKE DIR |%s|", path);
-	
-
-	//note 2:, must call getattr() to see if file already exisits
-	if(strlen(path) == 0){
-		return -1;
-	}
-	if(rufs_getattr(path, NULL) == 0){
-		return -1;
-	}
-
-	// Step 1: Use dirname() and basename() to separate parent directory path and target directory name
-	// int len_path = strlen(path);
-	// char* non_const_path = malloc(len_path+ 1);
-	// strcpy(non_const_path, path);
-	// my_print("%s -> %s", path, non_const_path);
-	char* base_name = basename(strdup(path));
-	char* dir_name = dirname(strdup(path));
-	my_print("Splting |%s| into Dirname: |%s| Basname: |%s|", path, dir_name, base_name);
-	if(strlen(dir_name) == 0 || strlen(base_name) == 0){
-		return -1;
-	}
-
-	// Step 2: Call get_node_by_path() to get inode of parent directory
-	struct inode* parrent_inode = malloc(sizeof(struct inode));
-	int stat = get_node_by_path(dir_name, 0, parrent_inode);
-	if(stat == -1){
-		return -1;
-	}
-
-
-	// Step 3: Call get_avail_ino() to get an available inode number
-	int base_ino = get_avail_ino();
-	my_print("NEW DIR INODE |%d| ----------------", base_ino);
-
-	// Step 4: Call dir_add() to add directory entry of target directory to parent directory
-	stat = dir_add(*parrent_inode, base_ino, base_name, strlen(base_name));
-	if(stat == -1){
-		my_print("MKDIR ERRO: could not add in dir add");
-		return -1;
-	}
-
-	// Step 5: Update inode for target directory
-	struct inode* base_inode = malloc(sizeof(struct inode));
-	base_inode->ino = base_ino;
-	base_inode->link = 2;
-	base_inode->size = BLOCK_SIZE;
-	base_inode->type = __S_IFDIR;
-	base_inode->valid = VALID_INODE;
-	for(int i = 0; i < MAX_DIRECT_PTRS; i++){
-		base_inode->direct_ptr[i] = INVALID_DBLOCK;
-	}
-	base_inode->direct_ptr[0] = get_avail_blkno();
-	time(&base_inode->vstat.st_mtime);
-	base_inode->vstat.st_uid = getuid();
-	base_inode->vstat.st_gid = getgid();
-
-	struct dirent* dirents = calloc(1, BLOCK_SIZE);
-	dirents[0].ino = base_ino;
-	strcpy(dirents[0].name, ".");
-	dirents[0].len = strlen(dirents[0].name);
-	dirents[0].valid = VALID_DIRENT;
-	dirents[1].ino = parrent_inode->ino;
-	strcpy(dirents[1].name, "..");
-	dirents[1].len = strlen(dirents[1].name);
-	dirents[1].valid = VALID_DIRENT;
-
-	// Step 6: Call writei() to write inode to disk
-	bio_write(sb->d_start_blk + base_inode->direct_ptr[0], dirents);
-	writei(base_ino, base_inode);
-	free(base_inode);
-	free(parrent_inode);
-	return 0;
+	uint16_t ino;
+	int stat = TIMED(OP_CREATE, path, 0, 0, 0, mode, rufs_create(path, mode, &ino));
+	if (stat == 0)
+		fi->fh = ino;
+	return stat;
 }
 
-// Required for 518
-static int rufs_rmdir(const char *path)
+static int rufs_fuse_open(const char *path, struct fuse_file_info *fi)
 {
-
-	// Step 1: Use dirname() and basename() to separate parent directory path and target directory name
-
-	// Step 2: Call get_node_by_path() to get inode of target directory
-
-	// Step 3: Clear data block bitmap of target directory
-
-	// Step 4: Clear inode bitmap and its data block
-
-	// Step 5: Call get_node_by_path() to get inode of parent directory
-
-	// Step 6: Call dir_remove() to remove directory entry of target directory in its parent directory
-
+	uint16_t ino;
+	if (TIMED(OP_OPEN, path, 0, 0, 0, 0, rufs_open(path, &ino)) != 0)
+		return -1;
+	fi->fh = ino;
+	// its size changes under the page cache, every read has to come to us
+	if (ino == STATS_INO)
+		fi->direct_io = 1;
+	// a packed image never changes, so what the page cache has of a file stays good after a close
+	else if (pack_mounted())
+		fi->keep_cache = 1;
 	return 0;
 }
 
-static int rufs_releasedir(const char *path, struct fuse_file_info *fi)
+static int rufs_fuse_read(const char *path, char *buffer, size_t size, off_t offset, struct fuse_file_info *fi)
 {
-	// For this project, you don't need to fill this function
-	// But DO NOT DELETE IT!
-	return 0;
+	return TIMED(OP_READ, path, fi->fh, offset, size, 0, rufs_read(fi->fh, buffer, size, offset));
 }
 
-static int rufs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+static int rufs_fuse_write(const char *path, const char *buffer, size_t size, off_t offset, struct fuse_file_info *fi)
 {
-	my_print("CREATE FILE at |%s|", path);
-
-	//note 2:, must call getattr() to see if file already exisits
-	if(strlen(path) == 0){
-		return -1;
-	}
-	if(rufs_getattr(path, NULL) == 0){
-		return -1;
-	}
-
-	// Step 1: Use dirname() and basename() to separate parent directory path and target file name
-	char* base_name = basename(strdup(path));
-	char* dir_name = dirname(strdup(path));
-	if(strlen(dir_name) == 0 || strlen(base_name) == 0){
-		return -1;
-	}
-
-	// Step 2: Call get_node_by_path() to get inode of parent directory
-	struct inode* parrent_inode = malloc(sizeof(struct inode));
-	int stat = get_node_by_path(dir_name, 0, parrent_inode);
-	if(stat == -1){
-		return -1;
-	}
-
-	// Step 3: Call get_avail_ino() to get an available inode number
-	int base_ino = get_avail_ino();
-	my_print("NEW FILE INODE |%d| ----------------", base_ino);
-	fi->fh = base_ino;
-
-	// Step 4: Call dir_add() to add directory entry of target file to parent directory
-	stat = dir_add(*parrent_inode, base_ino, base_name, strlen(base_name));
-	if(stat == -1){
-		return -1;
-	}
-
-	// Step 5: Update inode for target file
-	struct inode* base_inode = malloc(sizeof(struct inode));
-	base_inode->ino = base_ino;
-	base_inode->link = 1;
-	base_inode->size = 0;
-	base_inode->type = __S_IFREG;
-	base_inode->valid = VALID_INODE;
-	for(int i = 0; i < MAX_DIRECT_PTRS; i++){
-		base_inode->direct_ptr[i] = INVALID_DBLOCK;
-	}
-	// //TODO: remove
-	// base_inode->direct_ptr[0] = get_avail_blkno();
-	// base_inode->direct_ptr[1] = get_avail_blkno();
-	// base_inode->direct_ptr[2] = get_avail_blkno();
-	
-	time(&base_inode->vstat.st_mtime);
-	base_inode->vstat.st_uid = getuid();
-	base_inode->vstat.st_gid = getgid();
-
-	// Step 6: Call writei() to write inode to disk
-	writei(base_ino, base_inode);
-	free(base_inode);
-	free(parrent_inode);
-	return 0;
+	return TIMED(OP_WRITE, path, fi->fh, offset, size, 0, rufs_write(fi->fh, buffer, size, offset));
 }
 
-static int rufs_open(const char *path, struct fuse_file_info *fi)
+static int rufs_fuse_unlink(const char *path)
 {
-	my_print("OPEN FILE START");
-
-	// Step 1: Call get_node_by_path() to get inode from path
-	// Step 2: If not find, return -1
-	struct inode* in = malloc(sizeof(struct inode));
-	int stat = get_node_by_path(path, 0, in);
-	if(stat == -1 || !S_ISREG(in->type)){
-		free(in);
-		return -1;
-	}
-	fi->fh = in->ino;
-	free(in);
-	return 0;
+	return TIMED(OP_UNLINK, path, 0, 0, 0, 0, rufs_unlink(path));
 }
 
-static int rufs_read(const char *path, char *buffer, size_t size, off_t offset, struct fuse_file_info *fi)
+static int rufs_fuse_fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fi)
 {
-	// offset = 10;
-	// size = 4 * BLOCK_SIZE - 1000;
-	my_print("READ |%d| bytes from |%s| starting from |%d|", size, path, offset);
-
-	// Step 1: Use fi to get ino of the file
-	struct inode* f_inode = malloc(sizeof(struct inode));
-	readi(fi->fh, f_inode);
-	if(offset > f_inode->size){
-		free(f_inode);
-		return -1;
-	}
-	// Step 2: Based on size and offset, read its data blocks from disk
-
-
-	void* data_block = malloc(BLOCK_SIZE);
-	
-	int sor_i = offset / BLOCK_SIZE; //starting direct pointer index
-	int i = sor_i;
-	int eof_i = f_inode->size / BLOCK_SIZE;
-	int rem = size;
-	int total = 0;
-	my_print("Starting Block: %d", sor_i);
-	my_print("Actual EOF Blokc: %d", eof_i);
-	my_print("Remaing to read: %d", rem);
-	while(rem > 0 && f_inode->direct_ptr[i] != INVALID_DBLOCK) {
-		//if at starting block (aka the block that contatins the offset), make sure you start to read from the offset
-		int start = (i == sor_i) ? (offset % BLOCK_SIZE): 0;
-		//max amount of data we can read from this block. if at the end of file, then max amount of data is diff. And must subtract offset if at starting block
-		int data_in_block = ((i == eof_i) ? f_inode->size % BLOCK_SIZE : BLOCK_SIZE) - start;
-		//the amount of bytes to read based on how much is left to read
-		int bytes_to_read =( rem > data_in_block) ? data_in_block : rem;
-		
-		bio_read(sb->d_start_blk + f_inode->direct_ptr[i], data_block);
-		memcpy(buffer, data_block + start, bytes_to_read);
-		my_print("Copied |%d| starting from |%d| @ block i:%d|%d|w|%d|", bytes_to_read, start, i, f_inode->direct_ptr[i], data_in_block);
-		
-		//update ptrs and counts
-		buffer += bytes_to_read;
-		total += bytes_to_read;
-		rem -= bytes_to_read;
-		i++;
-	}
-	my_print("TOTAL AMOUNT READ |%d| bytes", total);
-	my_print("Freeing Data Block");
-	free(data_block);
-	my_print("Freed Data Block. Feeing INode");
-	free(f_inode);
-	my_print("Freed Inode");
-	return total;
+	return TIMED(OP_FALLOCATE, path, fi->fh, offset, length, mode, rufs_fallocate(fi->fh, mode, offset, length));
 }
 
-static int rufs_write(const char *path, const char *buffer, size_t size, off_t offset, struct fuse_file_info *fi)
+static int rufs_fuse_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data)
 {
-	my_print("WRITE |%d| bytes to |%s| starting from |%d|", size, path, offset);
-
-	// Step 1: Use fi to get ino of file
-	struct inode* f_inode = malloc(sizeof(struct inode));
-	readi(fi->fh, f_inode);
-	printf("Found Inode #%d of ISDIR=%d", f_inode->ino, S_ISDIR(f_inode->type));
-
-	if(offset > f_inode->size){
-		free(f_inode);
-		return -1;
-	}
-	void* data_block = malloc(BLOCK_SIZE);
-
-	int sow_i = offset / BLOCK_SIZE;
-	int i = sow_i;
-	int rem = size;
-	int total = 0;
-	my_print("starting in Block i:%d|%d|", i, f_inode->direct_ptr[i]);
-	my_print("starting while loop");
-	while(rem > 0 && i < MAX_DIRECT_PTRS) {
-		int start = (i == sow_i) ? (offset % BLOCK_SIZE) : 0;
-		int bytes_to_write = (rem > (BLOCK_SIZE - start)) ? (BLOCK_SIZE - start) : rem;
-
-		if(f_inode->direct_ptr[i] == INVALID_DBLOCK) {
-			f_inode->direct_ptr[i] = get_avail_blkno();
-			my_print("New Block Allocated at i:%d|%d|", i , f_inode->direct_ptr[i]);
-		} else if(i == sow_i){
-			bio_read(sb->d_start_blk + f_inode->direct_ptr[i], data_block);
-		}
-		memcpy(data_block + start, buffer, bytes_to_write);
-		bio_write(sb->d_start_blk + f_inode->direct_ptr[i], data_block);
-		my_print("Writen |%d| starting from |%d| @ block i:%d|%d|w|%d|", bytes_to_write, start, i, f_inode->direct_ptr[i], (BLOCK_SIZE - start));
-
-		buffer += bytes_to_write;
-		total += bytes_to_write;
-		rem -= bytes_to_write;
-		i++;
-	}
-	// Step 2: Based on size and offset, read its data blocks from disk
-
-	// Step 3: Write the correct amount of data from offset to disk
-
-	// Step 4: Update the inode info and write it to disk
-
-	// Note: this function should return the amount of bytes you write to disk
-	my_print("TOTAL AMOUNT WRiting |%d| bytes", total);
-	f_inode->size = offset + total;
-	writei(f_inode->ino, f_inode);
-	free(f_inode);
-	free(data_block);
-	return total;
+	if (flags & FUSE_IOCTL_COMPAT)
+		return -ENOSYS;
+	return TIMED(OP_IOCTL, path, fi->fh, 0, cmd, cmd, rufs_ioctl(fi->fh, cmd, data));
 }
 
-// Required for 518
-
-static int rufs_unlink(const char *path)
+static int rufs_fuse_flush(const char *path, struct fuse_file_info *fi)
 {
-
-	// Step 1: Use dirname() and basename() to separate parent directory path and target file name
-
-	// Step 2: Call get_node_by_path() to get inode of target file
-
-	// Step 3: Clear data block bitmap of target file
-
-	// Step 4: Clear inode bitmap and its data block
-
-	// Step 5: Call get_node_by_path() to get inode of parent directory
-
-	// Step 6: Call dir_remove() to remove directory entry of target file in its parent directory
-
-	return 0;
+	return TIMED(OP_FLUSH, path, fi->fh, 0, 0, 0, rufs_flush());
 }
 
-static int rufs_truncate(const char *path, off_t size)
+static int rufs_fuse_releasedir(const char *path, struct fuse_file_info *fi)
 {
 	// For this project, you don't need to fill this function
 	// But DO NOT DELETE IT!
 	return 0;
 }
 
-static int rufs_release(const char *path, struct fuse_file_info *fi)
+static int rufs_fuse_truncate(const char *path, off_t size)
 {
 	// For this project, you don't need to fill this function
 	// But DO NOT DELETE IT!
 	return 0;
 }
 
-static int rufs_flush(const char *path, struct fuse_file_info *fi)
+static int rufs_fuse_release(const char *path, struct fuse_file_info *fi)
 {
 	// For this project, you don't need to fill this function
 	// But DO NOT DELETE IT!
 	return 0;
 }
 
-static int rufs_utimens(const char *path, const struct timespec tv[2])
+static int rufs_fuse_utimens(const char *path, const struct timespec tv[2])
 {
 	// For this project, you don't need to fill this function
 	// But DO NOT DELETE IT!
@@ -1006,34 +240,134 @@ static int rufs_utimens(const char *path, const struct timespec tv[2])
 }
 
 static struct fuse_operations rufs_ope = {
-	.init = rufs_init,
-	.destroy = rufs_destroy,
-
-	.getattr = rufs_getattr,
-	.readdir = rufs_readdir,
-	.opendir = rufs_opendir,
-	.releasedir = rufs_releasedir,
-	.mkdir = rufs_mkdir,
-	.rmdir = rufs_rmdir,
+	.init = rufs_fuse_init,
+	.destroy = rufs_fuse_destroy,
+
+	.getattr = rufs_fuse_getattr,
+	.readdir = rufs_fuse_readdir,
+	.opendir = rufs_fuse_opendir,
+	.releasedir = rufs_fuse_releasedir,
+	.mkdir = rufs_fuse_mkdir,
+	.rmdir = rufs_fuse_rmdir,
+
+	.create = rufs_fuse_create,
+	.open = rufs_fuse_open,
+	.read = rufs_fuse_read,
+	.write = rufs_fuse_write,
+	.unlink = rufs_fuse_unlink,
+
+	.truncate = rufs_fuse_truncate,
+	.fallocate = rufs_fuse_fallocate,
+	.ioctl = rufs_fuse_ioctl,
+	.flush = rufs_fuse_flush,
+	.utimens = rufs_fuse_utimens,
+	.release = rufs_fuse_release};
 
-	.create = rufs_create,
-	.open = rufs_open,
-	.read = rufs_read,
-	.write = rufs_write,
-	.unlink = rufs_unlink,
-
-	.truncate = rufs_truncate,
-	.flush = rufs_flush,
-	.utimens = rufs_utimens,
-	.release = rufs_release};
 
 int main(int argc, char *argv[])
 {
 	int fuse_stat;
 
-	getcwd(diskfile_path, PATH_MAX);
-	strcat(diskfile_path, "/DISKFILE");
-	my_print("Sizeof dirent %d MAx %d", sizeof(struct dirent), MAX_DIRENTS_PER_DIRECT_PTR);
+	getcwd(image_path, PATH_MAX);
+	strcat(image_path, "/DISKFILE");
+
+	// our own flags, taken out before argv goes to fuse_main
+	int fuse_argc = 0;
+	for (int i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--trim") == 0)
+			return rufs_trim(image_path) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+		if (strcmp(argv[i], "--nodiscard") == 0)
+		{
+			discard_enabled = 0;
+			continue;
+		}
+		if (strcmp(argv[i], "--noreadahead") == 0)
+		{
+			readahead_enabled = 0;
+			continue;
+		}
+		if (strcmp(argv[i], "--noprefetch") == 0)
+		{
+			prefetch_enabled = 0;
+			continue;
+		}
+		if (strcmp(argv[i], "--nobloom") == 0)
+		{
+			bloom_enabled = 0;
+			continue;
+		}
+		if (strcmp(argv[i], "--compress") == 0)
+		{
+			compress_all = 1;
+			continue;
+		}
+		if (strcmp(argv[i], "--dedup") == 0)
+		{
+			dedup_enabled = 1;
+			continue;
+		}
+		if (strcmp(argv[i], "--data-csum") == 0)
+		{
+			data_csum_enabled = 1;
+			continue;
+		}
+		if (strncmp(argv[i], "--size=", 7) == 0)
+		{
+			disk_size = parse_size(argv[i] + 7);
+			if (disk_size < DISK_SIZE / 32)
+			{
+				my_print_always("--size needs to be at least 1M, like --size=512M or --size=200G");
+				return EXIT_FAILURE;
+			}
+			continue;
+		}
+		if (strncmp(argv[i], "--image=", 8) == 0)
+		{
+			abs_path(argv[i] + 8, image_path);
+			continue;
+		}
+		if (strncmp(argv[i], "--dev=", 6) == 0)
+		{
+			if (dev_select(argv[i] + 6) == -1)
+			{
+				my_print_always("--dev takes file or ram");
+				return EXIT_FAILURE;
+			}
+			continue;
+		}
+		if (strncmp(argv[i], "--trace=", 8) == 0)
+		{
+			abs_path(argv[i] + 8, trace_path);
+			trace_file = trace_path;
+			continue;
+		}
+		if (strncmp(argv[i], "--capture=", 10) == 0)
+		{
+			abs_path(argv[i] + 10, capture_path);
+			continue;
+		}
+		if (strncmp(argv[i], "--max-size=", 11) == 0)
+		{
+			max_disk_size = parse_size(argv[i] + 11);
+			if (max_disk_size == 0)
+			{
+				my_print_always("--max-size takes a size like --max-size=1T");
+				return EXIT_FAILURE;
+			}
+			continue;
+		}
+		argv[fuse_argc++] = argv[i];
+	}
+	argc = fuse_argc;
+	if (rufs_check_version(image_path) == -1)
+		return EXIT_FAILURE;
+	// a packed image is checked whole here, rufs_fuse_init() maps it again
+	int packed = pack_open(image_path);
+	if (packed == -2)
+		return EXIT_FAILURE;
+	if (packed == 0)
+		pack_close();
 	fuse_stat = fuse_main(argc, argv, &rufs_ope, NULL);
 
 	return fuse_stat;
@@ -14,8 +14,12 @@
 #define _TFS_H
 
 #define MAGIC_NUM 0x5C3A
+/* fixed geometry of images made before FEATURE_GEOMETRY: a 32MB disk with 1024 inodes */
 #define MAX_INUM 1024
 #define MAX_DNUM 8192
+/* limits of a geometry picked at mkfs. inode numbers are uint16_t, and a direct_ptr keeps its flags in the top bits */
+#define MAX_INUM_LIMIT 65504
+#define MAX_DNUM_LIMIT 0x1FFFFFFF
 #define VALID_INODE 1
 #define INVALID_INODE 0
 #define INVALID_DBLOCK -1
@@ -23,7 +27,38 @@
 #define INVALID_DIRENT 0
 #define MAX_DIRECT_PTRS 16
 #define MAX_DIRENTS_PER_DIRECT_PTR (BLOCK_SIZE / sizeof(struct dirent))
+#define MAX_FILE_SIZE (MAX_DIRECT_PTRS * BLOCK_SIZE)
 
+/* inode flags */
+#define INODE_COMPRESS 0x1			/* compress full clusters of this file (chattr +c) */
+#define INODE_INLINE 0x2			/* file data is kept in inline_data, it has no data blocks */
+
+/*
+ * bytes of file data that fit in the inode in place of its block pointers. 80, not the 256 a
+ * small file can be: room for 256 would take 384 byte inodes, a third as many per table block, so
+ * files of 81 bytes and up still take a data block
+ */
+#define MAX_INDIRECT_PTRS 4
+#define INLINE_DATA_MAX ((MAX_DIRECT_PTRS + MAX_INDIRECT_PTRS) * sizeof(int))
+
+/*
+ * compression works on clusters of direct_ptrs. a compressed cluster keeps a uint32_t length
+ * and the compressed bytes in its first few slots, all flagged DBLOCK_COMPRESSED, and the
+ * rest of its slots are INVALID_DBLOCK. it has to save at least one block to be kept
+ */
+#define CLUSTER_BLOCKS 4
+#define CLUSTER_SIZE (CLUSTER_BLOCKS * BLOCK_SIZE)
+#define MAX_CLUSTERS (MAX_DIRECT_PTRS / CLUSTER_BLOCKS)
+
+/* flag bits kept in the high end of a direct_ptr entry */
+#define DBLOCK_UNWRITTEN 0x40000000	/* reserved by fallocate, reads as zeros until written */
+#define DBLOCK_COMPRESSED 0x20000000	/* holds part of a compressed cluster */
+#define DBLOCK_FLAGS (DBLOCK_UNWRITTEN | DBLOCK_COMPRESSED)
+#define DBLOCK_NUM(ptr) ((ptr) & ~DBLOCK_FLAGS)
+
+
+/* bits of superblock csum_intent, each one covers an equal share of the checksum region */
+#define CSUM_INTENT_BITS 16384
 
 struct superblock {
 	uint32_t	magic_num;			/* magic number */
@@ -33,17 +68,84 @@ struct superblock {
 	uint32_t	d_bitmap_blk;		/* start block of data block bitmap */
 	uint32_t	i_start_blk;		/* start block of inode region */
 	uint32_t	d_start_blk;		/* start block of data block region */
+	uint32_t	features;			/* FEATURE_* bits this image was made with */
+	uint32_t	r_start_blk;		/* start block of data block refcount region */
+	uint32_t	f_start_blk;		/* start block of data block fingerprint region */
+	uint32_t	c_start_blk;		/* start block of block checksum region */
+	uint32_t	state;				/* SB_* state bits */
+	uint32_t	version;			/* on-disk inode format, SB_VERSION */
+	uint32_t	nr_inodes;			/* inodes in the inode table */
+	uint32_t	nr_dblocks;			/* blocks in the data block region */
+	uint32_t	i_bitmap_len;		/* blocks of inode bitmap */
+	uint32_t	d_bitmap_len;		/* blocks of data block bitmap */
+	uint64_t	nr_blocks;			/* blocks in the whole image */
+	uint64_t	max_blocks;			/* blocks the regions were laid out for, the image can grow to this */
+	uint32_t	max_inodes;			/* inodes the inode table has room for */
+	uint32_t	inodes_per_group;	/* inode table slice at the start of each block group, FEATURE_BGROUPS */
+	uint8_t		csum_intent[CSUM_INTENT_BITS / 8];	/* parts of the checksum region that can be behind, SB_CSUM_INTENT */
 };
 
+/*
+ * on-disk format version. images made before the field existed read back 0 and have the
+ * v1 256 byte inodes (a host struct stat inside). ./rufs_migrate converts them to v2
+ */
+#define SB_VERSION 2
+
+/* superblock feature bits. images made before a feature existed read back 0 */
+#define FEATURE_REFCOUNT 0x1		/* data blocks can be shared, see r_start_blk */
+#define FEATURE_IFLAGS 0x2			/* inode flags field is initialized */
+#define FEATURE_FPRINT 0x4			/* content fingerprints for dedup, see f_start_blk */
+#define FEATURE_CSUM 0x8			/* crc32c of every block, see c_start_blk */
+#define FEATURE_GEOMETRY 0x10		/* sized at mkfs, see nr_blocks. max_inum/max_dnum are not used */
+#define FEATURE_BGROUPS 0x20		/* inode table split into block groups, see inodes_per_group */
+
+/* superblock state bits */
+#define SB_MOUNTED 0x1				/* set while mounted, still set after a crash */
+#define SB_MIGRATING 0x2			/* rufs_migrate is writing the v2 table, its journal has the rest */
+#define SB_CSUM_INTENT 0x4			/* csum_intent is kept while mounted, see reseed_csums() */
+
+/* blocks it takes to hold n entries of size bytes */
+#define REGION_BLOCKS(n, size) (((uint64_t)(n) * (size) + BLOCK_SIZE - 1) / BLOCK_SIZE)
+
+/* one uint16_t per data block: how many owners it has beyond the first */
+#define REFCOUNT_BLOCKS(ndblocks) REGION_BLOCKS(ndblocks, sizeof(uint16_t))
+#define REFCOUNT_MAX UINT16_MAX
+
+/* one uint64_t per data block: hash of its contents, 0 if not known */
+#define FPRINT_BLOCKS(ndblocks) REGION_BLOCKS(ndblocks, sizeof(uint64_t))
+
+/* one uint32_t per disk block: its crc32c, 0 if it is not checksummed */
+#define CSUM_BLOCKS(nblocks) REGION_BLOCKS(nblocks, sizeof(uint32_t))
+
+/*
+ * block groups. the data region is cut into groups of one data block bitmap block each (128MB),
+ * and every group starts with its own slice of the inode table
+ */
+#define BLOCKS_PER_GROUP (BLOCK_SIZE * 8)
+#define INODES_PER_BLOCK (BLOCK_SIZE / sizeof(struct inode))
+
+/* one bit per inode or data block */
+#define BITMAP_BLOCKS(nbits) (((uint64_t)(nbits) + BLOCK_SIZE * 8 - 1) / (BLOCK_SIZE * 8))
+
+/* v2 inode, 128 bytes so 32 fit in an inode table block */
 struct inode {
 	uint16_t	ino;				/* inode number */
 	uint16_t	valid;				/* validity of the inode */
-	uint32_t	size;				/* size of the file */
 	uint32_t	type;				/* type of the file */
 	uint32_t	link;				/* link count */
-	int			direct_ptr[16];		/* direct pointer to data block */
-	int			indirect_ptr[8];	/* indirect pointer to data block */
-	struct stat	vstat;				/* inode stat */
+	uint32_t	flags;				/* INODE_* flags */
+	uint64_t	size;				/* size of the file */
+	uint32_t	uid;				/* owner */
+	uint32_t	gid;				/* group */
+	int64_t		mtime_ns;			/* last data change, ns since the epoch */
+	int64_t		ctime_ns;			/* last inode change, ns since the epoch */
+	union {
+		struct {
+			int		direct_ptr[MAX_DIRECT_PTRS];	/* direct pointer to data block */
+			int		indirect_ptr[MAX_INDIRECT_PTRS];	/* indirect pointer to data block */
+		};
+		char	inline_data[INLINE_DATA_MAX];	/* file data of an INODE_INLINE file */
+	};
 };
 
 struct dirent {
@@ -59,15 +161,15 @@ struct dirent {
  */
 typedef unsigned char* bitmap_t;
 
-void set_bitmap(bitmap_t b, int i) {
+static inline void set_bitmap(bitmap_t b, int i) {
     b[i / 8] |= 1 << (i & 7);
 }
 
-void unset_bitmap(bitmap_t b, int i) {
+static inline void unset_bitmap(bitmap_t b, int i) {
     b[i / 8] &= ~(1 << (i & 7));
 }
 
-uint8_t get_bitmap(bitmap_t b, int i) {
+static inline uint8_t get_bitmap(bitmap_t b, int i) {
     return b[i / 8] & (1 << (i & 7)) ? 1 : 0;
 }
 
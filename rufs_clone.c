@@ -0,0 +1,93 @@
+/*
+ *	Tiny File System
+ *	File:	rufs_clone.c
+ *
+ *	reflink a file inside a rufs mount without copying its data
+ *	usage: rufs_clone SRC DST [SRC_OFFSET DST_OFFSET LENGTH]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+#include "rufs_ioctl.h"
+
+/*
+ * Find the root of the mount holding path by walking up until the device changes.
+ * fills root with the mount point. returns 0 on sucess, -1 on failure
+ */
+int find_mount_root(const char *path, char *root)
+{
+	struct stat st, parent_st;
+	if (realpath(path, root) == NULL || stat(root, &st) < 0)
+		return -1;
+	while (strcmp(root, "/") != 0)
+	{
+		char parent[PATH_MAX];
+		strcpy(parent, root);
+		dirname(parent);
+		if (stat(parent, &parent_st) < 0)
+			return -1;
+		if (parent_st.st_dev != st.st_dev)
+			return 0;
+		strcpy(root, parent);
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3 && argc != 6)
+	{
+		fprintf(stderr, "usage: %s SRC DST [SRC_OFFSET DST_OFFSET LENGTH]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	char src_real[PATH_MAX], root[PATH_MAX];
+	if (realpath(argv[1], src_real) == NULL || find_mount_root(src_real, root) < 0)
+	{
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	struct rufs_clone_range args;
+	memset(&args, 0, sizeof(args));
+	// the fs only knows paths relative to its own root
+	const char *rel = src_real + strlen(root);
+	snprintf(args.src_path, RUFS_CLONE_PATH_MAX, "%s%s", rel[0] == '/' ? "" : "/", rel);
+	if (argc == 6)
+	{
+		args.src_offset = strtoull(argv[3], NULL, 0);
+		args.dest_offset = strtoull(argv[4], NULL, 0);
+		args.length = strtoull(argv[5], NULL, 0);
+	}
+
+	int fd = open(argv[2], O_WRONLY | O_CREAT, 0644);
+	if (fd < 0)
+	{
+		perror(argv[2]);
+		return EXIT_FAILURE;
+	}
+	struct stat src_st, dst_st;
+	stat(src_real, &src_st);
+	fstat(fd, &dst_st);
+	if (src_st.st_dev != dst_st.st_dev)
+	{
+		fprintf(stderr, "%s and %s are not on the same rufs mount\n", argv[1], argv[2]);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	if (ioctl(fd, RUFS_IOC_CLONE_RANGE, &args) < 0)
+	{
+		perror("RUFS_IOC_CLONE_RANGE");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	close(fd);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,55 @@
+/*
+ *	Tiny File System
+ *	File:	rufs_fsck.c
+ *
+ *	check an image that is not mounted, and with -y repair it
+ *	usage: rufs_fsck [-y] [-j THREADS] IMAGE
+ *	exits like e2fsck: 0 clean, 1 every problem fixed, 4 problems left, 8 could not check
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "librufs.h"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-y] [-j THREADS] IMAGE\n", prog);
+	exit(8);
+}
+
+int main(int argc, char *argv[])
+{
+	int repair = 0;
+	int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+	while ((opt = getopt(argc, argv, "yj:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'y':
+			repair = 1;
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || nthreads < 1)
+		usage(argv[0]);
+
+	switch (rufs_fsck(argv[optind], repair, nthreads))
+	{
+	case 0:
+		return 0;
+	case 1:
+		return 1;
+	case 2:
+		return 4;
+	default:
+		return 8;
+	}
+}
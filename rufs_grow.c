@@ -0,0 +1,48 @@
+/*
+ *	Tiny File System
+ *	File:	rufs_grow.c
+ *
+ *	grow a mounted rufs image without unmounting it
+ *	usage: rufs_grow MOUNTPOINT SIZE	(SIZE in bytes, or with a K, M, G or T suffix)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "librufs.h"
+#include "rufs_ioctl.h"
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: %s MOUNTPOINT SIZE\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	uint64_t size = parse_size(argv[2]);
+	if (size == 0)
+	{
+		fprintf(stderr, "%s: SIZE takes a size like 512M or 1T, not %s\n", argv[0], argv[2]);
+		return EXIT_FAILURE;
+	}
+
+	int fd = open(argv[1], O_RDONLY);
+	if (fd < 0)
+	{
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+	if (ioctl(fd, RUFS_IOC_GROW, &size) < 0)
+	{
+		// EFBIG: past the --max-size the image was made with
+		perror("RUFS_IOC_GROW");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	close(fd);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,359 @@
+/*
+ *	Tiny File System
+ *	File:	rufs_import.c
+ *
+ *	build a new image from a host directory tree, with no mount and no FUSE
+ *	usage: rufs_import [-j THREADS] [-s SIZE] SRCDIR IMAGE	(SIZE like ./rufs --size)
+ *
+ *	threads walk SRCDIR and read the files, and one writer puts them into librufs in breadth
+ *	first order: a dir's entries one after the other, so their inodes sit together, and every
+ *	file written whole, so its data is one run of blocks and one write. without -s the image
+ *	is sized from the walk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "block.h"
+// rufs.h has a struct dirent of its own
+#define dirent rufs_dirent
+#include "rufs.h"
+#undef dirent
+#include "librufs.h"
+
+#define DEFAULT_THREADS 8
+// files read ahead of the writer at most, so memory stays at about this many MAX_FILE_SIZE buffers
+#define READ_WINDOW 256
+#define NAME_MAX_RUFS (sizeof(((struct rufs_dirent *)0)->name) - 1)
+
+struct node {
+	char *src;			// path on the host
+	char *dst;			// path in the image
+	int is_dir;
+	off_t size;
+	mode_t mode;
+	struct node **kids;
+	int nkids;
+	// files only: filled by a reader
+	char *data;
+	int ready;			// 1 read, -1 could not be read
+};
+
+/*
+ * Step 1: the walk. dirs waiting to be read are on a stack, each is read by one thread, which
+ * fills its kids without a lock
+ */
+static pthread_mutex_t walk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t walk_cond = PTHREAD_COND_INITIALIZER;
+static struct node **walk_stack;
+static int walk_len = 0, walk_cap = 0, walk_busy = 0;
+static int skipped = 0;
+
+static char *join(const char *dir, const char *name)
+{
+	size_t len = strlen(dir) + strlen(name) + 2;
+	char *path = malloc(len);
+	snprintf(path, len, "%s%s%s", dir, strcmp(dir, "/") == 0 ? "" : "/", name);
+	return path;
+}
+
+static void walk_push(struct node *dir)
+{
+	if (walk_len == walk_cap)
+	{
+		walk_cap = walk_cap ? walk_cap * 2 : 64;
+		walk_stack = realloc(walk_stack, walk_cap * sizeof(*walk_stack));
+	}
+	walk_stack[walk_len++] = dir;
+	pthread_cond_signal(&walk_cond);
+}
+
+static void read_dir(struct node *dir)
+{
+	DIR *d = opendir(dir->src);
+	if (d == NULL)
+	{
+		perror(dir->src);
+		__atomic_fetch_add(&skipped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	int cap = 0;
+	struct dirent *de;
+	while ((de = readdir(d)) != NULL)
+	{
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		struct node *n = calloc(1, sizeof(struct node));
+		n->src = join(dir->src, de->d_name);
+		struct stat st;
+		const char *why = NULL;
+		if (strlen(de->d_name) > NAME_MAX_RUFS)
+			why = "name too long";
+		else if (lstat(n->src, &st) != 0)
+			why = strerror(errno);
+		else if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode))
+			why = "not a file or dir";
+		else if (S_ISREG(st.st_mode) && st.st_size > MAX_FILE_SIZE)
+			why = "bigger than a rufs file can be";
+		if (why != NULL)
+		{
+			fprintf(stderr, "skipping %s: %s\n", n->src, why);
+			__atomic_fetch_add(&skipped, 1, __ATOMIC_RELAXED);
+			free(n->src);
+			free(n);
+			continue;
+		}
+		n->dst = join(dir->dst, de->d_name);
+		n->is_dir = S_ISDIR(st.st_mode);
+		n->size = st.st_size;
+		n->mode = st.st_mode & 07777;
+		if (dir->nkids == cap)
+		{
+			cap = cap ? cap * 2 : 16;
+			dir->kids = realloc(dir->kids, cap * sizeof(*dir->kids));
+		}
+		dir->kids[dir->nkids++] = n;
+	}
+	closedir(d);
+	pthread_mutex_lock(&walk_lock);
+	for (int k = 0; k < dir->nkids; k++)
+		if (dir->kids[k]->is_dir)
+			walk_push(dir->kids[k]);
+	pthread_mutex_unlock(&walk_lock);
+}
+
+static void *walker(void *arg)
+{
+	pthread_mutex_lock(&walk_lock);
+	for (;;)
+	{
+		while (walk_len == 0 && walk_busy > 0)
+			pthread_cond_wait(&walk_cond, &walk_lock);
+		if (walk_len == 0)
+			break;
+		struct node *dir = walk_stack[--walk_len];
+		walk_busy++;
+		pthread_mutex_unlock(&walk_lock);
+		read_dir(dir);
+		pthread_mutex_lock(&walk_lock);
+		walk_busy--;
+	}
+	// nothing left and nobody reading, so nothing more will come. wake the others to see that
+	pthread_cond_broadcast(&walk_cond);
+	pthread_mutex_unlock(&walk_lock);
+	return NULL;
+}
+
+/*
+ * Step 3: the readers. they take files in writer order, at most READ_WINDOW ahead of it
+ */
+static pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t io_cond = PTHREAD_COND_INITIALIZER;
+static struct node **files;
+static int nfiles = 0, next_read = 0, written = 0;
+
+/* returns 1 if all of it was read, -1 if not */
+static int read_file(struct node *n)
+{
+	n->data = malloc(n->size > 0 ? n->size : 1);
+	int fd = open(n->src, O_RDONLY);
+	off_t got = 0;
+	while (fd >= 0 && got < n->size)
+	{
+		ssize_t r = read(fd, n->data + got, n->size - got);
+		if (r <= 0)
+			break;
+		got += r;
+	}
+	if (fd < 0 || got < n->size)
+		perror(n->src);
+	if (fd >= 0)
+		close(fd);
+	return (got == n->size) ? 1 : -1;
+}
+
+static void *reader(void *arg)
+{
+	pthread_mutex_lock(&io_lock);
+	while (next_read < nfiles)
+	{
+		if (next_read >= written + READ_WINDOW)
+		{
+			pthread_cond_wait(&io_cond, &io_lock);
+			continue;
+		}
+		struct node *n = files[next_read++];
+		pthread_mutex_unlock(&io_lock);
+		int ready = read_file(n);
+		pthread_mutex_lock(&io_lock);
+		n->ready = ready;
+		pthread_cond_broadcast(&io_cond);
+	}
+	pthread_mutex_unlock(&io_lock);
+	return NULL;
+}
+
+static int by_name(const void *a, const void *b)
+{
+	return strcmp((*(struct node *const *)a)->dst, (*(struct node *const *)b)->dst);
+}
+
+int main(int argc, char *argv[])
+{
+	int nthreads = DEFAULT_THREADS;
+	uint64_t size = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "j:s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 's':
+			size = parse_size(optarg);
+			if (size < DISK_SIZE / 32)
+			{
+				fprintf(stderr, "%s: bad size %s\n", argv[0], optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			nthreads = 0;
+		}
+	}
+	if (optind != argc - 2 || nthreads <= 0)
+	{
+		fprintf(stderr, "usage: %s [-j THREADS] [-s SIZE] SRCDIR IMAGE\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *image = argv[optind + 1];
+	if (access(image, F_OK) == 0)
+	{
+		fprintf(stderr, "%s: already exists, rufs_import only makes new images\n", image);
+		return EXIT_FAILURE;
+	}
+
+	struct node root = { 0 };
+	root.src = argv[optind];
+	root.dst = "/";
+	root.is_dir = 1;
+	struct stat st;
+	if (stat(root.src, &st) != 0 || !S_ISDIR(st.st_mode))
+	{
+		fprintf(stderr, "%s: not a directory\n", root.src);
+		return EXIT_FAILURE;
+	}
+	pthread_t tids[nthreads];
+	walk_push(&root);
+	for (int t = 0; t < nthreads; t++)
+		pthread_create(&tids[t], NULL, walker, NULL);
+	for (int t = 0; t < nthreads; t++)
+		pthread_join(tids[t], NULL);
+
+	// Step 2: breadth first order, and what the image needs to hold it
+	int cap = 1024, nnodes = 0;
+	struct node **order = malloc(cap * sizeof(*order));
+	order[nnodes++] = &root;
+	uint64_t blocks = 0;
+	for (int k = 0; k < nnodes; k++)
+	{
+		struct node *dir = order[k];
+		if (!dir->is_dir)
+			continue;
+		qsort(dir->kids, dir->nkids, sizeof(*dir->kids), by_name);
+		blocks += (dir->nkids + 2 + MAX_DIRENTS_PER_DIRECT_PTR - 1) / MAX_DIRENTS_PER_DIRECT_PTR;
+		for (int c = 0; c < dir->nkids; c++)
+		{
+			if (nnodes == cap)
+				order = realloc(order, (cap *= 2) * sizeof(*order));
+			order[nnodes++] = dir->kids[c];
+			if (!dir->kids[c]->is_dir)
+			{
+				nfiles++;
+				blocks += (dir->kids[c]->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+			}
+		}
+	}
+	files = malloc((nfiles > 0 ? nfiles : 1) * sizeof(*files));
+	for (int k = 0, f = 0; k < nnodes; k++)
+		if (!order[k]->is_dir)
+			files[f++] = order[k];
+	if (size == 0)
+	{
+		// a quarter spare for the bitmaps and regions, and an inode per 8 blocks (inodes_for())
+		uint64_t need = blocks + blocks / 4;
+		if (need < (uint64_t)nnodes * 8 + nnodes)
+			need = (uint64_t)nnodes * 8 + nnodes;
+		size = need * BLOCK_SIZE + DISK_SIZE / 2;
+		if (size < DISK_SIZE)
+			size = DISK_SIZE;
+	}
+	if (nnodes > MAX_INUM_LIMIT)
+		fprintf(stderr, "%d files and dirs, rufs holds %d. the rest will fail\n", nnodes, MAX_INUM_LIMIT);
+
+	// Step 3: the image. readers fill files[] in order while this thread writes them out
+	disk_size = size;
+	if (rufs_mount(image) != 0)
+		return EXIT_FAILURE;
+	for (int t = 0; t < nthreads; t++)
+		pthread_create(&tids[t], NULL, reader, NULL);
+	int errors = 0;
+	uint64_t bytes = 0;
+	uint64_t t0 = stat_clock();
+	for (int k = 1; k < nnodes; k++)
+	{
+		struct node *n = order[k];
+		if (n->is_dir)
+		{
+			if (rufs_mkdir(n->dst, n->mode) != 0)
+			{
+				fprintf(stderr, "%s: mkdir failed\n", n->dst);
+				errors++;
+			}
+			continue;
+		}
+		pthread_mutex_lock(&io_lock);
+		while (n->ready == 0)
+			pthread_cond_wait(&io_cond, &io_lock);
+		pthread_mutex_unlock(&io_lock);
+		uint16_t ino;
+		if (n->ready < 0)
+			errors++;
+		else if (rufs_create(n->dst, n->mode, &ino) != 0)
+		{
+			fprintf(stderr, "%s: create failed\n", n->dst);
+			errors++;
+		}
+		else if (n->size > 0 && rufs_write(ino, n->data, n->size, 0) != n->size)
+		{
+			fprintf(stderr, "%s: write failed\n", n->dst);
+			errors++;
+		}
+		else
+			bytes += n->size;
+		free(n->data);
+		n->data = NULL;
+		pthread_mutex_lock(&io_lock);
+		written++;
+		pthread_cond_broadcast(&io_cond);
+		pthread_mutex_unlock(&io_lock);
+	}
+	for (int t = 0; t < nthreads; t++)
+		pthread_join(tids[t], NULL);
+	double secs = (stat_clock() - t0) / 1e9;
+	rufs_unmount();
+
+	printf("%d dirs, %d files, %lu bytes in %.3fs (%.1f MB/s), %d skipped, %d failed\n",
+		nnodes - nfiles, nfiles, bytes, secs, secs > 0 ? bytes / secs / (1024 * 1024) : 0, skipped, errors);
+	return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,46 @@
+/*
+ *	Tiny File System
+ *	File:	rufs_ioctl.h
+ *
+ *	ioctls understood by rufs. shared by the fs and the client tools
+ */
+
+#ifndef _RUFS_IOCTL_H
+#define _RUFS_IOCTL_H
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+#define RUFS_CLONE_PATH_MAX 1024
+
+/*
+ * Share the blocks of [src_offset, src_offset+length) of src_path into the file the ioctl
+ * is issued on, starting at dest_offset. offsets must be block aligned, and so must length
+ * unless it reaches the end of the source and does not stop short of the end of the
+ * destination. length 0 means up to the end of the source
+ */
+struct rufs_clone_range {
+	char		src_path[RUFS_CLONE_PATH_MAX];	/* source file, absolute path inside the mount */
+	uint64_t	src_offset;
+	uint64_t	dest_offset;
+	uint64_t	length;
+};
+
+#define RUFS_IOC_CLONE_RANGE _IOW('r', 1, struct rufs_clone_range)
+
+/*
+ * Grow the mounted image to a DISKFILE of this many bytes, issued on any file or dir of the
+ * mount. it can only grow up to the --max-size the image was made with
+ */
+#define RUFS_IOC_GROW _IOW('r', 2, uint64_t)
+
+/* chattr flags. same values as linux/fs.h, which clashes with BLOCK_SIZE in block.h */
+#ifndef FS_IOC_GETFLAGS
+#define FS_IOC_GETFLAGS _IOR('f', 1, long)
+#define FS_IOC_SETFLAGS _IOW('f', 2, long)
+#endif
+#ifndef FS_COMPR_FL
+#define FS_COMPR_FL 0x00000004		/* compress file */
+#endif
+
+#endif
@@ -0,0 +1,291 @@
+/*
+ *	Tiny File System
+ *	File:	rufs_migrate.c
+ *
+ *	convert a DISKFILE with v1 (256 byte) inodes to the v2 (128 byte) format. the image must not be mounted
+ *	usage: rufs_migrate [DISKFILE]
+ *	the new blocks go to DISKFILE.migrate first, so a run that was cut short is finished by running it again
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "block.h"
+#include "rufs.h"
+#include "crc32c.h"
+
+/* an inode as rufs wrote it before SB_VERSION 2 */
+struct inode_v1 {
+	uint16_t	ino;				/* inode number */
+	uint16_t	valid;				/* validity of the inode */
+	uint32_t	size;				/* size of the file */
+	uint32_t	type;				/* type of the file */
+	uint32_t	link;				/* link count */
+	union {
+		struct {
+			int		direct_ptr[16];		/* direct pointer to data block */
+			int		indirect_ptr[7];	/* indirect pointer to data block */
+		};
+		char	inline_data[92];		/* file data of an INODE_INLINE file */
+	};
+	uint32_t	flags;				/* INODE_* flags, garbage without FEATURE_IFLAGS */
+	struct stat	vstat;				/* inode stat */
+};
+
+#define V1_INODE_BLOCKS ((MAX_INUM * sizeof(struct inode_v1)) / BLOCK_SIZE)
+
+/*
+ * the journal: a header block and then the blocks it lists, in that order. once the superblock
+ * has SB_MIGRATING set, the image is only made whole by writing all of them in place
+ */
+#define JOURNAL_MAGIC "RUFSMIG1"
+#define JOURNAL_MAX ((BLOCK_SIZE - 16) / sizeof(uint64_t))
+
+struct journal_header {
+	char magic[8];
+	uint64_t count;
+	uint64_t blocks[JOURNAL_MAX];
+};
+
+struct superblock *sb;
+bitmap_t dblock_bm;
+// crc32c of every disk block, NULL on images without FEATURE_CSUM
+uint32_t *blk_csum = NULL;
+
+/*
+ * Inline files longer than v2 has room for get their data moved to a fresh data block.
+ * returns 0 on sucess, -1 if the disk is full
+ */
+int spill_inline(const struct inode_v1 *old, struct inode *new)
+{
+	int blkno;
+	for (blkno = 0; blkno < sb->max_dnum; blkno++)
+	{
+		if (!get_bitmap(dblock_bm, blkno))
+			break;
+	}
+	if (blkno == sb->max_dnum)
+		return -1;
+	set_bitmap(dblock_bm, blkno);
+
+	void *data_block = calloc(1, BLOCK_SIZE);
+	memcpy(data_block, old->inline_data, old->size);
+	bio_write(sb->d_start_blk + blkno, data_block);
+	// file data is only checksummed with --data-csum, leave it unchecked
+	if (blk_csum != NULL)
+		blk_csum[sb->d_start_blk + blkno] = 0;
+	free(data_block);
+
+	new->flags &= ~INODE_INLINE;
+	for (int i = 0; i < MAX_DIRECT_PTRS; i++)
+		new->direct_ptr[i] = INVALID_DBLOCK;
+	new->direct_ptr[0] = blkno;
+	return 0;
+}
+
+/* add block_num to the journal, and its crc32c to blk_csum */
+void stage_block(struct journal_header *hdr, void *blocks, uint64_t block_num, const void *buf)
+{
+	if (blk_csum != NULL)
+		blk_csum[block_num] = crc32c(buf, BLOCK_SIZE);
+	memcpy((char *)blocks + hdr->count * BLOCK_SIZE, buf, BLOCK_SIZE);
+	hdr->blocks[hdr->count++] = block_num;
+}
+
+/* returns 0 once the journal is all on the host's disk, -1 if it could not be written */
+int write_journal(const char *path, const struct journal_header *hdr, const void *blocks)
+{
+	int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		return -1;
+	size_t len = hdr->count * BLOCK_SIZE;
+	int ret = 0;
+	if (pwrite(fd, hdr, BLOCK_SIZE, 0) != BLOCK_SIZE || pwrite(fd, blocks, len, BLOCK_SIZE) != (ssize_t)len || fsync(fd) != 0)
+		ret = -1;
+	close(fd);
+	return ret;
+}
+
+/* returns 0 if path holds a whole journal, read into hdr and blocks (malloced), else -1 */
+int read_journal(const char *path, struct journal_header **hdr, void **blocks)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	*hdr = malloc(BLOCK_SIZE);
+	*blocks = NULL;
+	int ret = -1;
+	if (pread(fd, *hdr, BLOCK_SIZE, 0) == BLOCK_SIZE && memcmp((*hdr)->magic, JOURNAL_MAGIC, 8) == 0 && (*hdr)->count <= JOURNAL_MAX)
+	{
+		size_t len = (*hdr)->count * BLOCK_SIZE;
+		*blocks = malloc(len);
+		if (pread(fd, *blocks, len, BLOCK_SIZE) == (ssize_t)len)
+			ret = 0;
+	}
+	close(fd);
+	return ret;
+}
+
+/*
+ * Write the journal's blocks in place, then the v2 superblock once they are on disk. writing
+ * them again after a crash does no harm, they are the same blocks
+ */
+void apply_journal(const char *path, const struct journal_header *hdr, const void *blocks)
+{
+	for (uint64_t i = 0; i < hdr->count; i++)
+		bio_write(hdr->blocks[i], (const char *)blocks + i * BLOCK_SIZE);
+	dev_flush();
+	sb->features |= FEATURE_IFLAGS;
+	sb->version = SB_VERSION;
+	sb->state &= ~SB_MIGRATING;
+	bio_write(0, sb);
+	dev_flush();
+	unlink(path);
+}
+
+int main(int argc, char *argv[])
+{
+	char diskfile_path[PATH_MAX];
+	if (argc > 1)
+		snprintf(diskfile_path, PATH_MAX, "%s", argv[1]);
+	else
+	{
+		getcwd(diskfile_path, PATH_MAX);
+		strcat(diskfile_path, "/DISKFILE");
+	}
+
+	if (dev_open(diskfile_path) < 0)
+		return EXIT_FAILURE;
+	sb = malloc(BLOCK_SIZE);
+	bio_read(0, sb);
+	if (sb->magic_num != MAGIC_NUM)
+	{
+		fprintf(stderr, "rufs_migrate: %s is not a rufs image\n", diskfile_path);
+		return EXIT_FAILURE;
+	}
+	if (sb->version == SB_VERSION)
+	{
+		printf("rufs_migrate: %s is already v%d\n", diskfile_path, SB_VERSION);
+		return EXIT_SUCCESS;
+	}
+
+	char journal_path[PATH_MAX + 8];
+	snprintf(journal_path, sizeof(journal_path), "%s.migrate", diskfile_path);
+	if (sb->state & SB_MIGRATING)
+	{
+		// an earlier run was cut short while writing the table, which may be half v1 and half v2
+		struct journal_header *hdr;
+		void *blocks;
+		if (read_journal(journal_path, &hdr, &blocks) == -1)
+		{
+			fprintf(stderr, "rufs_migrate: %s was being migrated but %s is missing or cut short, can not finish it\n", diskfile_path, journal_path);
+			return EXIT_FAILURE;
+		}
+		apply_journal(journal_path, hdr, blocks);
+		dev_close();
+		printf("rufs_migrate: finished the interrupted migration of %s to v%d\n", diskfile_path, SB_VERSION);
+		free(hdr);
+		free(blocks);
+		free(sb);
+		return EXIT_SUCCESS;
+	}
+	// a journal without SB_MIGRATING is from a run that stopped before touching the table
+	unlink(journal_path);
+
+	if (sb->features & FEATURE_CSUM)
+	{
+		blk_csum = malloc(CSUM_BLOCKS(MAX_DNUM) * BLOCK_SIZE);
+		for (int i = 0; i < CSUM_BLOCKS(MAX_DNUM); i++)
+			bio_read(sb->c_start_blk + i, (char *)blk_csum + i * BLOCK_SIZE);
+	}
+	dblock_bm = malloc(BLOCK_SIZE);
+	bio_read(sb->d_bitmap_blk, dblock_bm);
+
+	// Step 1: convert the whole inode table in memory
+	struct inode_v1 *old_table = malloc(V1_INODE_BLOCKS * BLOCK_SIZE);
+	struct inode *new_table = calloc(V1_INODE_BLOCKS, BLOCK_SIZE);
+	for (int i = 0; i < V1_INODE_BLOCKS; i++)
+		bio_read(sb->i_start_blk + i, (char *)old_table + i * BLOCK_SIZE);
+
+	int converted = 0, spilled = 0;
+	for (int ino = 0; ino < MAX_INUM; ino++)
+	{
+		struct inode_v1 *old = &old_table[ino];
+		struct inode *new = &new_table[ino];
+		if (old->valid != VALID_INODE)
+			continue;
+		new->ino = old->ino;
+		new->valid = old->valid;
+		new->type = old->type;
+		new->link = old->link;
+		new->flags = (sb->features & FEATURE_IFLAGS) ? old->flags : 0;
+		new->size = old->size;
+		new->uid = old->vstat.st_uid;
+		new->gid = old->vstat.st_gid;
+		new->mtime_ns = (int64_t)old->vstat.st_mtim.tv_sec * 1000000000 + old->vstat.st_mtim.tv_nsec;
+		new->ctime_ns = new->mtime_ns;
+		if (!(new->flags & INODE_INLINE))
+			memcpy(new->direct_ptr, old->direct_ptr, sizeof(new->direct_ptr));
+		else if (old->size <= INLINE_DATA_MAX)
+			memcpy(new->inline_data, old->inline_data, old->size);
+		else if (spill_inline(old, new) == -1)
+		{
+			// nothing but free data blocks was written yet, so the image is untouched
+			fprintf(stderr, "rufs_migrate: no free data block to move inode %d out to\n", ino);
+			return EXIT_FAILURE;
+		}
+		else
+			spilled++;
+		converted++;
+	}
+
+	// Step 2: spilled data went to free blocks the v1 image does not use, get it there before the
+	// journal names the bitmap that takes them. the table only takes the front half of the old
+	// one now, the rest is left zeroed
+	dev_flush();
+	struct journal_header *hdr = calloc(1, BLOCK_SIZE);
+	memcpy(hdr->magic, JOURNAL_MAGIC, sizeof(hdr->magic));
+	void *blocks = malloc((1 + V1_INODE_BLOCKS + CSUM_BLOCKS(MAX_DNUM)) * BLOCK_SIZE);
+	if (spilled > 0)
+		stage_block(hdr, blocks, sb->d_bitmap_blk, dblock_bm);
+	for (int i = 0; i < V1_INODE_BLOCKS; i++)
+		stage_block(hdr, blocks, sb->i_start_blk + i, (char *)new_table + i * BLOCK_SIZE);
+	if (blk_csum != NULL)
+	{
+		// after the blocks above, which changed some of them
+		for (int i = 0; i < CSUM_BLOCKS(MAX_DNUM); i++)
+			memcpy((char *)blocks + (hdr->count + i) * BLOCK_SIZE, (char *)blk_csum + i * BLOCK_SIZE, BLOCK_SIZE);
+		for (int i = 0; i < CSUM_BLOCKS(MAX_DNUM); i++)
+			hdr->blocks[hdr->count++] = sb->c_start_blk + i;
+	}
+	if (write_journal(journal_path, hdr, blocks) == -1)
+	{
+		// the image still has every v1 block, only free data blocks were written
+		perror(journal_path);
+		unlink(journal_path);
+		return EXIT_FAILURE;
+	}
+
+	// Step 3: from here on a crash is finished by the next run
+	sb->state |= SB_MIGRATING;
+	bio_write(0, sb);
+	dev_flush();
+	apply_journal(journal_path, hdr, blocks);
+
+	printf("rufs_migrate: converted %d inodes of %s to v%d (%d inline files moved to a data block)\n",
+		converted, diskfile_path, SB_VERSION, spilled);
+	free(old_table);
+	free(new_table);
+	free(hdr);
+	free(blocks);
+	free(dblock_bm);
+	free(blk_csum);
+	free(sb);
+	return EXIT_SUCCESS;
+}
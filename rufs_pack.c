@@ -0,0 +1,224 @@
+/*
+ *	Tiny File System
+ *	File:	rufs_pack.c
+ *
+ *	build a read-only packed image (pack.h) from a host directory tree
+ *	usage: rufs_pack SRCDIR PACKFILE
+ *	./rufs --image=PACKFILE mounts it. it can not be written, make a new one to change it
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "pack.h"
+
+struct entry {
+	char *src;			// path on the host
+	const char *name;	// last part of src, "" for the root
+	struct stat st;
+	uint16_t parent;
+	uint32_t first;		// dirs: index of the first entry
+	uint32_t nkids;
+	uint32_t nsubdirs;
+};
+
+static struct entry *entries;
+static uint32_t nentries = 0, cap = 0;
+static int skipped = 0;
+
+static int by_name(const void *a, const void *b)
+{
+	const struct entry *x = a, *y = b;
+	return pack_namecmp(x->name, strlen(x->name), y->name, strlen(y->name));
+}
+
+/*
+ * Append the entries of dir k, sorted. they get the next inode numbers, so walking the
+ * entries in order and doing this for every dir numbers the tree breadth first
+ */
+static int read_dir(uint32_t k)
+{
+	DIR *d = opendir(entries[k].src);
+	if (d == NULL)
+	{
+		perror(entries[k].src);
+		skipped++;
+		return 0;
+	}
+	uint32_t first = nentries;
+	struct dirent *de;
+	while ((de = readdir(d)) != NULL)
+	{
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		if (nentries == PACK_MAX_INODES)
+		{
+			fprintf(stderr, "more than %d files and dirs, a packed image can not hold them\n", PACK_MAX_INODES);
+			closedir(d);
+			return -1;
+		}
+		if (nentries == cap)
+		{
+			cap = cap ? cap * 2 : 1024;
+			entries = realloc(entries, cap * sizeof(struct entry));
+		}
+		struct entry *e = &entries[nentries];
+		memset(e, 0, sizeof(*e));
+		size_t len = strlen(entries[k].src) + strlen(de->d_name) + 2;
+		e->src = malloc(len);
+		snprintf(e->src, len, "%s/%s", entries[k].src, de->d_name);
+		e->name = e->src + len - 1 - strlen(de->d_name);
+		const char *why = NULL;
+		if (lstat(e->src, &e->st) != 0)
+			why = strerror(errno);
+		else if (!S_ISDIR(e->st.st_mode) && !S_ISREG(e->st.st_mode))
+			why = "not a file or dir";
+		if (why != NULL)
+		{
+			fprintf(stderr, "skipping %s: %s\n", e->src, why);
+			skipped++;
+			free(e->src);
+			continue;
+		}
+		e->parent = k;
+		entries[k].nsubdirs += S_ISDIR(e->st.st_mode);
+		nentries++;
+	}
+	closedir(d);
+	entries[k].first = first;
+	entries[k].nkids = nentries - first;
+	qsort(&entries[first], nentries - first, sizeof(struct entry), by_name);
+	return 0;
+}
+
+/* copy size bytes of src to out. a file that got shorter since the walk is filled with zeros */
+static void copy_file(const char *src, off_t size, FILE *out)
+{
+	static char buf[1 << 20];
+	int fd = open(src, O_RDONLY);
+	if (fd < 0)
+		perror(src);
+	off_t done = 0;
+	while (done < size)
+	{
+		size_t want = (size - done < sizeof(buf)) ? size - done : sizeof(buf);
+		ssize_t got = (fd >= 0) ? read(fd, buf, want) : 0;
+		if (got <= 0)
+		{
+			fprintf(stderr, "%s: got shorter while packing, the rest reads as zeros\n", src);
+			memset(buf, 0, want);
+			got = want;
+			skipped++;
+		}
+		fwrite(buf, got, 1, out);
+		done += got;
+	}
+	if (fd >= 0)
+		close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: %s SRCDIR PACKFILE\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// Step 1: the walk, breadth first from the root
+	cap = 1024;
+	entries = calloc(cap, sizeof(struct entry));
+	entries[0].src = strdup(argv[1]);
+	entries[0].name = "";
+	if (stat(argv[1], &entries[0].st) != 0 || !S_ISDIR(entries[0].st.st_mode))
+	{
+		fprintf(stderr, "%s: not a directory\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	nentries = 1;
+	for (uint32_t k = 0; k < nentries; k++)
+	{
+		if (S_ISDIR(entries[k].st.st_mode) && read_dir(k) == -1)
+			return EXIT_FAILURE;
+	}
+
+	// Step 2: lay it out. inodes, then names, then the files one after the other
+	struct pack_header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PACK_MAGIC, sizeof(hdr.magic));
+	hdr.inode_size = sizeof(struct pack_inode);
+	hdr.ninodes = nentries;
+	hdr.names_off = sizeof(hdr) + (uint64_t)nentries * sizeof(struct pack_inode);
+	struct pack_inode *inodes = calloc(nentries, sizeof(struct pack_inode));
+	uint64_t names_len = 0, data_len = 0;
+	for (uint32_t k = 0; k < nentries; k++)
+	{
+		struct entry *e = &entries[k];
+		struct pack_inode *in = &inodes[k];
+		in->mode = e->st.st_mode & ~0222;
+		in->uid = e->st.st_uid;
+		in->gid = e->st.st_gid;
+		in->mtime_ns = (int64_t)e->st.st_mtim.tv_sec * 1000000000 + e->st.st_mtim.tv_nsec;
+		in->parent = e->parent;
+		in->name_off = names_len;
+		in->name_len = strlen(e->name);
+		names_len += in->name_len + 1;
+		if (S_ISDIR(e->st.st_mode))
+		{
+			in->off = e->first;
+			in->size = e->nkids;
+			in->nlink = 2 + e->nsubdirs;
+		}
+		else
+		{
+			in->off = data_len;
+			in->size = e->st.st_size;
+			in->nlink = 1;
+			data_len += e->st.st_size;
+		}
+	}
+	hdr.data_off = (hdr.names_off + names_len + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+	hdr.size = hdr.data_off + data_len;
+
+	// Step 3: write it out in that order
+	FILE *out = fopen(argv[2], "wb");
+	if (out == NULL)
+	{
+		perror(argv[2]);
+		return EXIT_FAILURE;
+	}
+	fwrite(&hdr, sizeof(hdr), 1, out);
+	fwrite(inodes, sizeof(struct pack_inode), nentries, out);
+	for (uint32_t k = 0; k < nentries; k++)
+		fwrite(entries[k].name, inodes[k].name_len + 1, 1, out);
+	for (uint64_t pad = hdr.names_off + names_len; pad < hdr.data_off; pad++)
+		fputc(0, out);
+	uint32_t nfiles = 0;
+	for (uint32_t k = 0; k < nentries; k++)
+	{
+		if (S_ISREG(entries[k].st.st_mode))
+		{
+			copy_file(entries[k].src, entries[k].st.st_size, out);
+			nfiles++;
+		}
+	}
+	// fwrite only reports a short write (the disk filling up) through the stream's error flag
+	int failed = ferror(out);
+	if (fclose(out) != 0 || failed)
+	{
+		perror(argv[2]);
+		return EXIT_FAILURE;
+	}
+	printf("packed %u files and %u dirs (%.1f MB) into %s", nfiles, nentries - nfiles, hdr.size / 1048576.0, argv[2]);
+	if (skipped > 0)
+		printf(", %d skipped", skipped);
+	printf("\n");
+	return EXIT_SUCCESS;
+}
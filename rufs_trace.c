@@ -0,0 +1,131 @@
+/*
+ *	Tiny File System
+ *	File:	rufs_trace.c
+ *
+ *	decode a trace written by ./rufs --trace=FILE
+ *	usage: rufs_trace [-s] TRACEFILE
+ *	prints every event in time order, or with -s a count and latency summary per operation
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "block.h"
+#include "trace.h"
+
+static const char *op_names[TRACE_OP_COUNT] = RUFS_OP_NAMES;
+
+static int by_time(const void *a, const void *b)
+{
+	const struct trace_event *x = a, *y = b;
+	return (x->ts_ns > y->ts_ns) - (x->ts_ns < y->ts_ns);
+}
+
+static int by_dur(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void print_event(struct trace_event *e, uint64_t start)
+{
+	const char *name = (e->op < TRACE_OP_COUNT) ? op_names[e->op] : "?";
+	printf("%12.6f t%-3d %-9s ", (e->ts_ns - start) / 1e9, e->tid, name);
+	switch (e->op)
+	{
+	case OP_READ:
+	case OP_WRITE:
+	case OP_FALLOCATE:
+		printf("ino %-5d off %-10lu size %-8u", e->ino, e->offset, e->size);
+		break;
+	case OP_DEV_READ:
+	case OP_DEV_WRITE:
+		printf("blk %-16lu size %-8u", e->offset / BLOCK_SIZE, e->size);
+		break;
+	case OP_IOCTL:
+		printf("ino %-5d cmd %-24x", e->ino, e->size);
+		break;
+	default:
+		printf("%-38s", "");
+	}
+	printf(" ret %-6d %9.1fus\n", e->ret, e->dur_ns / 1e3);
+}
+
+/* count, mean, p50, p99 and max of each operation */
+static void summary(struct trace_event *ev, uint32_t n)
+{
+	uint32_t *durs = malloc((n > 0 ? n : 1) * sizeof(uint32_t));
+	printf("%-10s %8s %8s %10s %10s %10s %10s\n", "op", "count", "errors", "mean_us", "p50_us", "p99_us", "max_us");
+	for (int op = 0; op < TRACE_OP_COUNT; op++)
+	{
+		uint32_t count = 0, errors = 0;
+		uint64_t sum = 0;
+		for (uint32_t k = 0; k < n; k++)
+		{
+			if (ev[k].op != op)
+				continue;
+			durs[count++] = ev[k].dur_ns;
+			sum += ev[k].dur_ns;
+			errors += (ev[k].ret < 0);
+		}
+		if (count == 0)
+			continue;
+		qsort(durs, count, sizeof(uint32_t), by_dur);
+		printf("%-10s %8u %8u %10.1f %10.1f %10.1f %10.1f\n", op_names[op], count, errors,
+			sum / 1e3 / count, durs[count / 2] / 1e3, durs[(uint64_t)count * 99 / 100] / 1e3, durs[count - 1] / 1e3);
+	}
+	free(durs);
+}
+
+int main(int argc, char *argv[])
+{
+	int summarize = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "s")) != -1)
+	{
+		if (opt != 's')
+		{
+			fprintf(stderr, "usage: %s [-s] TRACEFILE\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		summarize = 1;
+	}
+	if (optind != argc - 1)
+	{
+		fprintf(stderr, "usage: %s [-s] TRACEFILE\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	FILE *f = fopen(argv[optind], "rb");
+	if (f == NULL)
+	{
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+	struct trace_header hdr;
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0
+		|| hdr.event_size != sizeof(struct trace_event))
+	{
+		fprintf(stderr, "%s: not a rufs trace, or from another version\n", argv[optind]);
+		fclose(f);
+		return EXIT_FAILURE;
+	}
+	struct trace_event *ev = malloc((hdr.nevents > 0 ? hdr.nevents : 1) * sizeof(struct trace_event));
+	uint32_t n = fread(ev, sizeof(struct trace_event), hdr.nevents, f);
+	fclose(f);
+	if (n < hdr.nevents)
+		fprintf(stderr, "%s: cut short, %u of %u events\n", argv[optind], n, hdr.nevents);
+
+	// Step 1: the rings were dumped one after the other, merge them
+	qsort(ev, n, sizeof(struct trace_event), by_time);
+	if (summarize)
+		summary(ev, n);
+	else
+		for (uint32_t k = 0; k < n; k++)
+			print_event(&ev[k], ev[0].ts_ns);
+	free(ev);
+	return EXIT_SUCCESS;
+}
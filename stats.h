@@ -0,0 +1,53 @@
+/*
+ *	Tiny File System
+ *	File:	stats.h
+ *
+ *	operation counters and latency histograms. updated with relaxed atomics, so nothing
+ *	takes a lock and a reader may see one op counted but not yet timed
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+/* bucket b holds ops faster than 2^(b+10) ns (1us, 2us, 4us ... about 4s), the last one the rest */
+#define HIST_BUCKETS 23
+#define HIST_MIN_SHIFT 10
+
+struct op_stat {
+	uint64_t count;
+	uint64_t errors;
+	uint64_t sum_ns;
+	uint64_t bytes;
+	uint64_t buckets[HIST_BUCKETS];
+};
+
+static inline uint64_t stat_clock()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline int hist_bucket(uint64_t ns)
+{
+	uint64_t x = ns >> HIST_MIN_SHIFT;
+	int b = (x == 0) ? 0 : 64 - __builtin_clzll(x);
+	return (b < HIST_BUCKETS) ? b : HIST_BUCKETS - 1;
+}
+
+/* one op that took ns, moved bytes and failed or not */
+static inline void op_stat_record(struct op_stat *s, uint64_t ns, uint64_t bytes, int failed)
+{
+	__atomic_fetch_add(&s->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->sum_ns, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->buckets[hist_bucket(ns)], 1, __ATOMIC_RELAXED);
+	if (bytes > 0)
+		__atomic_fetch_add(&s->bytes, bytes, __ATOMIC_RELAXED);
+	if (failed)
+		__atomic_fetch_add(&s->errors, 1, __ATOMIC_RELAXED);
+}
+
+#endif
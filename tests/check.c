@@ -0,0 +1,694 @@
+/*
+ * Checks of librufs and the tools built next to it, run by make check from the top dir
+ *
+ * usage: ./tests/check
+ *
+ * each check makes its images in a scratch dir under /tmp, writes through librufs.h, remounts
+ * and reads everything back, and only passes if rufs_fsck() finds the image clean after. the
+ * import, pack and migrate checks run ./rufs_import, ./rufs_pack and ./rufs_migrate.
+ * every check runs in a child of its own, so one that fails with an image still mounted, or
+ * crashes, does not take the next ones with it. prints ok or FAIL per check and exits 1 if
+ * any failed
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/falloc.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../block.h"
+#include "../rufs.h"
+#include "../rufs_ioctl.h"
+#include "../librufs.h"
+
+/* internals of librufs.c that are not part of its API */
+int get_avail_blkno(uint32_t goal);
+int amount_of_dblocks_used();
+
+/* v1 inode as rufs_migrate.c reads it, to make an image from before SB_VERSION */
+struct inode_v1 {
+	uint16_t	ino;
+	uint16_t	valid;
+	uint32_t	size;
+	uint32_t	type;
+	uint32_t	link;
+	union {
+		struct {
+			int		direct_ptr[16];
+			int		indirect_ptr[7];
+		};
+		char	inline_data[92];
+	};
+	uint32_t	flags;
+	struct stat	vstat;
+};
+
+/* fail the check it is in with the line that did not hold */
+#define EXPECT(cond) do { \
+	if (!(cond)) { \
+		printf("    %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		return -1; \
+	} \
+} while (0)
+
+static char scratch[] = "/tmp/rufs_check.XXXXXX";
+
+/* files of the tree the import and pack checks copy in, and the v1 image has some of */
+struct tree_file {
+	const char *path;
+	int size;
+};
+
+static const struct tree_file tree[] = {
+	{ "empty", 0 },
+	{ "tiny", 50 },
+	{ "inline_max", INLINE_DATA_MAX },
+	{ "just_over", INLINE_DATA_MAX + 1 },
+	{ "one_block", BLOCK_SIZE },
+	{ "odd", 10000 },
+	{ "full", MAX_FILE_SIZE },
+	{ "sub/a", 3000 },
+	{ "sub/deeper/b", 40000 },
+};
+#define TREE_FILES (sizeof(tree) / sizeof(tree[0]))
+static const char *tree_dirs[] = { "sub", "sub/deeper" };
+#define TREE_DIRS (sizeof(tree_dirs) / sizeof(tree_dirs[0]))
+
+static char *scratch_path(char *buf, const char *name)
+{
+	snprintf(buf, PATH_MAX, "%s/%s", scratch, name);
+	return buf;
+}
+
+/* len bytes that do not compress, the same ones for the same seed */
+static void fill_random(char *buf, size_t len, unsigned int seed)
+{
+	uint32_t x = seed * 2654435761u + 1;
+	for (size_t i = 0; i < len; i++)
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		buf[i] = x >> 24;
+	}
+}
+
+/* len bytes of text, which lz.c packs well */
+static void fill_text(char *buf, size_t len)
+{
+	static const char line[] = "the quick brown fox jumps over the lazy dog, 0123456789\n";
+	for (size_t i = 0; i < len; i++)
+		buf[i] = line[i % (sizeof(line) - 1)];
+}
+
+/* a new mount at name in the scratch dir */
+static int fresh_mount(char *img, const char *name)
+{
+	scratch_path(img, name);
+	unlink(img);
+	return rufs_mount(img);
+}
+
+static int write_file(const char *path, const char *data, size_t len)
+{
+	uint16_t ino;
+	if (rufs_create(path, S_IFREG | 0644, &ino) != 0)
+		return -1;
+	if (len > 0 && rufs_write(ino, data, len, 0) != (int)len)
+		return -1;
+	return ino;
+}
+
+/* 0 if path holds exactly len bytes of data */
+static int read_back(const char *path, const char *data, size_t len)
+{
+	uint16_t ino;
+	struct stat st;
+	if (rufs_getattr(path, &st) != 0 || st.st_size != (off_t)len)
+		return -1;
+	if (rufs_open(path, &ino) != 0)
+		return -1;
+	char *buf = malloc(len + 1);
+	int ret = 0;
+	if (len > 0 && (rufs_read(ino, buf, len, 0) != (int)len || memcmp(buf, data, len) != 0))
+		ret = -1;
+	free(buf);
+	return ret;
+}
+
+/* unmount, fsck without repairing and mount again */
+static int remount(const char *img)
+{
+	rufs_flush();
+	rufs_unmount();
+	if (rufs_fsck(img, 0, 2) != 0)
+		return -1;
+	return rufs_mount(img);
+}
+
+/* unmount and fsck a last time */
+static int finish(const char *img)
+{
+	rufs_unmount();
+	return rufs_fsck(img, 0, 2) == 0 ? 0 : -1;
+}
+
+static int run(const char *cmd)
+{
+	int status = system(cmd);
+	return (status != -1 && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+}
+
+static int count_name(void *ctx, const char *name)
+{
+	(*(int *)ctx)++;
+	return 0;
+}
+
+static int check_files()
+{
+	char img[PATH_MAX];
+	char data[3 * BLOCK_SIZE + 100], small[60];
+	fill_random(data, sizeof(data), 1);
+	fill_random(small, sizeof(small), 2);
+
+	EXPECT(fresh_mount(img, "files.img") == 0);
+	EXPECT(rufs_mkdir("/d", S_IFDIR | 0755) == 0);
+	EXPECT(write_file("/d/f", data, sizeof(data)) >= 0);
+	EXPECT(write_file("/d/small", small, sizeof(small)) >= 0);
+	EXPECT(read_back("/d/f", data, sizeof(data)) == 0);
+
+	// an overwrite across a block boundary
+	uint16_t ino;
+	EXPECT(rufs_open("/d/f", &ino) == 0);
+	fill_random(data + BLOCK_SIZE - 500, 1000, 3);
+	EXPECT(rufs_write(ino, data + BLOCK_SIZE - 500, 1000, BLOCK_SIZE - 500) == 1000);
+
+	EXPECT(remount(img) == 0);
+	EXPECT(read_back("/d/f", data, sizeof(data)) == 0);
+	EXPECT(read_back("/d/small", small, sizeof(small)) == 0);
+	int names = 0;
+	EXPECT(rufs_readdir("/d", count_name, &names) == 0);
+	EXPECT(names >= 2);
+	struct stat st;
+	EXPECT(rufs_getattr("/d/missing", &st) == -ENOENT);
+	return finish(img);
+}
+
+static int check_compress()
+{
+	char img[PATH_MAX];
+	static char data[MAX_FILE_SIZE];
+	fill_text(data, sizeof(data));
+
+	compress_all = 1;
+	EXPECT(fresh_mount(img, "compress.img") == 0);
+	int used = amount_of_dblocks_used();
+	EXPECT(write_file("/text", data, sizeof(data)) >= 0);
+	EXPECT(rufs_flush() == 0);
+	EXPECT(amount_of_dblocks_used() - used < MAX_DIRECT_PTRS / 2);
+	EXPECT(remount(img) == 0);
+	EXPECT(read_back("/text", data, sizeof(data)) == 0);
+
+	// rewriting the middle of a compressed cluster
+	uint16_t ino;
+	EXPECT(rufs_open("/text", &ino) == 0);
+	fill_random(data + CLUSTER_SIZE + 100, 2000, 4);
+	EXPECT(rufs_write(ino, data + CLUSTER_SIZE + 100, 2000, CLUSTER_SIZE + 100) == 2000);
+	EXPECT(remount(img) == 0);
+	EXPECT(read_back("/text", data, sizeof(data)) == 0);
+	return finish(img);
+}
+
+static int check_dedup()
+{
+	char img[PATH_MAX];
+	static char data[8 * BLOCK_SIZE], block[BLOCK_SIZE];
+	fill_random(data, sizeof(data), 5);
+
+	dedup_enabled = 1;
+	EXPECT(fresh_mount(img, "dedup.img") == 0);
+	EXPECT(write_file("/a", data, sizeof(data)) >= 0);
+	EXPECT(rufs_flush() == 0);
+	int used = amount_of_dblocks_used();
+	EXPECT(write_file("/b", data, sizeof(data)) >= 0);
+	EXPECT(rufs_flush() == 0);
+	EXPECT(amount_of_dblocks_used() - used < 8);
+	EXPECT(remount(img) == 0);
+	EXPECT(read_back("/a", data, sizeof(data)) == 0);
+	EXPECT(read_back("/b", data, sizeof(data)) == 0);
+
+	// writing a shared block gives b its own copy and leaves a alone
+	uint16_t ino;
+	EXPECT(rufs_open("/b", &ino) == 0);
+	fill_random(block, sizeof(block), 6);
+	EXPECT(rufs_write(ino, block, sizeof(block), 0) == BLOCK_SIZE);
+	EXPECT(remount(img) == 0);
+	EXPECT(read_back("/a", data, sizeof(data)) == 0);
+	memcpy(data, block, sizeof(block));
+	EXPECT(read_back("/b", data, sizeof(data)) == 0);
+	return finish(img);
+}
+
+static int check_csum()
+{
+	char img[PATH_MAX];
+	static char data[4 * BLOCK_SIZE];
+	fill_random(data, sizeof(data), 7);
+
+	data_csum_enabled = 1;
+	EXPECT(fresh_mount(img, "csum.img") == 0);
+	EXPECT(write_file("/f", data, sizeof(data)) >= 0);
+	EXPECT(remount(img) == 0);
+	EXPECT(read_back("/f", data, sizeof(data)) == 0);
+	EXPECT(finish(img) == 0);
+
+	// flip a byte of the file's third block behind the checksum's back
+	int fd = open(img, O_RDWR);
+	EXPECT(fd >= 0);
+	char block[BLOCK_SIZE];
+	off_t found = -1;
+	for (off_t off = 0; pread(fd, block, BLOCK_SIZE, off) == BLOCK_SIZE; off += BLOCK_SIZE)
+	{
+		if (memcmp(block, data + 2 * BLOCK_SIZE, BLOCK_SIZE) == 0)
+		{
+			found = off;
+			break;
+		}
+	}
+	if (found != -1)
+	{
+		block[100] ^= 0xFF;
+		pwrite(fd, block, BLOCK_SIZE, found);
+	}
+	close(fd);
+	EXPECT(found != -1);
+
+	EXPECT(rufs_mount(img) == 0);
+	uint16_t ino;
+	EXPECT(rufs_open("/f", &ino) == 0);
+	EXPECT(rufs_read(ino, data, BLOCK_SIZE, 0) == BLOCK_SIZE);
+	EXPECT(rufs_read(ino, data, BLOCK_SIZE, 2 * BLOCK_SIZE) == -EIO);
+	rufs_unmount();
+	return 0;
+}
+
+static int check_fallocate()
+{
+	char img[PATH_MAX];
+	static char data[8 * BLOCK_SIZE], block[BLOCK_SIZE];
+
+	EXPECT(fresh_mount(img, "fallocate.img") == 0);
+	uint16_t ino;
+	EXPECT(rufs_create("/f", S_IFREG | 0644, &ino) == 0);
+	EXPECT(rufs_fallocate(ino, 0, 0, sizeof(data)) == 0);
+	memset(data, 0, sizeof(data));
+	EXPECT(read_back("/f", data, sizeof(data)) == 0);
+
+	// write into the reserved blocks, then punch some of them out again
+	fill_random(data + BLOCK_SIZE, 4 * BLOCK_SIZE, 8);
+	EXPECT(rufs_write(ino, data + BLOCK_SIZE, 4 * BLOCK_SIZE, BLOCK_SIZE) == 4 * BLOCK_SIZE);
+	EXPECT(rufs_fallocate(ino, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 2 * BLOCK_SIZE, 2 * BLOCK_SIZE) == 0);
+	memset(data + 2 * BLOCK_SIZE, 0, 2 * BLOCK_SIZE);
+	EXPECT(read_back("/f", data, sizeof(data)) == 0);
+	EXPECT(rufs_fallocate(ino, FALLOC_FL_PUNCH_HOLE, 0, BLOCK_SIZE) != 0);
+
+	EXPECT(remount(img) == 0);
+	EXPECT(read_back("/f", data, sizeof(data)) == 0);
+	EXPECT(rufs_open("/f", &ino) == 0);
+	fill_random(block, sizeof(block), 9);
+	EXPECT(rufs_write(ino, block, sizeof(block), 3 * BLOCK_SIZE) == BLOCK_SIZE);
+	memcpy(data + 3 * BLOCK_SIZE, block, sizeof(block));
+	EXPECT(remount(img) == 0);
+	EXPECT(read_back("/f", data, sizeof(data)) == 0);
+	return finish(img);
+}
+
+static int check_clone()
+{
+	char img[PATH_MAX];
+	static char data[10 * BLOCK_SIZE + 123], block[BLOCK_SIZE];
+	fill_random(data, sizeof(data), 10);
+
+	EXPECT(fresh_mount(img, "clone.img") == 0);
+	EXPECT(write_file("/src", data, sizeof(data)) >= 0);
+	uint16_t ino;
+	EXPECT(rufs_create("/dst", S_IFREG | 0644, &ino) == 0);
+	EXPECT(rufs_flush() == 0);
+	int used = amount_of_dblocks_used();
+	struct rufs_clone_range range = { .src_path = "/src", .src_offset = 0, .dest_offset = 0, .length = 0 };
+	EXPECT(rufs_ioctl(ino, RUFS_IOC_CLONE_RANGE, &range) == 0);
+	EXPECT(rufs_flush() == 0);
+	EXPECT(amount_of_dblocks_used() - used <= 1);
+	EXPECT(read_back("/dst", data, sizeof(data)) == 0);
+
+	// a write to the clone copies the block and leaves the source as it was
+	fill_random(block, sizeof(block), 11);
+	EXPECT(rufs_write(ino, block, sizeof(block), BLOCK_SIZE) == BLOCK_SIZE);
+	EXPECT(remount(img) == 0);
+	EXPECT(read_back("/src", data, sizeof(data)) == 0);
+	memcpy(data + BLOCK_SIZE, block, sizeof(block));
+	EXPECT(read_back("/dst", data, sizeof(data)) == 0);
+	return finish(img);
+}
+
+#define GROW_DIRS 8
+#define GROW_FILES 270
+
+static int check_grow()
+{
+	char img[PATH_MAX], path[64];
+	static char data[MAX_FILE_SIZE];
+
+	max_disk_size = 512 * 1024 * 1024;
+	EXPECT(fresh_mount(img, "grow.img") == 0);
+	uint16_t root;
+	EXPECT(rufs_opendir("/", &root) == 0);
+	uint64_t size = 64 * 1024 * 1024;
+	EXPECT(rufs_ioctl(root, RUFS_IOC_GROW, &size) == 0);
+	size = 1024 * 1024 * 1024;
+	EXPECT(rufs_ioctl(root, RUFS_IOC_GROW, &size) != 0);
+	struct stat st;
+	EXPECT(stat(img, &st) == 0 && st.st_size >= 64 * 1024 * 1024);
+
+	// more files and data than 64MB has inodes and blocks for, so both grow on their own too
+	for (int d = 0; d < GROW_DIRS; d++)
+	{
+		snprintf(path, sizeof(path), "/d%d", d);
+		EXPECT(rufs_mkdir(path, S_IFDIR | 0755) == 0);
+		for (int f = 0; f < GROW_FILES; f++)
+		{
+			snprintf(path, sizeof(path), "/d%d/f%d", d, f);
+			fill_random(data, sizeof(data), d * GROW_FILES + f);
+			EXPECT(write_file(path, data, sizeof(data)) >= 0);
+		}
+	}
+	EXPECT(remount(img) == 0);
+	EXPECT(stat(img, &st) == 0 && st.st_size > 64 * 1024 * 1024);
+	for (int d = 0; d < GROW_DIRS; d++)
+	{
+		for (int f = 0; f < GROW_FILES; f += 37)
+		{
+			snprintf(path, sizeof(path), "/d%d/f%d", d, f);
+			fill_random(data, sizeof(data), d * GROW_FILES + f);
+			EXPECT(read_back(path, data, sizeof(data)) == 0);
+		}
+	}
+	return finish(img);
+}
+
+static int check_fsck()
+{
+	char img[PATH_MAX];
+	char data[2 * BLOCK_SIZE];
+	fill_random(data, sizeof(data), 12);
+
+	EXPECT(fresh_mount(img, "fsck.img") == 0);
+	EXPECT(write_file("/f", data, sizeof(data)) >= 0);
+	// a block marked used that nothing points at
+	EXPECT(get_avail_blkno(0) != INVALID_DBLOCK);
+	rufs_unmount();
+
+	EXPECT(rufs_fsck(img, 0, 2) == 2);
+	EXPECT(rufs_fsck(img, 1, 2) == 1);
+	EXPECT(rufs_fsck(img, 0, 1) == 0);
+	EXPECT(rufs_mount(img) == 0);
+	EXPECT(read_back("/f", data, sizeof(data)) == 0);
+	EXPECT(finish(img) == 0);
+
+	char bogus[PATH_MAX];
+	int fd = open(scratch_path(bogus, "bogus.img"), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	EXPECT(fd >= 0);
+	EXPECT(ftruncate(fd, 1024 * 1024) == 0);
+	close(fd);
+	EXPECT(rufs_fsck(bogus, 0, 2) == -1);
+	return 0;
+}
+
+/* the tree under scratch/src on the host */
+static int make_tree()
+{
+	char path[PATH_MAX], name[PATH_MAX];
+	static char data[MAX_FILE_SIZE];
+	EXPECT(mkdir(scratch_path(path, "src"), 0755) == 0);
+	for (int i = 0; i < TREE_DIRS; i++)
+	{
+		snprintf(name, sizeof(name), "src/%s", tree_dirs[i]);
+		EXPECT(mkdir(scratch_path(path, name), 0755) == 0);
+	}
+	for (int i = 0; i < TREE_FILES; i++)
+	{
+		snprintf(name, sizeof(name), "src/%s", tree[i].path);
+		FILE *f = fopen(scratch_path(path, name), "w");
+		EXPECT(f != NULL);
+		fill_random(data, tree[i].size, 100 + i);
+		EXPECT(fwrite(data, 1, tree[i].size, f) == tree[i].size);
+		fclose(f);
+	}
+	return 0;
+}
+
+/* 0 if the mounted image has the tree of make_tree() */
+static int read_tree()
+{
+	char path[PATH_MAX];
+	static char data[MAX_FILE_SIZE];
+	for (int i = 0; i < TREE_FILES; i++)
+	{
+		snprintf(path, sizeof(path), "/%s", tree[i].path);
+		fill_random(data, tree[i].size, 100 + i);
+		EXPECT(read_back(path, data, tree[i].size) == 0);
+	}
+	return 0;
+}
+
+static int check_import()
+{
+	char img[PATH_MAX], src[PATH_MAX], cmd[3 * PATH_MAX];
+	scratch_path(img, "import.img");
+	snprintf(cmd, sizeof(cmd), "./rufs_import -j 2 %s %s >/dev/null", scratch_path(src, "src"), img);
+	EXPECT(run(cmd) == 0);
+	EXPECT(rufs_fsck(img, 0, 2) == 0);
+	EXPECT(rufs_mount(img) == 0);
+	EXPECT(read_tree() == 0);
+
+	// the imported image takes writes like any other
+	char data[100];
+	fill_random(data, sizeof(data), 13);
+	EXPECT(write_file("/sub/new", data, sizeof(data)) >= 0);
+	EXPECT(remount(img) == 0);
+	EXPECT(read_tree() == 0);
+	EXPECT(read_back("/sub/new", data, sizeof(data)) == 0);
+	return finish(img);
+}
+
+static int check_pack()
+{
+	char img[PATH_MAX], cut[PATH_MAX], src[PATH_MAX], cmd[3 * PATH_MAX];
+	scratch_path(img, "tree.pack");
+	snprintf(cmd, sizeof(cmd), "./rufs_pack %s %s >/dev/null", scratch_path(src, "src"), img);
+	EXPECT(run(cmd) == 0);
+	EXPECT(rufs_mount(img) == 0);
+	EXPECT(read_tree() == 0);
+	uint16_t ino;
+	EXPECT(rufs_create("/new", S_IFREG | 0644, &ino) == -EROFS);
+	EXPECT(rufs_open("/odd", &ino) == 0);
+	EXPECT(rufs_write(ino, "x", 1, 0) == -EROFS);
+	rufs_unmount();
+	EXPECT(rufs_mount(img) == 0);
+	EXPECT(read_tree() == 0);
+	rufs_unmount();
+
+	// a pack cut short is refused
+	struct stat st;
+	EXPECT(stat(img, &st) == 0);
+	snprintf(cmd, sizeof(cmd), "head -c %ld %s > %s", (long)st.st_size / 2, img, scratch_path(cut, "cut.pack"));
+	EXPECT(run(cmd) == 0);
+	EXPECT(rufs_mount(cut) != 0);
+	return 0;
+}
+
+/*
+ * A v1 image like the 32MB rufs made before SB_VERSION: fixed regions, 256 byte inodes and an
+ * inline file too long for v2, which rufs_migrate has to move to a data block
+ */
+static int make_v1_image(const char *img, const char *small, const char *spill, const char *data, int data_len)
+{
+	uint32_t i_start = 3;
+	uint32_t r_start = i_start + MAX_INUM * sizeof(struct inode_v1) / BLOCK_SIZE;
+	uint32_t f_start = r_start + REFCOUNT_BLOCKS(MAX_DNUM);
+	uint32_t c_start = f_start + FPRINT_BLOCKS(MAX_DNUM);
+	uint32_t d_start = c_start + CSUM_BLOCKS(MAX_DNUM);
+
+	int fd = open(img, O_CREAT | O_TRUNC | O_RDWR, 0644);
+	EXPECT(fd >= 0);
+	EXPECT(ftruncate(fd, (off_t)MAX_DNUM * BLOCK_SIZE) == 0);
+	char *block = calloc(1, BLOCK_SIZE);
+
+	struct superblock *sb = (struct superblock *)block;
+	sb->magic_num = MAGIC_NUM;
+	sb->max_inum = MAX_INUM;
+	sb->max_dnum = MAX_DNUM - d_start;
+	sb->i_bitmap_blk = 1;
+	sb->d_bitmap_blk = 2;
+	sb->i_start_blk = i_start;
+	sb->d_start_blk = d_start;
+	sb->features = FEATURE_REFCOUNT | FEATURE_IFLAGS | FEATURE_FPRINT;
+	sb->r_start_blk = r_start;
+	sb->f_start_blk = f_start;
+	sb->c_start_blk = c_start;
+	EXPECT(pwrite(fd, block, BLOCK_SIZE, 0) == BLOCK_SIZE);
+
+	// root, then one file in a data block and two inline
+	memset(block, 0, BLOCK_SIZE);
+	for (int i = 0; i < 4; i++)
+		set_bitmap((bitmap_t)block, i);
+	EXPECT(pwrite(fd, block, BLOCK_SIZE, 1 * BLOCK_SIZE) == BLOCK_SIZE);
+	memset(block, 0, BLOCK_SIZE);
+	set_bitmap((bitmap_t)block, 0);
+	set_bitmap((bitmap_t)block, 1);
+	EXPECT(pwrite(fd, block, BLOCK_SIZE, 2 * BLOCK_SIZE) == BLOCK_SIZE);
+
+	static const char *names[] = { ".", "data", "small", "spill" };
+	memset(block, 0, BLOCK_SIZE);
+	struct dirent *dirents = (struct dirent *)block;
+	for (int i = 0; i < 4; i++)
+	{
+		dirents[i].ino = i;
+		dirents[i].valid = VALID_DIRENT;
+		strcpy(dirents[i].name, names[i]);
+		dirents[i].len = strlen(names[i]);
+	}
+	EXPECT(pwrite(fd, block, BLOCK_SIZE, (off_t)d_start * BLOCK_SIZE) == BLOCK_SIZE);
+	memset(block, 0, BLOCK_SIZE);
+	memcpy(block, data, data_len);
+	EXPECT(pwrite(fd, block, BLOCK_SIZE, (off_t)(d_start + 1) * BLOCK_SIZE) == BLOCK_SIZE);
+
+	memset(block, 0, BLOCK_SIZE);
+	struct inode_v1 *inodes = (struct inode_v1 *)block;
+	for (int i = 0; i < 4; i++)
+	{
+		inodes[i].ino = i;
+		inodes[i].valid = VALID_INODE;
+		inodes[i].type = S_IFREG;
+		inodes[i].link = 1;
+		for (int p = 0; p < 16; p++)
+			inodes[i].direct_ptr[p] = INVALID_DBLOCK;
+	}
+	// a dir's link count is 2 and one for each entry dir_add() made
+	inodes[0].type = S_IFDIR;
+	inodes[0].link = 2 + 3;
+	inodes[0].size = BLOCK_SIZE;
+	inodes[0].direct_ptr[0] = 0;
+	inodes[1].size = data_len;
+	inodes[1].direct_ptr[0] = 1;
+	inodes[2].size = strlen(small);
+	inodes[2].flags = INODE_INLINE;
+	memcpy(inodes[2].inline_data, small, inodes[2].size);
+	inodes[3].size = strlen(spill);
+	inodes[3].flags = INODE_INLINE;
+	memcpy(inodes[3].inline_data, spill, inodes[3].size);
+	EXPECT(pwrite(fd, block, BLOCK_SIZE, (off_t)i_start * BLOCK_SIZE) == BLOCK_SIZE);
+
+	free(block);
+	close(fd);
+	return 0;
+}
+
+static int check_migrate()
+{
+	char img[PATH_MAX], cmd[2 * PATH_MAX];
+	char data[3000], small[40], spill[90];
+	fill_random(data, sizeof(data), 14);
+	memset(small, 's', sizeof(small));
+	small[sizeof(small) - 1] = '\0';
+	memset(spill, 'p', sizeof(spill));
+	spill[sizeof(spill) - 1] = '\0';
+
+	scratch_path(img, "v1.img");
+	EXPECT(make_v1_image(img, small, spill, data, sizeof(data)) == 0);
+	EXPECT(rufs_check_version(img) == -1);
+	EXPECT(rufs_fsck(img, 0, 2) == -1);
+	snprintf(cmd, sizeof(cmd), "./rufs_migrate %s >/dev/null", img);
+	EXPECT(run(cmd) == 0);
+	EXPECT(rufs_check_version(img) == 0);
+	EXPECT(rufs_fsck(img, 0, 2) == 0);
+	// a second run finds it is already v2 and leaves it alone
+	EXPECT(run(cmd) == 0);
+
+	EXPECT(rufs_mount(img) == 0);
+	EXPECT(read_back("/data", data, sizeof(data)) == 0);
+	EXPECT(read_back("/small", small, strlen(small)) == 0);
+	EXPECT(read_back("/spill", spill, strlen(spill)) == 0);
+	EXPECT(write_file("/new", data, sizeof(data)) >= 0);
+	EXPECT(remount(img) == 0);
+	EXPECT(read_back("/new", data, sizeof(data)) == 0);
+	EXPECT(read_back("/spill", spill, strlen(spill)) == 0);
+	return finish(img);
+}
+
+struct check {
+	const char *name;
+	int (*fn)();
+};
+
+static const struct check checks[] = {
+	{ "files", check_files },
+	{ "compress", check_compress },
+	{ "dedup", check_dedup },
+	{ "csum", check_csum },
+	{ "fallocate", check_fallocate },
+	{ "clone", check_clone },
+	{ "grow", check_grow },
+	{ "fsck", check_fsck },
+	{ "import", check_import },
+	{ "pack", check_pack },
+	{ "migrate", check_migrate },
+};
+
+int main(int argc, char *argv[])
+{
+	if (mkdtemp(scratch) == NULL)
+	{
+		perror(scratch);
+		return EXIT_FAILURE;
+	}
+	if (make_tree() == -1)
+	{
+		printf("FAIL could not make the tree to import under %s\n", scratch);
+		return EXIT_FAILURE;
+	}
+
+	int failed = 0;
+	for (int i = 0; i < sizeof(checks) / sizeof(checks[0]); i++)
+	{
+		printf("---- %s\n", checks[i].name);
+		fflush(stdout);
+		int status = -1;
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			int ret = checks[i].fn();
+			fflush(stdout);
+			_exit(ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+		if (pid > 0)
+			waitpid(pid, &status, 0);
+		int ok = pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+		printf("%s %s\n", ok ? "ok  " : "FAIL", checks[i].name);
+		if (!ok)
+			failed++;
+	}
+
+	char cmd[PATH_MAX];
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", scratch);
+	run(cmd);
+	printf("%d of %d checks failed\n", failed, (int)(sizeof(checks) / sizeof(checks[0])));
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
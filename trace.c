@@ -0,0 +1,76 @@
+/*
+ *	Tiny File System
+ *	File:	trace.c
+ *
+ *	the rings of trace.h. a thread gets its ring the first time it records, and rings are
+ *	kept until exit, so a dump sees the last events of threads that are gone
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+
+int trace_enabled = 0;
+__thread struct trace_ring *thread_ring = NULL;
+// every ring, newest first. only ever pushed to
+static struct trace_ring *all_rings = NULL;
+static int nr_rings = 0;
+
+struct trace_ring *trace_ring_new()
+{
+	struct trace_ring *r = calloc(1, sizeof(struct trace_ring));
+	if (r == NULL)
+		return NULL;
+	r->tid = __atomic_fetch_add(&nr_rings, 1, __ATOMIC_RELAXED);
+	r->next = __atomic_load_n(&all_rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&all_rings, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+	thread_ring = r;
+	return r;
+}
+
+/*
+ * Call it when nothing is recording any more (rufs_unmount()), a ring that is written
+ * while it is copied can have one torn event
+ */
+int trace_dump(const char *path)
+{
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+	struct trace_ring *first = __atomic_load_n(&all_rings, __ATOMIC_ACQUIRE);
+	struct trace_header hdr;
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.event_size = sizeof(struct trace_event);
+	hdr.nevents = 0;
+	for (struct trace_ring *r = first; r != NULL; r = r->next)
+	{
+		uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		hdr.nevents += (head < TRACE_RING_EVENTS) ? head : TRACE_RING_EVENTS;
+	}
+	fwrite(&hdr, sizeof(hdr), 1, f);
+
+	// Step 1: each ring oldest first, which is from head once it has wrapped
+	int written = 0;
+	for (struct trace_ring *r = first; r != NULL && written < hdr.nevents; r = r->next)
+	{
+		uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		uint64_t n = (head < TRACE_RING_EVENTS) ? head : TRACE_RING_EVENTS;
+		if (n > hdr.nevents - written)
+			n = hdr.nevents - written;
+		for (uint64_t k = head - n; k < head; k++)
+			fwrite(&r->ev[k & (TRACE_RING_EVENTS - 1)], sizeof(struct trace_event), 1, f);
+		written += n;
+	}
+	if (fclose(f) != 0)
+	{
+		perror(path);
+		return -1;
+	}
+	return written;
+}
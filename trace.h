@@ -0,0 +1,100 @@
+/*
+ *	Tiny File System
+ *	File:	trace.h
+ *
+ *	binary event trace. every thread records fixed size events into its own ring, with no
+ *	lock and no formatting, and trace_dump() writes all rings to a file for ./rufs_trace.
+ *	TRACE_LEVEL picks what is compiled in: 0 nothing, 1 FUSE operations, 2 also every
+ *	DISKFILE read and write. at run time nothing is recorded until trace_enabled is set
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL 1
+#endif
+
+/* per thread, a power of two. a ring keeps its thread's last this many events */
+#define TRACE_RING_EVENTS 8192
+#define TRACE_MAGIC "RUFSTRC1"
+
+/* what is traced. the FUSE operations come first, they are also the op_stats of librufs.h */
+enum rufs_op {
+	OP_GETATTR, OP_OPENDIR, OP_READDIR, OP_MKDIR, OP_RMDIR, OP_CREATE, OP_OPEN, OP_UNLINK,
+	OP_READ, OP_WRITE, OP_FALLOCATE, OP_IOCTL, OP_FLUSH, OP_COUNT,
+	OP_DEV_READ = OP_COUNT, OP_DEV_WRITE, TRACE_OP_COUNT
+};
+#define RUFS_OP_NAMES { \
+	"getattr", "opendir", "readdir", "mkdir", "rmdir", "create", "open", "unlink", \
+	"read", "write", "fallocate", "ioctl", "flush", "dev_read", "dev_write" }
+
+/*
+ * 32 bytes. path operations have no ino or offset, dev events have the byte offset in the
+ * DISKFILE, ioctl events have the cmd as size
+ */
+struct trace_event {
+	uint64_t ts_ns;		// CLOCK_MONOTONIC when it started
+	uint64_t offset;
+	uint32_t dur_ns;
+	uint32_t size;
+	int32_t ret;
+	uint16_t ino;
+	uint8_t op;
+	uint8_t tid;		// which ring, in the order threads first traced
+};
+
+/* a trace file is this and then nevents events, each ring oldest first */
+struct trace_header {
+	char magic[8];
+	uint32_t event_size;
+	uint32_t nevents;
+};
+
+struct trace_ring {
+	uint64_t head;				// events ever recorded, only its own thread writes it
+	struct trace_ring *next;	// every ring, for trace_dump()
+	uint8_t tid;
+	struct trace_event ev[TRACE_RING_EVENTS];
+};
+
+extern int trace_enabled;
+extern __thread struct trace_ring *thread_ring;
+struct trace_ring *trace_ring_new();
+/* write every ring to path. returns the events written, -1 on failure */
+int trace_dump(const char *path);
+
+static inline void trace_record(int op, uint16_t ino, uint64_t offset, uint32_t size, uint64_t t0, uint64_t t1, int ret)
+{
+	struct trace_ring *r = thread_ring;
+	if (r == NULL && (r = trace_ring_new()) == NULL)
+		return;
+	struct trace_event *e = &r->ev[r->head & (TRACE_RING_EVENTS - 1)];
+	e->ts_ns = t0;
+	e->offset = offset;
+	e->dur_ns = (t1 - t0 > UINT32_MAX) ? UINT32_MAX : t1 - t0;
+	e->size = size;
+	e->ret = ret;
+	e->ino = ino;
+	e->op = op;
+	e->tid = r->tid;
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+#if TRACE_LEVEL >= 1
+#define TRACE_OP(op, ino, offset, size, t0, t1, ret) \
+	do { if (trace_enabled) trace_record(op, ino, offset, size, t0, t1, ret); } while (0)
+#else
+#define TRACE_OP(op, ino, offset, size, t0, t1, ret) ((void)0)
+#endif
+
+#if TRACE_LEVEL >= 2
+#define TRACE_DEV(op, offset, size, t0, t1, ret) \
+	do { if (trace_enabled) trace_record(op, 0, offset, size, t0, t1, ret); } while (0)
+#else
+#define TRACE_DEV(op, offset, size, t0, t1, ret) ((void)0)
+#endif
+
+#endif